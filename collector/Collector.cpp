@@ -0,0 +1,230 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <chrono>
+#include <limits>
+
+#include "Collector.h"
+
+#define IDLE_SLEEP       200    // Sleep time of an idle thread, in µs
+#define STORE_BATCH      1024   // Maximum number of strikes stored before correlating
+#define CORRELATE_PERIOD  100   // Period of correlation runs, in ms
+#define BUCKETS_PER_OCTAVE  4
+
+static void idle() {
+    std::this_thread::sleep_for(std::chrono::microseconds(IDLE_SLEEP));
+}
+
+LatencyHistogram::LatencyHistogram() {
+    memset(buckets, 0, sizeof(buckets));
+    this->count = 0;
+    this->sum = 0;
+    this->max = 0;
+}
+
+void LatencyHistogram::add(int64_t latency) {
+    if (latency < 0) {
+        latency = 0;
+    }
+    int bucket = (int) (log2((double) latency + 1.0) * BUCKETS_PER_OCTAVE);
+    buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    count++;
+    sum += latency;
+    if (latency > max) {
+        max = latency;
+    }
+}
+
+int64_t LatencyHistogram::getPercentile(double percentile) const {
+    unsigned long limit = (unsigned long) ceil(count * percentile / 100.0);
+    unsigned long seen = 0;
+    for (int ix = 0; ix < LATENCY_BUCKETS; ix++) {
+        seen += buckets[ix];
+        if (seen >= limit && seen > 0) {
+            int64_t upper = (int64_t) exp2((ix + 1.0) / BUCKETS_PER_OCTAVE) - 1;
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+Collector::Collector(Fleet& fleet, const CollectorOptions& options)
+        : fleet(fleet), options(options),
+          strikeQueue(new LockFreeQueue<Strike, STRIKE_QUEUE_SIZE>()),
+          correlator(store, fleet, options.window) {
+    this->workersStopping.store(false);
+    this->storeStopping.store(false);
+    this->backpressure.store(0);
+    this->stored = 0;
+
+    for (int ix = 0; ix < options.workers; ix++) {
+        Worker* worker = new Worker();
+        worker->inbox.reset(new LockFreeQueue<Message, INBOX_SIZE>());
+        worker->messages.store(0);
+        worker->invalid.store(0);
+        worker->strikes.store(0);
+        worker->duplicates.store(0);
+        workers.push_back(std::unique_ptr<Worker>(worker));
+    }
+}
+
+Collector::~Collector() {
+    stop();
+}
+
+void Collector::start(std::function<void(const Correlation&)> handler) {
+    this->handler = handler;
+    for (size_t ix = 0; ix < workers.size(); ix++) {
+        Worker& worker = *workers[ix];
+        worker.thread = std::thread([this, &worker]() { runWorker(worker); });
+    }
+    storeThread = std::thread([this]() { runStore(); });
+}
+
+void Collector::submit(Message& message) {
+    // Every node is always handled by the same worker
+    Worker& worker = *workers[message.node % workers.size()];
+    if (worker.inbox->push(message)) {
+        return;
+    }
+    backpressure.fetch_add(1, std::memory_order_relaxed);
+    do {
+        std::this_thread::yield();
+    } while (!worker.inbox->push(message));
+}
+
+void Collector::stop() {
+    if (!storeThread.joinable()) {
+        return;
+    }
+    workersStopping.store(true);
+    for (size_t ix = 0; ix < workers.size(); ix++) {
+        workers[ix]->thread.join();
+    }
+    storeStopping.store(true);
+    storeThread.join();
+}
+
+CollectorStats Collector::getStats() const {
+    CollectorStats stats;
+    memset(&stats, 0, sizeof(CollectorStats));
+    for (size_t ix = 0; ix < workers.size(); ix++) {
+        const Worker& worker = *workers[ix];
+        stats.messages += worker.messages.load();
+        stats.invalid += worker.invalid.load();
+        stats.strikes += worker.strikes.load();
+        stats.duplicates += worker.duplicates.load();
+    }
+    stats.stored = stored;
+    stats.backpressure = backpressure.load();
+    return stats;
+}
+
+void Collector::runWorker(Worker& worker) {
+    Message message;
+    std::vector<Strike> strikes;
+    MessageInfo info;
+
+    for (;;) {
+        if (!worker.inbox->pop(message)) {
+            // the producers are stopped before, so an empty inbox stays empty
+            if (workersStopping.load()) {
+                break;
+            }
+            idle();
+            continue;
+        }
+
+        worker.messages.fetch_add(1, std::memory_order_relaxed);
+        strikes.clear();
+        if (!parseMessage(message, strikes, info)) {
+            worker.invalid.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (message.type == MESSAGE_STATUS) {
+            Node& node = fleet[message.node];
+            worker.deduplicator.updateCursor(message.node, info.detector, info.cursor);
+            node.cursors[info.detector].store(info.cursor, std::memory_order_relaxed);
+            if (info.detectors > 0 && info.detectors <= MAX_DETECTORS) {
+                node.detectors.store(info.detectors, std::memory_order_relaxed);
+            }
+        }
+
+        worker.strikes.fetch_add(strikes.size(), std::memory_order_relaxed);
+        for (size_t ix = 0; ix < strikes.size(); ix++) {
+            if (!worker.deduplicator.accept(strikes[ix])) {
+                worker.duplicates.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (!strikeQueue->push(strikes[ix])) {
+                backpressure.fetch_add(1, std::memory_order_relaxed);
+                do {
+                    std::this_thread::yield();
+                } while (!strikeQueue->push(strikes[ix]));
+            }
+        }
+    }
+}
+
+void Collector::runStore() {
+    int64_t lastCorrelation = wallTime();
+    Strike strike;
+
+    for (;;) {
+        int count = 0;
+        while (count < STORE_BATCH && strikeQueue->pop(strike)) {
+            storeLatency.add(monotonicTime() - strike.stamp);
+            correlator.add(strike);
+            stored++;
+            count++;
+        }
+
+        int64_t now = wallTime();
+        if (now - lastCorrelation >= CORRELATE_PERIOD) {
+            correlate(now - options.window - options.lateness);
+            correlator.expire(now - options.retention);
+            lastCorrelation = now;
+        }
+
+        if (count == 0) {
+            // the workers are stopped before, so an empty queue stays empty
+            if (storeStopping.load()) {
+                break;
+            }
+            idle();
+        }
+    }
+
+    // close all remaining windows
+    correlate(std::numeric_limits<int64_t>::max());
+}
+
+void Collector::correlate(int64_t watermark) {
+    std::vector<Correlation> results;
+    correlator.process(watermark, results);
+    int64_t now = monotonicTime();
+    for (size_t ix = 0; ix < results.size(); ix++) {
+        correlationLatency.add(now - results[ix].stamp);
+        if (handler) {
+            handler(results[ix]);
+        }
+    }
+}
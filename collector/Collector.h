@@ -0,0 +1,183 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Collector__
+#define __Collector__
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Correlator.h"
+#include "Event.h"
+#include "Fleet.h"
+#include "Ingest.h"
+#include "Queue.h"
+#include "Store.h"
+
+#define INBOX_SIZE       4096   // Capacity of the message queue of every worker
+#define STRIKE_QUEUE_SIZE 65536 // Capacity of the queue between the workers and the store
+#define LATENCY_BUCKETS   128   // Number of buckets of a LatencyHistogram
+
+/**
+ * Histogram of latencies, with logarithmic buckets of about 19% width. It uses
+ * constant memory, no matter how long the collector is running.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    /**
+     * Add a latency, in µs.
+     */
+    void add(int64_t latency);
+
+    unsigned long getCount() const  { return count; }
+    int64_t getMax() const          { return max; }
+    double getAverage() const       { return count > 0 ? (double) sum / count : 0.0; }
+
+    /**
+     * Return the upper bound of the given percentile, in µs.
+     */
+    int64_t getPercentile(double percentile) const;
+
+private:
+    unsigned long buckets[LATENCY_BUCKETS];
+    unsigned long count;
+    int64_t sum;
+    int64_t max;
+};
+
+/**
+ * Configuration of the Collector.
+ */
+struct CollectorOptions {
+    int workers = 4;                // number of ingestion workers
+    int64_t window = 2000;          // correlation window, in ms
+    int64_t lateness = 5000;        // maximum delay of a message, in ms
+    int64_t retention = 3600000;    // time to keep strikes in the store, in ms
+};
+
+/**
+ * Statistics of the Collector. The counters are only consistent after stop().
+ */
+struct CollectorStats {
+    unsigned long messages;         // messages that were processed
+    unsigned long invalid;          // messages that could not be parsed
+    unsigned long strikes;          // strikes in the processed messages
+    unsigned long duplicates;       // strikes that were dropped as duplicate
+    unsigned long stored;           // strikes that were stored
+    unsigned long backpressure;     // times a queue was full and a producer had to wait
+};
+
+/**
+ * Ingests the messages of all nodes, and correlates their strikes.
+ *
+ * Messages are submitted by any number of producer threads, and are handed to a fixed
+ * number of ingestion workers via lock-free queues. Every node is always handled by the
+ * same worker, so the per-node state of the deduplication needs no locking. The workers
+ * parse the messages, drop duplicates, and pass the strikes to the store thread via
+ * another lock-free queue. The store thread owns the StrikeStore and the Correlator, so
+ * they need no locking either.
+ *
+ * If a queue is full, the producer yields until there is room again, so a slow store
+ * slows down the ingestion instead of losing messages.
+ */
+class Collector {
+public:
+    /**
+     * Create a new Collector.
+     *
+     * @param fleet     All nodes
+     * @param options   Configuration
+     */
+    Collector(Fleet& fleet, const CollectorOptions& options);
+    ~Collector();
+
+    /**
+     * Start the worker and store threads.
+     *
+     * @param handler   Invoked by the store thread for every correlation
+     */
+    void start(std::function<void(const Correlation&)> handler);
+
+    /**
+     * Submit a message. It is moved into the queue. Waits if the queue is full.
+     * May be invoked by any thread.
+     */
+    void submit(Message& message);
+
+    /**
+     * Process all pending messages, correlate all remaining strikes, and stop all
+     * threads.
+     */
+    void stop();
+
+    /**
+     * Return the statistics.
+     */
+    CollectorStats getStats() const;
+
+    const CorrelatorStats& getCorrelatorStats() const   { return correlator.getStats(); }
+
+    /**
+     * Latency from the reception of a message until the strike is stored.
+     */
+    const LatencyHistogram& getStoreLatency() const     { return storeLatency; }
+
+    /**
+     * Latency from the reception of the last report until the correlation is found.
+     * It includes the correlation window and the lateness.
+     */
+    const LatencyHistogram& getCorrelationLatency() const { return correlationLatency; }
+
+private:
+    struct Worker {
+        std::thread thread;
+        std::unique_ptr<LockFreeQueue<Message, INBOX_SIZE> > inbox;
+        Deduplicator deduplicator;
+        std::atomic<unsigned long> messages;
+        std::atomic<unsigned long> invalid;
+        std::atomic<unsigned long> strikes;
+        std::atomic<unsigned long> duplicates;
+    };
+
+    Fleet& fleet;
+    CollectorOptions options;
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::unique_ptr<LockFreeQueue<Strike, STRIKE_QUEUE_SIZE> > strikeQueue;
+    std::thread storeThread;
+    std::function<void(const Correlation&)> handler;
+    std::atomic<bool> workersStopping;
+    std::atomic<bool> storeStopping;
+    std::atomic<unsigned long> backpressure;
+    unsigned long stored;
+
+    StrikeStore store;
+    Correlator correlator;
+    LatencyHistogram storeLatency;
+    LatencyHistogram correlationLatency;
+
+    void runWorker(Worker& worker);
+    void runStore();
+    void correlate(int64_t watermark);
+};
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "Correlator.h"
+
+#define DISTANCE_REL_ERROR  0.3     // Relative error of the AS3935 distance estimation
+#define DISTANCE_ABS_ERROR  2.0     // Absolute error of the AS3935 distance estimation, in km
+#define OVERHEAD_RANGE      5.0     // Maximum distance of an "overhead" storm, in km
+#define MAX_RANGE          40.0     // Maximum distance that is reported by the AS3935, in km
+#define FIT_ITERATIONS     20       // Maximum number of Gauss-Newton iterations
+#define FIT_PRECISION       0.01    // Position change that ends the fit, in km
+
+/**
+ * Return the range of true distances that is consistent with a reported distance.
+ */
+static void distanceRange(uint8_t distance, double& low, double& high) {
+    if (distance == OUT_OF_RANGE) {
+        low = MAX_RANGE * (1.0 - DISTANCE_REL_ERROR) - DISTANCE_ABS_ERROR;
+        high = INFINITY;
+    } else if (distance <= 1) {
+        low = 0.0;
+        high = OVERHEAD_RANGE * (1.0 + DISTANCE_REL_ERROR) + DISTANCE_ABS_ERROR;
+    } else {
+        low = distance * (1.0 - DISTANCE_REL_ERROR) - DISTANCE_ABS_ERROR;
+        high = distance * (1.0 + DISTANCE_REL_ERROR) + DISTANCE_ABS_ERROR;
+    }
+    if (low < 0.0) {
+        low = 0.0;
+    }
+}
+
+/**
+ * Return the distance that is used for the position fit.
+ */
+static double fitDistance(uint8_t distance) {
+    return distance <= 1 ? OVERHEAD_RANGE / 2.0 : distance;
+}
+
+Correlator::Correlator(StrikeStore& store, const Fleet& fleet, int64_t window)
+        : store(store), fleet(fleet) {
+    this->window = window;
+    this->next = 0;
+    this->nextId = 1;
+    memset(&this->stats, 0, sizeof(CorrelatorStats));
+}
+
+void Correlator::add(const Strike& strike) {
+    size_t row = store.insert(strike);
+    if (row < next) {
+        // the window of this strike was already closed
+        store.setCluster(row, CLUSTER_LATE);
+        next++;
+        stats.late++;
+    }
+}
+
+void Correlator::expire(int64_t before) {
+    size_t removed = store.expire(before);
+    next = removed < next ? next - removed : 0;
+}
+
+bool Correlator::consistent(size_t a, size_t b) const {
+    const Node& nodeA = fleet[store.getNode(a)];
+    const Node& nodeB = fleet[store.getNode(b)];
+    if (!nodeA.hasPosition || !nodeB.hasPosition) {
+        return true;
+    }
+
+    double lowA, highA, lowB, highB;
+    distanceRange(store.getDistance(a), lowA, highA);
+    distanceRange(store.getDistance(b), lowB, highB);
+
+    // Both rings around the nodes must intersect
+    double separation = hypot(nodeA.x - nodeB.x, nodeA.y - nodeB.y);
+    return separation <= highA + highB
+        && separation >= lowA - highB
+        && separation >= lowB - highA;
+}
+
+bool Correlator::contains(size_t row, double x, double y) const {
+    const Node& node = fleet[store.getNode(row)];
+    if (!node.hasPosition) {
+        return true;
+    }
+    double low, high;
+    distanceRange(store.getDistance(row), low, high);
+    double distance = hypot(x - node.x, y - node.y);
+    return distance >= low && distance <= high;
+}
+
+void Correlator::process(int64_t watermark, std::vector<Correlation>& results) {
+    std::vector<size_t> candidates;
+    std::vector<size_t> members;
+    for (; next < store.size() && store.getTime(next) <= watermark; next++) {
+        if (store.getCluster(next) != CLUSTER_PENDING) {
+            continue;
+        }
+
+        if (store.getDistance(next) == OUT_OF_RANGE) {
+            // without a distance, the report would match about any other report
+            store.setCluster(next, CLUSTER_SINGLE);
+            stats.singles++;
+            continue;
+        }
+
+        // Collect the consistent reports of other nodes within the window, closest first
+        int64_t seedTime = store.getTime(next);
+        candidates.clear();
+        for (size_t row = next + 1; row < store.size() && store.getTime(row) <= seedTime + window; row++) {
+            if (store.getCluster(row) == CLUSTER_PENDING && store.getNode(row) != store.getNode(next)
+                    && store.getDistance(row) != OUT_OF_RANGE && consistent(next, row)) {
+                candidates.push_back(row);
+            }
+        }
+        std::stable_sort(candidates.begin(), candidates.end(), [this, seedTime](size_t a, size_t b) {
+            return store.getTime(a) - seedTime < store.getTime(b) - seedTime;
+        });
+
+        // Greedily take one consistent report per node
+        members.clear();
+        members.push_back(next);
+        for (size_t ix = 0; ix < candidates.size(); ix++) {
+            size_t row = candidates[ix];
+            bool matches = true;
+            for (size_t m = 1; m < members.size() && matches; m++) {
+                matches = store.getNode(members[m]) != store.getNode(row)
+                        && consistent(members[m], row);
+            }
+            if (matches) {
+                members.push_back(row);
+            }
+        }
+
+        Correlation result;
+        result.located = locate(members, result.x, result.y, result.residual);
+        if (result.located) {
+            // Release the reports that do not match the position, they may belong to
+            // another lightning
+            size_t kept = 1;
+            for (size_t ix = 1; ix < members.size(); ix++) {
+                if (contains(members[ix], result.x, result.y)) {
+                    members[kept++] = members[ix];
+                }
+            }
+            if (kept < members.size()) {
+                members.resize(kept);
+                result.located = locate(members, result.x, result.y, result.residual);
+            }
+        }
+
+        if (members.size() < 2) {
+            store.setCluster(next, CLUSTER_SINGLE);
+            stats.singles++;
+            continue;
+        }
+
+        result.id = nextId++;
+        result.time = seedTime;
+        result.stamp = 0;
+        for (size_t ix = 0; ix < members.size(); ix++) {
+            store.setCluster(members[ix], result.id);
+            result.nodes.push_back(store.getNode(members[ix]));
+            result.distances.push_back(store.getDistance(members[ix]));
+            result.energies.push_back(store.getEnergy(members[ix]));
+            if (store.getStamp(members[ix]) > result.stamp) {
+                result.stamp = store.getStamp(members[ix]);
+            }
+        }
+        stats.correlations++;
+        if (result.located) {
+            stats.located++;
+        }
+        results.push_back(result);
+    }
+}
+
+bool Correlator::locate(const std::vector<size_t>& rows, double& x, double& y, double& residual) const {
+    x = 0.0;
+    y = 0.0;
+    residual = 0.0;
+
+    std::vector<const Node*> nodes;
+    std::vector<double> distances;
+    for (size_t ix = 0; ix < rows.size(); ix++) {
+        const Node& node = fleet[store.getNode(rows[ix])];
+        if (node.hasPosition) {
+            nodes.push_back(&node);
+            distances.push_back(fitDistance(store.getDistance(rows[ix])));
+        }
+    }
+    if (nodes.size() < 3) {
+        // two rings intersect at two points, so the position is ambiguous
+        return false;
+    }
+
+    // Start at the centroid, weighted towards the closer nodes
+    double weights = 0.0;
+    for (size_t ix = 0; ix < nodes.size(); ix++) {
+        double weight = 1.0 / (distances[ix] + 1.0);
+        x += nodes[ix]->x * weight;
+        y += nodes[ix]->y * weight;
+        weights += weight;
+    }
+    x /= weights;
+    y /= weights;
+
+    // Gauss-Newton fit of the distances
+    for (int iteration = 0; iteration < FIT_ITERATIONS; iteration++) {
+        double jxx = 0.0, jxy = 0.0, jyy = 0.0, ex = 0.0, ey = 0.0;
+        for (size_t ix = 0; ix < nodes.size(); ix++) {
+            double dx = x - nodes[ix]->x;
+            double dy = y - nodes[ix]->y;
+            double range = hypot(dx, dy);
+            if (range < 1e-3) {
+                range = 1e-3;
+            }
+            double gx = dx / range;
+            double gy = dy / range;
+            double error = range - distances[ix];
+            jxx += gx * gx;
+            jxy += gx * gy;
+            jyy += gy * gy;
+            ex += gx * error;
+            ey += gy * error;
+        }
+        double det = jxx * jyy - jxy * jxy;
+        if (fabs(det) < 1e-9) {
+            // nodes are in a line, the position is ambiguous
+            return false;
+        }
+        double stepX = -(jyy * ex - jxy * ey) / det;
+        double stepY = -(jxx * ey - jxy * ex) / det;
+        x += stepX;
+        y += stepY;
+        if (hypot(stepX, stepY) < FIT_PRECISION) {
+            break;
+        }
+    }
+
+    double sum = 0.0;
+    for (size_t ix = 0; ix < nodes.size(); ix++) {
+        double error = hypot(x - nodes[ix]->x, y - nodes[ix]->y) - distances[ix];
+        sum += error * error;
+    }
+
+    residual = sqrt(sum / nodes.size());
+    return true;
+}
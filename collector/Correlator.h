@@ -0,0 +1,110 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Correlator__
+#define __Correlator__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Event.h"
+#include "Fleet.h"
+#include "Store.h"
+
+/**
+ * Statistics of the Correlator.
+ */
+struct CorrelatorStats {
+    unsigned long correlations;     // strikes seen by several nodes
+    unsigned long located;          // correlations with a computed position
+    unsigned long singles;          // strikes only seen by one node
+    unsigned long late;             // strikes that arrived too late for correlation
+};
+
+/**
+ * Finds strikes that were reported by several nodes.
+ *
+ * Strikes of different nodes belong to the same lightning if their times are within
+ * the correlation window, and if their distances are consistent with the positions of
+ * the nodes. The AS3935 distance estimation is coarse, so every reported distance is
+ * widened to a range, and two reports are consistent if the rings around both nodes
+ * intersect. Nodes without a known position are only correlated by time.
+ *
+ * Reports of lightnings that are out of range carry no distance, so they would match
+ * about any other report. They are not correlated.
+ *
+ * If at least three nodes with known positions reported the lightning, its position is
+ * computed by a least squares fit of the distances. Reports that do not match the
+ * position are released again, as they probably belong to another lightning.
+ *
+ * Strikes are correlated when the window is closed, i.e. when the time is older than
+ * the watermark passed to process(). Strikes that arrive after that are counted as late.
+ */
+class Correlator {
+public:
+    /**
+     * Create a new Correlator.
+     *
+     * @param store     Store of all strikes
+     * @param fleet     Node positions
+     * @param window    Maximum time difference of the reports of a lightning, in ms
+     */
+    Correlator(StrikeStore& store, const Fleet& fleet, int64_t window);
+
+    /**
+     * Add a strike to the store.
+     */
+    void add(const Strike& strike);
+
+    /**
+     * Correlate all strikes up to the watermark.
+     *
+     * @param watermark Time up to which all strikes are assumed to have arrived
+     * @param results   Receives the correlations that were found
+     */
+    void process(int64_t watermark, std::vector<Correlation>& results);
+
+    /**
+     * Remove all strikes before the given time from the store.
+     */
+    void expire(int64_t before);
+
+    /**
+     * Return the correlation window, in ms.
+     */
+    int64_t getWindow() const {
+        return window;
+    }
+
+    const CorrelatorStats& getStats() const {
+        return stats;
+    }
+
+private:
+    StrikeStore& store;
+    const Fleet& fleet;
+    int64_t window;
+    size_t next;                    // first row that was not processed yet
+    uint32_t nextId;
+    CorrelatorStats stats;
+
+    bool consistent(size_t a, size_t b) const;
+    bool contains(size_t row, double x, double y) const;
+    bool locate(const std::vector<size_t>& rows, double& x, double& y, double& residual) const;
+};
+
+#endif
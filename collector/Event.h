@@ -0,0 +1,92 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Event__
+#define __Event__
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define OUT_OF_RANGE 0x3F   // Distance of a lightning that is out of range
+
+/**
+ * Source format of a message.
+ */
+enum MessageType {
+    MESSAGE_STATUS,         // response of the /status endpoint
+    MESSAGE_MQTT            // MQTT event payload
+};
+
+/**
+ * A raw message of a node, as it was received.
+ */
+struct Message {
+    int node;               // index of the sending node
+    MessageType type;
+    int64_t received;       // wall clock time of reception, in ms since epoch
+    int64_t stamp;          // monotonic time of reception, in µs, for latency measurement
+    std::string payload;
+};
+
+/**
+ * A lightning that was detected by a node.
+ */
+struct Strike {
+    int64_t time;           // estimated time of the lightning, in ms since epoch
+    int64_t stamp;          // monotonic time of reception, in µs
+    uint32_t seq;           // sequence number of the node's detector, 0 if unknown
+    uint32_t energy;
+    uint16_t node;
+    uint8_t detector;
+    uint8_t distance;       // estimated distance in km, or OUT_OF_RANGE
+};
+
+/**
+ * A lightning that was detected by several nodes.
+ */
+struct Correlation {
+    uint32_t id;
+    int64_t time;           // time of the earliest report, in ms since epoch
+    int64_t stamp;          // monotonic time of the latest report, in µs
+    std::vector<uint16_t> nodes;        // reporting nodes
+    std::vector<uint8_t> distances;     // reported distances, by node
+    std::vector<uint32_t> energies;     // reported energies, by node
+    bool located;           // true if the position could be computed
+    double x;               // position on the local plane, in km
+    double y;
+    double residual;        // RMS of the distance residuals, in km
+};
+
+/**
+ * Return the wall clock time, in ms since epoch.
+ */
+inline int64_t wallTime() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Return the monotonic time, in µs.
+ */
+inline int64_t monotonicTime() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
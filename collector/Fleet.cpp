@@ -0,0 +1,132 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "Fleet.h"
+
+#define KM_PER_DEGREE_LATITUDE 110.574
+#define KM_PER_DEGREE_EQUATOR  111.320
+
+Fleet::Fleet() : nodes(new Node[MAX_NODES]) {
+    this->count.store(0);
+    this->hasOrigin = false;
+    this->originLatitude = 0.0;
+    this->originLongitude = 0.0;
+    this->kmPerDegreeLongitude = KM_PER_DEGREE_EQUATOR;
+}
+
+bool Fleet::load(const char* file) {
+    std::ifstream in(file);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", file);
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string name, address;
+        if (!(fields >> name) || name[0] == '#') {
+            continue;
+        }
+        if (!(fields >> address)) {
+            fprintf(stderr, "%s:%d: host is missing\n", file, lineNumber);
+            return false;
+        }
+
+        std::string host;
+        int port = 80;
+        if (address != "-") {
+            size_t colon = address.find(':');
+            host = address.substr(0, colon);
+            if (colon != std::string::npos) {
+                port = atoi(address.c_str() + colon + 1);
+            }
+        }
+
+        int index = add(name, host, port);
+        if (index < 0) {
+            fprintf(stderr, "%s:%d: duplicate node or too many nodes\n", file, lineNumber);
+            return false;
+        }
+
+        double latitude, longitude;
+        if (fields >> latitude >> longitude) {
+            setPosition(index, latitude, longitude);
+        }
+    }
+    return true;
+}
+
+int Fleet::add(const std::string& name, const std::string& host, int port) {
+    size_t index = count.load(std::memory_order_relaxed);
+    if (index >= MAX_NODES || names.count(name) > 0) {
+        return -1;
+    }
+
+    Node& node = nodes[index];
+    node.name = name;
+    node.host = host;
+    node.port = port;
+    node.hasPosition = false;
+    node.latitude = 0.0;
+    node.longitude = 0.0;
+    node.x = 0.0;
+    node.y = 0.0;
+    for (int ix = 0; ix < MAX_DETECTORS; ix++) {
+        node.cursors[ix].store(0, std::memory_order_relaxed);
+    }
+    node.detectors.store(1, std::memory_order_relaxed);
+
+    names[name] = index;
+    count.store(index + 1, std::memory_order_release);
+    return index;
+}
+
+int Fleet::find(const std::string& name) const {
+    std::unordered_map<std::string, int>::const_iterator it = names.find(name);
+    return it != names.end() ? it->second : -1;
+}
+
+void Fleet::setPosition(int index, double latitude, double longitude) {
+    if (!hasOrigin) {
+        originLatitude = latitude;
+        originLongitude = longitude;
+        kmPerDegreeLongitude = KM_PER_DEGREE_EQUATOR * cos(latitude * M_PI / 180.0);
+        hasOrigin = true;
+    }
+
+    Node& node = nodes[index];
+    node.latitude = latitude;
+    node.longitude = longitude;
+    node.x = (longitude - originLongitude) * kmPerDegreeLongitude;
+    node.y = (latitude - originLatitude) * KM_PER_DEGREE_LATITUDE;
+    node.hasPosition = true;
+}
+
+void Fleet::toLatLon(double x, double y, double& latitude, double& longitude) const {
+    latitude = originLatitude + y / KM_PER_DEGREE_LATITUDE;
+    longitude = originLongitude + x / kmPerDegreeLongitude;
+}
@@ -0,0 +1,120 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Fleet__
+#define __Fleet__
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#define MAX_NODES 4096      // Maximum number of Kaminari nodes
+#define MAX_DETECTORS 4     // Maximum number of detectors per node, see AS3935_MAX_INSTANCES
+
+/**
+ * A Kaminari node.
+ */
+struct Node {
+    std::string name;                   // name of the node, also its MQTT topic
+    std::string host;                   // host to poll /status from, empty if not polled
+    int port;
+    bool hasPosition;
+    double latitude;
+    double longitude;
+    double x;                           // position on the local plane, in km
+    double y;
+    std::atomic<uint32_t> cursors[MAX_DETECTORS];   // last /status cursor, by detector
+    std::atomic<int> detectors;         // number of detectors, as reported by /status
+};
+
+/**
+ * All known Kaminari nodes.
+ *
+ * Nodes are referred to by their index. The node table never moves, so other threads
+ * can use a node as soon as they got its index. Only the setup and a single ingestion
+ * thread may add nodes.
+ *
+ * Node positions are projected to a local plane in km, with the first positioned node
+ * as origin. This is precise enough for the range of an AS3935.
+ */
+class Fleet {
+public:
+    Fleet();
+
+    /**
+     * Read nodes from a file. Every line contains a node:
+     *
+     *   <name> <host>[:<port>] [<latitude> <longitude>]
+     *
+     * The host is '-' if the node is not polled. Empty lines and lines starting with
+     * '#' are ignored.
+     *
+     * @param file      File name
+     * @return true if the file was read, false if it could not be read or is invalid
+     */
+    bool load(const char* file);
+
+    /**
+     * Add a node.
+     *
+     * @param name      Name of the node
+     * @param host      Host to poll /status from, empty if not polled
+     * @param port      Port to poll /status from
+     * @return Index of the new node, or -1 if the table is full or the name is taken
+     */
+    int add(const std::string& name, const std::string& host = std::string(), int port = 80);
+
+    /**
+     * Find a node by its name.
+     *
+     * @return Index of the node, or -1 if there is no such node
+     */
+    int find(const std::string& name) const;
+
+    /**
+     * Set the position of a node.
+     */
+    void setPosition(int index, double latitude, double longitude);
+
+    /**
+     * Convert a position on the local plane back to latitude and longitude.
+     */
+    void toLatLon(double x, double y, double& latitude, double& longitude) const;
+
+    /**
+     * Return the number of nodes.
+     */
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    Node& operator[](size_t index)              { return nodes[index]; }
+    const Node& operator[](size_t index) const  { return nodes[index]; }
+
+private:
+    std::unique_ptr<Node[]> nodes;
+    std::atomic<size_t> count;
+    std::unordered_map<std::string, int> names;
+    bool hasOrigin;
+    double originLatitude;
+    double originLongitude;
+    double kmPerDegreeLongitude;
+};
+
+#endif
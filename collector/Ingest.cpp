@@ -0,0 +1,120 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "Fleet.h"
+#include "Ingest.h"
+#include "Json.h"
+
+static uint8_t readDistance(const JsonValue& value) {
+    double distance = value.asNumber(OUT_OF_RANGE);
+    return distance >= 0.0 && distance < OUT_OF_RANGE ? (uint8_t) distance : OUT_OF_RANGE;
+}
+
+static Strike makeStrike(const Message& message, const JsonValue& event, const char* age, int detector) {
+    Strike strike;
+    strike.time = message.received - (int64_t) (event[age].asNumber() * 1000.0);
+    strike.stamp = message.stamp;
+    strike.seq = (uint32_t) event["seq"].asNumber();
+    strike.energy = (uint32_t) event["energy"].asNumber();
+    strike.node = message.node;
+    strike.detector = detector;
+    strike.distance = readDistance(event["distance"]);
+    return strike;
+}
+
+bool parseMessage(const Message& message, std::vector<Strike>& strikes, MessageInfo& info) {
+    JsonValue doc;
+    if (!doc.parse(message.payload.data(), message.payload.size()) || doc.getType() != JSON_OBJECT) {
+        return false;
+    }
+
+    info.detector = (int) doc["detector"].asNumber();
+    if (info.detector < 0 || info.detector >= MAX_DETECTORS) {
+        return false;
+    }
+    info.detectors = (int) doc["detectors"].asNumber();
+    info.cursor = (uint32_t) doc["cursor"].asNumber();
+    info.truncated = doc["truncated"].asBool();
+
+    if (message.type == MESSAGE_STATUS) {
+        const JsonValue& lightnings = doc["lightnings"];
+        if (lightnings.getType() != JSON_ARRAY) {
+            return false;
+        }
+        // lightnings are sent in antichronological order
+        for (size_t ix = lightnings.size(); ix > 0; ix--) {
+            strikes.push_back(makeStrike(message, lightnings[ix - 1], "age", info.detector));
+        }
+    } else if (doc["energy"].isNumber() && doc["seq"].isNumber()) {
+        // Noise floor changes repeat the last lightning, only its seq tells if it is new
+        strikes.push_back(makeStrike(message, doc, "lightningAge", info.detector));
+    }
+    return true;
+}
+
+Deduplicator::History& Deduplicator::history(uint16_t node, uint8_t detector) {
+    uint32_t key = (uint32_t) node << 8 | detector;
+    std::unordered_map<uint32_t, History>::iterator it = histories.find(key);
+    if (it == histories.end()) {
+        History fresh;
+        memset(&fresh, 0, sizeof(History));
+        it = histories.insert(std::make_pair(key, fresh)).first;
+    }
+    return it->second;
+}
+
+void Deduplicator::updateCursor(uint16_t node, uint8_t detector, uint32_t cursor) {
+    History& h = history(node, detector);
+    if (cursor < h.lastSeq) {
+        h.lastSeq = 0;
+    }
+}
+
+bool Deduplicator::accept(const Strike& strike) {
+    History& h = history(strike.node, strike.detector);
+
+    if (strike.seq > 0) {
+        // A lower sequence number of a later lightning means that the node was restarted.
+        // The same sequence number is always a repetition, as a retained message may be
+        // delivered much later than it was sent.
+        if (strike.seq == h.lastSeq
+                || (strike.seq < h.lastSeq && strike.time <= h.lastTime + DEDUP_TOLERANCE)) {
+            return false;
+        }
+        h.lastSeq = strike.seq;
+        h.lastTime = strike.time;
+    }
+
+    for (size_t ix = 0; ix < h.used; ix++) {
+        int64_t diff = strike.time - h.times[ix];
+        if (diff <= DEDUP_TOLERANCE && diff >= -DEDUP_TOLERANCE
+                && h.energies[ix] == strike.energy && h.distances[ix] == strike.distance) {
+            return false;
+        }
+    }
+
+    h.times[h.next] = strike.time;
+    h.energies[h.next] = strike.energy;
+    h.distances[h.next] = strike.distance;
+    h.next = (h.next + 1) % DEDUP_HISTORY;
+    if (h.used < DEDUP_HISTORY) {
+        h.used++;
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Ingest__
+#define __Ingest__
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "Event.h"
+
+#define DEDUP_HISTORY   16      // Number of recent lightnings per detector kept for deduplication
+#define DEDUP_TOLERANCE 1500    // Maximum time difference of duplicate lightnings, in ms
+
+/**
+ * Header values of a parsed message.
+ */
+struct MessageInfo {
+    int detector;           // detector that sent the message
+    int detectors;          // number of detectors of the node, 0 if unknown
+    uint32_t cursor;        // /status cursor, 0 if unknown
+    bool truncated;         // /status lost lightnings since the last poll
+};
+
+/**
+ * Parse a /status response or an MQTT payload.
+ *
+ * The lightning times are computed from the reception time and the age of the
+ * lightning. /status lightnings are returned in chronological order. MQTT payloads
+ * without a lightning are accepted, but do not return a strike. MQTT payloads of noise
+ * floor changes repeat the last lightning, so MQTT strikes always need a sequence
+ * number to be deduplicated.
+ *
+ * @param message   Message to parse
+ * @param strikes   Receives the lightnings of the message
+ * @param info      Receives the header values of the message
+ * @return true if the message was valid
+ */
+bool parseMessage(const Message& message, std::vector<Strike>& strikes, MessageInfo& info);
+
+/**
+ * Drops lightnings that were already seen.
+ *
+ * /status responses repeat lightnings that were already polled, and MQTT events repeat
+ * the last lightning on noise floor changes and when a retained message is delivered
+ * again. So lightnings are dropped if their sequence number is not higher than the
+ * last one of that detector. A lower sequence number of a later lightning means that
+ * the node was restarted, so it is accepted. A node may also be polled and send MQTT events at the
+ * same time, so every lightning is also compared with the recent lightnings of its
+ * detector, and dropped if energy and distance are equal and the time is about the
+ * same.
+ *
+ * An instance is not thread-safe. Every ingestion worker has its own instance, and
+ * only sees the nodes that are assigned to it.
+ */
+class Deduplicator {
+public:
+    /**
+     * Update the last /status cursor of a detector. If the cursor went back, the node
+     * was restarted, and the sequence numbers start all over again.
+     */
+    void updateCursor(uint16_t node, uint8_t detector, uint32_t cursor);
+
+    /**
+     * Check if a lightning is new, and remember it.
+     *
+     * @return true if the lightning is new, false if it is a duplicate
+     */
+    bool accept(const Strike& strike);
+
+private:
+    struct History {
+        uint32_t lastSeq;
+        int64_t lastTime;       // time of the lightning with lastSeq
+        size_t next;
+        size_t used;
+        int64_t times[DEDUP_HISTORY];
+        uint32_t energies[DEDUP_HISTORY];
+        uint8_t distances[DEDUP_HISTORY];
+    };
+
+    std::unordered_map<uint32_t, History> histories;
+
+    History& history(uint16_t node, uint8_t detector);
+};
+
+#endif
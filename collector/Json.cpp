@@ -0,0 +1,259 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Json.h"
+
+#define MAX_DEPTH 16    // Maximum nesting depth of a document
+
+static const JsonValue NULL_VALUE;
+static const std::string EMPTY_STRING;
+
+static void skipSpace(const char*& pos, const char* end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) {
+        pos++;
+    }
+}
+
+static bool matchWord(const char*& pos, const char* end, const char* word) {
+    size_t length = strlen(word);
+    if ((size_t) (end - pos) < length || memcmp(pos, word, length) != 0) {
+        return false;
+    }
+    pos += length;
+    return true;
+}
+
+static void appendUtf8(std::string& out, unsigned long code) {
+    if (code < 0x80) {
+        out += (char) code;
+    } else if (code < 0x800) {
+        out += (char) (0xC0 | (code >> 6));
+        out += (char) (0x80 | (code & 0x3F));
+    } else {
+        out += (char) (0xE0 | (code >> 12));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+}
+
+JsonValue::JsonValue() {
+    this->type = JSON_NULL;
+    this->number = 0.0;
+}
+
+bool JsonValue::parse(const char* text, size_t length) {
+    const char* pos = text;
+    const char* end = text + length;
+    if (!parseValue(pos, end, 0)) {
+        *this = JsonValue();
+        return false;
+    }
+    skipSpace(pos, end);
+    return pos == end;
+}
+
+double JsonValue::asNumber(double fallback) const {
+    return type == JSON_NUMBER ? number : fallback;
+}
+
+bool JsonValue::asBool() const {
+    return type == JSON_BOOL && number != 0.0;
+}
+
+const std::string& JsonValue::asString() const {
+    return type == JSON_STRING ? string : EMPTY_STRING;
+}
+
+size_t JsonValue::size() const {
+    return type == JSON_ARRAY || type == JSON_OBJECT ? items.size() : 0;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const {
+    if (type != JSON_ARRAY || index >= items.size()) {
+        return NULL_VALUE;
+    }
+    return items[index];
+}
+
+const JsonValue& JsonValue::operator[](const char* key) const {
+    if (type == JSON_OBJECT) {
+        for (size_t ix = 0; ix < keys.size(); ix++) {
+            if (keys[ix] == key) {
+                return items[ix];
+            }
+        }
+    }
+    return NULL_VALUE;
+}
+
+bool JsonValue::parseValue(const char*& pos, const char* end, int depth) {
+    if (depth > MAX_DEPTH) {
+        return false;
+    }
+
+    skipSpace(pos, end);
+    if (pos >= end) {
+        return false;
+    }
+
+    switch (*pos) {
+        case 'n':
+            type = JSON_NULL;
+            return matchWord(pos, end, "null");
+
+        case 't':
+            type = JSON_BOOL;
+            number = 1.0;
+            return matchWord(pos, end, "true");
+
+        case 'f':
+            type = JSON_BOOL;
+            number = 0.0;
+            return matchWord(pos, end, "false");
+
+        case '"':
+            type = JSON_STRING;
+            return parseString(pos, end, string);
+
+        case '[':
+            type = JSON_ARRAY;
+            pos++;
+            skipSpace(pos, end);
+            if (pos < end && *pos == ']') {
+                pos++;
+                return true;
+            }
+            for (;;) {
+                items.push_back(JsonValue());
+                if (!items.back().parseValue(pos, end, depth + 1)) {
+                    return false;
+                }
+                skipSpace(pos, end);
+                if (pos < end && *pos == ',') {
+                    pos++;
+                } else if (pos < end && *pos == ']') {
+                    pos++;
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+        case '{':
+            type = JSON_OBJECT;
+            pos++;
+            skipSpace(pos, end);
+            if (pos < end && *pos == '}') {
+                pos++;
+                return true;
+            }
+            for (;;) {
+                skipSpace(pos, end);
+                keys.push_back(std::string());
+                if (!parseString(pos, end, keys.back())) {
+                    return false;
+                }
+                skipSpace(pos, end);
+                if (pos >= end || *pos != ':') {
+                    return false;
+                }
+                pos++;
+                items.push_back(JsonValue());
+                if (!items.back().parseValue(pos, end, depth + 1)) {
+                    return false;
+                }
+                skipSpace(pos, end);
+                if (pos < end && *pos == ',') {
+                    pos++;
+                } else if (pos < end && *pos == '}') {
+                    pos++;
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+        default: {
+            // strtod needs a terminated string, so copy the number first
+            char buffer[32];
+            size_t length = 0;
+            while (pos + length < end && length < sizeof(buffer) - 1
+                    && strchr("+-0123456789.eE", pos[length]) != NULL) {
+                buffer[length] = pos[length];
+                length++;
+            }
+            buffer[length] = '\0';
+            char* numberEnd;
+            number = strtod(buffer, &numberEnd);
+            if (length == 0 || numberEnd != buffer + length) {
+                return false;
+            }
+            type = JSON_NUMBER;
+            pos += length;
+            return true;
+        }
+    }
+}
+
+bool JsonValue::parseString(const char*& pos, const char* end, std::string& out) {
+    if (pos >= end || *pos != '"') {
+        return false;
+    }
+    pos++;
+    while (pos < end) {
+        char ch = *pos++;
+        if (ch == '"') {
+            return true;
+        }
+        if (ch != '\\') {
+            out += ch;
+            continue;
+        }
+        if (pos >= end) {
+            return false;
+        }
+        ch = *pos++;
+        switch (ch) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                if (end - pos < 4) {
+                    return false;
+                }
+                char hex[5] = { pos[0], pos[1], pos[2], pos[3], '\0' };
+                char* hexEnd;
+                unsigned long code = strtoul(hex, &hexEnd, 16);
+                if (hexEnd != hex + 4) {
+                    return false;
+                }
+                // surrogate pairs are not needed for Kaminari's documents
+                appendUtf8(out, code >= 0xD800 && code < 0xE000 ? '?' : code);
+                pos += 4;
+                break;
+            }
+            default:
+                out += ch;
+        }
+    }
+    return false;
+}
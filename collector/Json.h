@@ -0,0 +1,98 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Json__
+#define __Json__
+
+#include <string>
+#include <vector>
+
+enum JsonType {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+};
+
+/**
+ * A parsed JSON value. It is just good enough for the documents that are sent by
+ * Kaminari, so the collector does not need any further dependencies.
+ *
+ * Accessing a missing member or array element returns a null value, so nested values
+ * can be read without checking every level.
+ */
+class JsonValue {
+public:
+    JsonValue();
+
+    /**
+     * Parse a JSON document.
+     *
+     * @param text      JSON document
+     * @param length    Length of the document
+     * @return true if the document was valid, false otherwise
+     */
+    bool parse(const char* text, size_t length);
+
+    JsonType getType() const            { return type; }
+    bool isNull() const                 { return type == JSON_NULL; }
+    bool isNumber() const               { return type == JSON_NUMBER; }
+
+    /**
+     * Return the number, or the fallback if this is not a number.
+     */
+    double asNumber(double fallback = 0.0) const;
+
+    /**
+     * Return the boolean value. Everything else is false.
+     */
+    bool asBool() const;
+
+    /**
+     * Return the string. Everything else is an empty string.
+     */
+    const std::string& asString() const;
+
+    /**
+     * Return the number of array elements or object members.
+     */
+    size_t size() const;
+
+    /**
+     * Return an array element, or a null value if there is no such element.
+     */
+    const JsonValue& operator[](size_t index) const;
+
+    /**
+     * Return an object member, or a null value if there is no such member.
+     */
+    const JsonValue& operator[](const char* key) const;
+
+private:
+    JsonType type;
+    double number;
+    std::string string;
+    std::vector<JsonValue> items;       // array elements, or object member values
+    std::vector<std::string> keys;      // object member keys
+
+    bool parseValue(const char*& pos, const char* end, int depth);
+    static bool parseString(const char*& pos, const char* end, std::string& out);
+};
+
+#endif
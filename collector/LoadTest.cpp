@@ -0,0 +1,425 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <unordered_map>
+
+#include "LoadTest.h"
+
+#define ORIGIN_LATITUDE     50.0    // Position of the first node
+#define ORIGIN_LONGITUDE     8.0
+#define AS3935_RANGE        40.0    // Maximum detection distance, in km
+#define DETECTION_RATE       0.9    // Probability that a node in range detects a lightning
+#define DISTANCE_NOISE       0.1    // Relative deviation of the distance estimation
+#define STATUS_HISTORY         3    // Number of lightnings returned by a /status poll
+#define JOB_QUEUE_SIZE     16384    // Capacity of the job queue of every publisher
+#define MIN_RECALL           0.9    // Minimum share of lightnings that must be correlated
+#define NOISE_FLOOR_DELAY   3000    // Time between a lightning and a noise floor change, in ms
+#define RETAINED_DELAY     30000    // Time until a retained message is delivered again, in ms
+
+// Distances that are reported by the AS3935, in km
+static const uint8_t DISTANCES[] = { 1, 5, 6, 8, 10, 12, 14, 17, 20, 24, 27, 31, 34, 37, 40 };
+
+/**
+ * A lightning that was detected by a node, and needs to be published.
+ */
+struct Job {
+    uint32_t lightning;
+    int node;
+    double distance;        // true distance, in km
+    int64_t time;           // wall clock time of the lightning, in ms
+    int64_t stamp;          // monotonic time of the lightning, in µs
+};
+
+/**
+ * A simulated lightning.
+ */
+struct Truth {
+    double x;
+    double y;
+    int reporters;
+};
+
+/**
+ * State of a simulated node, only used by the publisher that owns the node.
+ */
+struct SimNode {
+    bool mqtt;
+    uint32_t seq;
+    size_t used;
+    uint32_t seqs[STATUS_HISTORY];          // recent lightnings, newest first
+    int64_t times[STATUS_HISTORY];
+    uint32_t energies[STATUS_HISTORY];
+    int distances[STATUS_HISTORY];
+};
+
+/**
+ * Stand-in for an MQTT broker. It delivers the payload of a topic to the collector.
+ * The topics are registered before the publishers are started, so lookups need no
+ * locking.
+ */
+class LocalBroker {
+public:
+    LocalBroker(const Fleet& fleet, Collector& collector) : collector(collector) {
+        for (size_t ix = 0; ix < fleet.size(); ix++) {
+            topics[fleet[ix].name] = ix;
+        }
+        published.store(0);
+    }
+
+    void publish(const std::string& topic, const char* payload, int64_t received, int64_t stamp) {
+        std::unordered_map<std::string, int>::const_iterator it = topics.find(topic);
+        if (it == topics.end()) {
+            return;
+        }
+        Message message;
+        message.node = it->second;
+        message.type = MESSAGE_MQTT;
+        message.received = received;
+        message.stamp = stamp;
+        message.payload = payload;
+        collector.submit(message);
+        published.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    unsigned long getPublished() const {
+        return published.load();
+    }
+
+private:
+    Collector& collector;
+    std::unordered_map<std::string, int> topics;
+    std::atomic<unsigned long> published;
+};
+
+typedef LockFreeQueue<Job, JOB_QUEUE_SIZE> JobQueue;
+
+static int quantizeDistance(double distance, std::mt19937& random) {
+    std::normal_distribution<double> noise(1.0, DISTANCE_NOISE);
+    double estimated = distance * noise(random);
+    if (estimated > AS3935_RANGE + 2.0) {
+        return OUT_OF_RANGE;
+    }
+    const uint8_t* best = DISTANCES;
+    for (const uint8_t* d = DISTANCES; d < DISTANCES + sizeof(DISTANCES); d++) {
+        if (fabs(*d - estimated) < fabs(*best - estimated)) {
+            best = d;
+        }
+    }
+    return *best;
+}
+
+static void formatDistance(char* buffer, size_t size, int distance) {
+    if (distance == OUT_OF_RANGE) {
+        snprintf(buffer, size, "null");
+    } else {
+        snprintf(buffer, size, "%d", distance);
+    }
+}
+
+static const char* RATES_JSON =
+        "\"rates\":{\"lightnings\":[2,9,17],\"disturbers\":[81,350,902],\"noise\":[0,0,3]}";
+
+/**
+ * Publish a lightning of a node, either as MQTT event or as /status response.
+ */
+static void publish(const Fleet& fleet, LocalBroker& broker, Collector& collector,
+        SimNode& node, const Job& job, std::mt19937& random, const LoadTestOptions& test,
+        std::atomic<unsigned long>& polled) {
+    uint32_t energy = job.lightning + 1;    // carries the lightning, for verification
+    int distance = quantizeDistance(job.distance, random);
+    char dist[8];
+    formatDistance(dist, sizeof(dist), distance);
+
+    char storm[160];
+    snprintf(storm, sizeof(storm),
+            "\"storm\":{\"active\":true,\"strikes\":%u,\"closest\":null,\"distance\":null,"
+            "\"speed\":null,\"eta\":null,\"rate\":1.5,\"trend\":\"steady\"}",
+            node.seq + 1);
+
+    if (node.mqtt) {
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        uint32_t seq = ++node.seq;
+        char payload[512];
+        snprintf(payload, sizeof(payload),
+                "{\"energy\":%u,\"distance\":%s,\"seq\":%u,\"lightningAge\":0,\"age\":0,"
+                "\"tuning\":500135,\"noiseFloorLevel\":146,\"disturbersPerMinute\":2,"
+                "\"watchdogThreshold\":2,\"wifiSignalStrength\":-55,\"detector\":0,%s,%s}",
+                energy, dist, seq, RATES_JSON, storm);
+        broker.publish(fleet[job.node].name, payload, job.time, job.stamp);
+        if (chance(random) < test.duplicates) {
+            // redelivery, e.g. after a reconnection
+            broker.publish(fleet[job.node].name, payload, job.time, job.stamp);
+        }
+        if (chance(random) < test.retained) {
+            // the retained message is delivered again when the subscriber reconnects
+            broker.publish(fleet[job.node].name, payload, job.time + RETAINED_DELAY, job.stamp);
+        }
+        if (chance(random) < test.noiseFloors) {
+            // a noise floor change repeats the last lightning
+            snprintf(payload, sizeof(payload),
+                    "{\"energy\":%u,\"distance\":%s,\"seq\":%u,\"lightningAge\":%d,\"age\":0,"
+                    "\"tuning\":500135,\"noiseFloorLevel\":183,\"disturbersPerMinute\":2,"
+                    "\"watchdogThreshold\":2,\"wifiSignalStrength\":-55,\"detector\":0,%s,%s}",
+                    energy, dist, seq, NOISE_FLOOR_DELAY / 1000, RATES_JSON, storm);
+            broker.publish(fleet[job.node].name, payload, job.time + NOISE_FLOOR_DELAY, job.stamp);
+        }
+        return;
+    }
+
+    // /status nodes keep the last lightnings, and repeat them on every poll
+    for (size_t ix = STATUS_HISTORY - 1; ix > 0; ix--) {
+        node.seqs[ix] = node.seqs[ix - 1];
+        node.times[ix] = node.times[ix - 1];
+        node.energies[ix] = node.energies[ix - 1];
+        node.distances[ix] = node.distances[ix - 1];
+    }
+    node.seqs[0] = ++node.seq;
+    node.times[0] = job.time;
+    node.energies[0] = energy;
+    node.distances[0] = distance;
+    if (node.used < STATUS_HISTORY) {
+        node.used++;
+    }
+
+    std::string payload = "{\"lightnings\":[";
+    for (size_t ix = 0; ix < node.used; ix++) {
+        char lightning[96];
+        formatDistance(dist, sizeof(dist), node.distances[ix]);
+        snprintf(lightning, sizeof(lightning), "%s{\"seq\":%u,\"age\":%lld,\"energy\":%u,\"distance\":%s}",
+                ix > 0 ? "," : "", node.seqs[ix], (long long) (job.time - node.times[ix]) / 1000,
+                node.energies[ix], dist);
+        payload += lightning;
+    }
+    char members[512];
+    snprintf(members, sizeof(members),
+            "],%s,\"cursor\":%u,\"truncated\":false,\"distance\":null,\"energy\":0,"
+            "\"noiseFloorLevel\":146,\"disturbersPerMinute\":2,\"watchdogThreshold\":2,"
+            "\"wifiSignalStrength\":-55,\"detector\":0,\"detectors\":1,",
+            storm, node.seq);
+    payload += members;
+    payload += RATES_JSON;
+    payload += "}";
+
+    Message message;
+    message.node = job.node;
+    message.type = MESSAGE_STATUS;
+    message.received = job.time;
+    message.stamp = job.stamp;
+    message.payload = payload;
+    collector.submit(message);
+    polled.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void printLatency(const char* title, const LatencyHistogram& histogram) {
+    printf("%-17savg %.2f ms, 50%% %.2f ms, 99%% %.2f ms, max %.2f ms\n", title,
+            histogram.getAverage() / 1000.0,
+            histogram.getPercentile(50.0) / 1000.0,
+            histogram.getPercentile(99.0) / 1000.0,
+            histogram.getMax() / 1000.0);
+}
+
+bool runLoadTest(const LoadTestOptions& test, const CollectorOptions& options) {
+    // Place the nodes on a square grid
+    Fleet fleet;
+    int side = (int) ceil(sqrt((double) test.nodes));
+    double kmPerDegreeLongitude = 111.320 * cos(ORIGIN_LATITUDE * M_PI / 180.0);
+    std::vector<SimNode> simNodes(test.nodes);
+    for (int ix = 0; ix < test.nodes; ix++) {
+        char name[32];
+        snprintf(name, sizeof(name), "kaminari/node%d", ix);
+        int index = fleet.add(name);
+        double x = (ix % side) * test.spacing;
+        double y = (ix / side) * test.spacing;
+        fleet.setPosition(index, ORIGIN_LATITUDE + y / 110.574, ORIGIN_LONGITUDE + x / kmPerDegreeLongitude);
+        simNodes[ix].mqtt = ix % 2 == 0;
+        simNodes[ix].seq = 0;
+        simNodes[ix].used = 0;
+    }
+
+    std::vector<Correlation> correlations;
+    Collector collector(fleet, options);
+    LocalBroker broker(fleet, collector);
+    collector.start([&correlations](const Correlation& correlation) {
+        correlations.push_back(correlation);
+    });
+
+    // Publishers format and submit the payloads of their nodes
+    std::vector<std::unique_ptr<JobQueue> > jobQueues;
+    std::vector<std::thread> publishers;
+    std::atomic<bool> stormOver(false);
+    std::atomic<unsigned long> polled(0);
+    for (int p = 0; p < test.publishers; p++) {
+        jobQueues.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+    }
+    for (int p = 0; p < test.publishers; p++) {
+        JobQueue& queue = *jobQueues[p];
+        publishers.push_back(std::thread([&, p]() {
+            std::mt19937 random(test.seed * 1000 + p);
+            Job job;
+            for (;;) {
+                if (queue.pop(job)) {
+                    publish(fleet, broker, collector, simNodes[job.node], job, random,
+                            test, polled);
+                } else if (stormOver.load()) {
+                    break;
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+        }));
+    }
+
+    // Generate the storm
+    std::mt19937 random(test.seed);
+    std::uniform_real_distribution<double> area(-10.0, (side - 1) * test.spacing + 10.0);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::exponential_distribution<double> interval(test.rate > 0.0 ? test.rate : 1.0);
+    std::vector<Truth> truths;
+    unsigned long jobStalls = 0;
+    int64_t start = monotonicTime();
+    int64_t end = start + (int64_t) (test.duration * 1000000.0);
+    double next = 0.0;
+
+    for (;;) {
+        int64_t now = monotonicTime();
+        if (test.rate > 0.0) {
+            int64_t due = start + (int64_t) (next * 1000000.0);
+            if (due >= end) {
+                break;
+            }
+            if (due > now) {
+                std::this_thread::sleep_for(std::chrono::microseconds(due - now < 1000 ? due - now : 1000));
+                continue;
+            }
+            next += interval(random);
+        } else if (now >= end) {
+            break;
+        }
+
+        Truth truth;
+        truth.x = area(random);
+        truth.y = area(random);
+        truth.reporters = 0;
+
+        Job job;
+        job.lightning = truths.size();
+        job.time = wallTime();
+        job.stamp = monotonicTime();
+        for (int ix = 0; ix < test.nodes; ix++) {
+            job.distance = hypot(truth.x - fleet[ix].x, truth.y - fleet[ix].y);
+            if (job.distance > AS3935_RANGE || chance(random) > DETECTION_RATE) {
+                continue;
+            }
+            job.node = ix;
+            JobQueue& queue = *jobQueues[ix % test.publishers];
+            if (!queue.push(job)) {
+                jobStalls++;
+                do {
+                    std::this_thread::yield();
+                } while (!queue.push(job));
+            }
+            truth.reporters++;
+        }
+        truths.push_back(truth);
+    }
+
+    stormOver.store(true);
+    for (size_t ix = 0; ix < publishers.size(); ix++) {
+        publishers[ix].join();
+    }
+    int64_t published = monotonicTime();
+    collector.stop();
+    int64_t finished = monotonicTime();
+
+    // Evaluate the correlations
+    unsigned long expected = 0;
+    unsigned long detections = 0;
+    for (size_t ix = 0; ix < truths.size(); ix++) {
+        if (truths[ix].reporters >= 2) {
+            expected++;
+        }
+        detections += truths[ix].reporters;
+    }
+
+    // A correlation finds the lightning with the most reports, all other reports are
+    // foreign. The energy of a report carries its lightning.
+    std::set<uint32_t> found;
+    unsigned long reports = 0;
+    unsigned long foreign = 0;
+    unsigned long located = 0;
+    double errorSum = 0.0;
+    double errorMax = 0.0;
+    for (size_t ix = 0; ix < correlations.size(); ix++) {
+        const Correlation& c = correlations[ix];
+        uint32_t lightning = 0;
+        long majority = 0;
+        for (size_t m = 0; m < c.energies.size(); m++) {
+            long count = std::count(c.energies.begin(), c.energies.end(), c.energies[m]);
+            if (count > majority) {
+                majority = count;
+                lightning = c.energies[m] - 1;
+            }
+        }
+        reports += c.energies.size();
+        foreign += c.energies.size() - majority;
+        found.insert(lightning);
+        if (c.located && lightning < truths.size()) {
+            double error = hypot(c.x - truths[lightning].x, c.y - truths[lightning].y);
+            errorSum += error;
+            errorMax = std::max(errorMax, error);
+            located++;
+        }
+    }
+
+    CollectorStats stats = collector.getStats();
+    const CorrelatorStats& cstats = collector.getCorrelatorStats();
+    unsigned long messages = broker.getPublished() + polled.load();
+    double elapsed = (finished - start) / 1000000.0;
+    double recall = expected > 0 ? (double) found.size() / expected : 1.0;
+
+    printf("Nodes:           %d (%d MQTT, %d /status), %d km apart\n",
+            test.nodes, (test.nodes + 1) / 2, test.nodes / 2, (int) test.spacing);
+    printf("Threads:         %d publishers, %d workers, 1 store\n", test.publishers, options.workers);
+    printf("Lightnings:      %zu in %.1f s, %lu seen by 2+ nodes\n",
+            truths.size(), test.duration, expected);
+    printf("Messages:        %lu published, %lu ingested, %lu invalid\n",
+            messages, stats.messages, stats.invalid);
+    printf("Throughput:      %.0f messages/s, %.0f strikes/s, drained in %.0f ms\n",
+            stats.messages / elapsed, stats.strikes / elapsed, (finished - published) / 1000.0);
+    printf("Strikes:         %lu parsed, %lu duplicates dropped, %lu stored, %lu detected\n",
+            stats.strikes, stats.duplicates, stats.stored, detections);
+    printf("Correlations:    %lu, %zu lightnings (%.1f%%) found, %lu singles, %lu late\n",
+            cstats.correlations, found.size(), recall * 100.0, cstats.singles, cstats.late);
+    printf("Reports:         %lu correlated, %lu foreign (%.1f%%)\n",
+            reports, foreign, reports > 0 ? foreign * 100.0 / reports : 0.0);
+    if (located > 0) {
+        printf("Location:        %lu located, error avg %.1f km, max %.1f km\n",
+                located, errorSum / located, errorMax);
+    }
+    printLatency("Store latency:", collector.getStoreLatency());
+    printLatency("Correlation:", collector.getCorrelationLatency());
+    printf("Backpressure:    %lu collector, %lu publisher\n", stats.backpressure, jobStalls);
+
+    return stats.messages == messages && stats.invalid == 0 && stats.stored == detections
+            && recall >= MIN_RECALL;
+}
@@ -0,0 +1,59 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __LoadTest__
+#define __LoadTest__
+
+#include "Collector.h"
+
+/**
+ * Configuration of a load test.
+ */
+struct LoadTestOptions {
+    int nodes = 100;                // number of simulated nodes
+    double duration = 10.0;         // duration of the storm, in s
+    double rate = 100.0;            // lightnings per second, 0 for as fast as possible
+    int publishers = 4;             // number of publishing threads
+    double spacing = 25.0;          // distance between neighboring nodes, in km
+    double duplicates = 0.05;       // probability that an MQTT message is delivered twice
+    double noiseFloors = 0.2;       // probability of a noise floor change after a lightning
+    double retained = 0.02;         // probability that a retained MQTT message is delivered again
+    unsigned long seed = 1;
+};
+
+/**
+ * Run a load test against the collector.
+ *
+ * The simulated nodes are placed on a square grid. A storm thread generates lightnings
+ * at random positions, and every node within the range of the AS3935 reports them with
+ * a coarse distance estimation. Half of the nodes send MQTT payloads via a local broker
+ * stand-in, the other half answer simulated /status polls, which repeat the previous
+ * lightnings. MQTT nodes also send noise floor changes, which repeat the last lightning,
+ * and retained messages are delivered again much later, as after a reconnection of the
+ * subscriber. The payloads are formatted and submitted by a number of publisher threads.
+ *
+ * After the storm, the throughput, the latencies, and the quality of the correlation
+ * are reported.
+ *
+ * @param test      Configuration of the load test
+ * @param options   Configuration of the collector
+ * @return true if all messages were ingested, no repeated lightning was stored as a new
+ *         one, and the correlation found most lightnings
+ */
+bool runLoadTest(const LoadTestOptions& test, const CollectorOptions& options);
+
+#endif
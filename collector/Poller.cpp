@@ -0,0 +1,223 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "Poller.h"
+
+#define MAX_RESPONSE_SIZE 65536     // Maximum size of a /status response
+#define SLEEP_SLICE 100             // Maximum sleep time, so stop() is noticed quickly (ms)
+
+static bool decodeChunked(const std::string& data, std::string& body) {
+    size_t pos = 0;
+    for (;;) {
+        size_t lineEnd = data.find("\r\n", pos);
+        if (lineEnd == std::string::npos) {
+            return false;
+        }
+        char* end;
+        unsigned long size = strtoul(data.c_str() + pos, &end, 16);
+        if (end == data.c_str() + pos) {
+            return false;
+        }
+        if (size == 0) {
+            return true;
+        }
+        pos = lineEnd + 2;
+        if (pos + size > data.size()) {
+            return false;
+        }
+        body.append(data, pos, size);
+        pos += size + 2;
+    }
+}
+
+bool httpGet(const std::string& host, int port, const std::string& path, int timeout, std::string& body) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo* addresses;
+    if (getaddrinfo(host.c_str(), service, &hints, &addresses) != 0) {
+        return false;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        // on Linux, the send timeout also limits connect()
+        struct timeval tv;
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host
+            + "\r\nAccept: application/json\r\nConnection: close\r\n\r\n";
+    bool ok = send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t) request.size();
+
+    std::string response;
+    char buffer[2048];
+    while (ok) {
+        ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+        if (length < 0 || response.size() + length > MAX_RESPONSE_SIZE) {
+            ok = false;
+        } else if (length == 0) {
+            break;
+        } else {
+            response.append(buffer, length);
+        }
+    }
+    close(fd);
+
+    size_t headerEnd = response.find("\r\n\r\n");
+    if (!ok || headerEnd == std::string::npos || response.compare(0, 5, "HTTP/") != 0) {
+        return false;
+    }
+    size_t space = response.find(' ');
+    if (space == std::string::npos || atoi(response.c_str() + space + 1) != 200) {
+        return false;
+    }
+
+    std::string headers = response.substr(0, headerEnd);
+    std::string data = response.substr(headerEnd + 4);
+    const char* encoding = strcasestr(headers.c_str(), "\r\nTransfer-Encoding:");
+    if (encoding != NULL && strcasestr(encoding, "chunked") != NULL) {
+        body.clear();
+        return decodeChunked(data, body);
+    }
+    body = data;
+    return true;
+}
+
+Poller::Poller(Fleet& fleet, Collector& collector, int threads, int interval, int timeout)
+        : fleet(fleet), collector(collector) {
+    this->threadCount = threads;
+    this->interval = interval;
+    this->timeout = timeout;
+    this->running.store(false);
+    this->polls.store(0);
+    this->failures.store(0);
+}
+
+Poller::~Poller() {
+    stop();
+}
+
+size_t Poller::start() {
+    std::vector<int> polled;
+    for (size_t ix = 0; ix < fleet.size(); ix++) {
+        if (!fleet[ix].host.empty()) {
+            polled.push_back(ix);
+        }
+    }
+
+    running.store(true);
+    for (int thread = 0; thread < threadCount && thread < (int) polled.size(); thread++) {
+        std::vector<int> nodes;
+        for (size_t ix = thread; ix < polled.size(); ix += threadCount) {
+            nodes.push_back(polled[ix]);
+        }
+        threads.push_back(std::thread(&Poller::run, this, nodes));
+    }
+    return polled.size();
+}
+
+void Poller::stop() {
+    running.store(false);
+    for (size_t ix = 0; ix < threads.size(); ix++) {
+        threads[ix].join();
+    }
+    threads.clear();
+}
+
+void Poller::run(std::vector<int> nodes) {
+    // Spread the polls evenly over the interval
+    std::vector<int64_t> due;
+    int64_t now = wallTime();
+    for (size_t ix = 0; ix < nodes.size(); ix++) {
+        due.push_back(now + (int64_t) interval * ix / nodes.size());
+    }
+
+    while (running.load()) {
+        size_t next = 0;
+        for (size_t ix = 1; ix < nodes.size(); ix++) {
+            if (due[ix] < due[next]) {
+                next = ix;
+            }
+        }
+
+        int64_t wait = due[next] - wallTime();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(wait < SLEEP_SLICE ? wait : SLEEP_SLICE));
+            continue;
+        }
+
+        poll(nodes[next]);
+        due[next] += interval;
+        if (due[next] < wallTime()) {
+            // the node is overdue, don't try to catch up
+            due[next] = wallTime() + interval;
+        }
+    }
+}
+
+void Poller::poll(int index) {
+    Node& node = fleet[index];
+    int detectors = node.detectors.load(std::memory_order_relaxed);
+    for (int detector = 0; detector < detectors; detector++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/status?detector=%d&since=%u",
+                detector, node.cursors[detector].load(std::memory_order_relaxed));
+
+        Message message;
+        polls.fetch_add(1, std::memory_order_relaxed);
+        if (!httpGet(node.host, node.port, path, timeout, message.payload)) {
+            failures.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        message.node = index;
+        message.type = MESSAGE_STATUS;
+        message.received = wallTime();
+        message.stamp = monotonicTime();
+        collector.submit(message);
+    }
+}
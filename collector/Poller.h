@@ -0,0 +1,91 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Poller__
+#define __Poller__
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Collector.h"
+#include "Fleet.h"
+
+/**
+ * Fetch a document via HTTP GET.
+ *
+ * @param host      Host name
+ * @param port      Port
+ * @param path      Path and query of the document
+ * @param timeout   Connection and read timeout, in ms
+ * @param body      Receives the body of the response
+ * @return true if the document was fetched with status 200
+ */
+bool httpGet(const std::string& host, int port, const std::string& path, int timeout, std::string& body);
+
+/**
+ * Polls the /status endpoint of all nodes with a host.
+ *
+ * The nodes are distributed over a number of polling threads, and the polls of a thread
+ * are spread evenly over the polling interval. Every poll only requests the lightnings
+ * after the cursor of the previous poll, which is maintained by the ingestion workers.
+ * If a node has several detectors, all of them are polled.
+ */
+class Poller {
+public:
+    /**
+     * Create a new Poller.
+     *
+     * @param fleet     All nodes
+     * @param collector Collector to submit the responses to
+     * @param threads   Number of polling threads
+     * @param interval  Polling interval, in ms
+     * @param timeout   HTTP timeout, in ms
+     */
+    Poller(Fleet& fleet, Collector& collector, int threads, int interval, int timeout);
+    ~Poller();
+
+    /**
+     * Start polling. Returns the number of polled nodes.
+     */
+    size_t start();
+
+    /**
+     * Stop polling.
+     */
+    void stop();
+
+    unsigned long getPolls() const      { return polls.load(); }
+    unsigned long getFailures() const   { return failures.load(); }
+
+private:
+    Fleet& fleet;
+    Collector& collector;
+    int threadCount;
+    int interval;
+    int timeout;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running;
+    std::atomic<unsigned long> polls;
+    std::atomic<unsigned long> failures;
+
+    void run(std::vector<int> nodes);
+    void poll(int index);
+};
+
+#endif
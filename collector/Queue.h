@@ -0,0 +1,126 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Queue__
+#define __Queue__
+
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+
+/**
+ * A bounded, lock-free queue for any number of producers and consumers.
+ *
+ * Every cell carries a sequence number that tells whether it is free for the producer
+ * of a certain position, or filled for the consumer of that position. Producers and
+ * consumers claim a position by a compare-and-swap on their index, and then hand the
+ * cell over by publishing the next sequence number. No thread ever waits for another
+ * one, a full or empty queue is just reported to the caller.
+ *
+ * @param T     Element type, must be default constructible and movable
+ * @param SIZE  Capacity, must be a power of 2
+ */
+template<typename T, size_t SIZE>
+class LockFreeQueue {
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+public:
+    LockFreeQueue() {
+        for (size_t ix = 0; ix < SIZE; ix++) {
+            cells[ix].sequence.store(ix, std::memory_order_relaxed);
+        }
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    /**
+     * Add an element to the end of the queue.
+     *
+     * @param value     Element to be added, it is moved into the queue on success
+     * @return true if the element was added, false if the queue is full
+     */
+    bool push(T& value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & (SIZE - 1)];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            long diff = (long) seq - (long) pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Remove the first element of the queue.
+     *
+     * @param value     Receives the element
+     * @return true if an element was removed, false if the queue is empty
+     */
+    bool pop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & (SIZE - 1)];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            long diff = (long) seq - (long) (pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + SIZE, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Return the approximate number of elements in the queue.
+     */
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell cells[SIZE];
+    std::atomic<size_t> head;
+    char padding[64];           // keep producers and consumers on separate cache lines
+    std::atomic<size_t> tail;
+};
+
+#endif
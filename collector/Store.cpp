@@ -0,0 +1,78 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <algorithm>
+
+#include "Store.h"
+
+#define COMPACT_MIN_ROWS 4096   // Minimum number of expired rows before compacting
+
+template<typename T>
+static void insertAt(std::vector<T>& column, size_t index, const T& value) {
+    column.insert(column.begin() + index, value);
+}
+
+template<typename T>
+static void removeFront(std::vector<T>& column, size_t count) {
+    column.erase(column.begin(), column.begin() + count);
+}
+
+StrikeStore::StrikeStore() {
+    this->first = 0;
+}
+
+size_t StrikeStore::insert(const Strike& strike) {
+    // Search from the end, as most strikes arrive in time order
+    size_t index = time.size();
+    while (index > first && time[index - 1] > strike.time) {
+        index--;
+    }
+
+    insertAt(time, index, strike.time);
+    insertAt(stamp, index, strike.stamp);
+    insertAt(node, index, strike.node);
+    insertAt(detector, index, strike.detector);
+    insertAt(distance, index, strike.distance);
+    insertAt(energy, index, strike.energy);
+    insertAt(cluster, index, (int32_t) CLUSTER_PENDING);
+    return index - first;
+}
+
+size_t StrikeStore::expire(int64_t before) {
+    size_t end = first + lowerBound(before);
+    size_t removed = end - first;
+    first = end;
+    if (first >= COMPACT_MIN_ROWS && first * 2 >= time.size()) {
+        compact();
+    }
+    return removed;
+}
+
+size_t StrikeStore::lowerBound(int64_t t) const {
+    return std::lower_bound(time.begin() + first, time.end(), t) - (time.begin() + first);
+}
+
+void StrikeStore::compact() {
+    removeFront(time, first);
+    removeFront(stamp, first);
+    removeFront(node, first);
+    removeFront(detector, first);
+    removeFront(distance, first);
+    removeFront(energy, first);
+    removeFront(cluster, first);
+    first = 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Store__
+#define __Store__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Event.h"
+
+#define CLUSTER_PENDING -1      // Strike was not correlated yet
+#define CLUSTER_SINGLE  -2      // Strike was only seen by one node
+#define CLUSTER_LATE    -3      // Strike arrived after its time window was correlated
+
+/**
+ * In-memory time series of all strikes, ordered by time.
+ *
+ * The strikes are stored column by column, so scanning a time range only touches the
+ * time column, and the other columns are only read for the matching rows. Rows are
+ * appended in time order most of the time, late rows are inserted near the end. Old
+ * rows are expired from the front, the columns are compacted from time to time, so
+ * expiry is amortized O(1).
+ *
+ * Rows are addressed by an index relative to the oldest row. The store is not
+ * thread-safe, it is owned by the store thread of the Collector.
+ */
+class StrikeStore {
+public:
+    StrikeStore();
+
+    /**
+     * Insert a strike at its time position.
+     *
+     * @return Index of the new row
+     */
+    size_t insert(const Strike& strike);
+
+    /**
+     * Remove all strikes that are older than the given time.
+     *
+     * @return Number of removed rows
+     */
+    size_t expire(int64_t before);
+
+    /**
+     * Return the index of the first row at or after the given time.
+     */
+    size_t lowerBound(int64_t time) const;
+
+    size_t size() const                     { return time.size() - first; }
+    int64_t getTime(size_t row) const       { return time[first + row]; }
+    int64_t getStamp(size_t row) const      { return stamp[first + row]; }
+    uint16_t getNode(size_t row) const      { return node[first + row]; }
+    uint8_t getDetector(size_t row) const   { return detector[first + row]; }
+    uint8_t getDistance(size_t row) const   { return distance[first + row]; }
+    uint32_t getEnergy(size_t row) const    { return energy[first + row]; }
+    int32_t getCluster(size_t row) const    { return cluster[first + row]; }
+    void setCluster(size_t row, int32_t id) { cluster[first + row] = id; }
+
+private:
+    size_t first;                       // index of the oldest row that was not expired
+    std::vector<int64_t> time;
+    std::vector<int64_t> stamp;
+    std::vector<uint16_t> node;
+    std::vector<uint8_t> detector;
+    std::vector<uint8_t> distance;
+    std::vector<uint32_t> energy;
+    std::vector<int32_t> cluster;       // correlation id, or one of the CLUSTER constants
+
+    void compact();
+};
+
+#endif
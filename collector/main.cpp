@@ -0,0 +1,271 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Collects the lightnings of many Kaminari nodes, and reports lightnings that were
+ * detected by several nodes.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#include "Collector.h"
+#include "Fleet.h"
+#include "LoadTest.h"
+#include "Poller.h"
+
+struct Options {
+    const char* nodes = NULL;
+    bool mqttStdin = false;
+    int pollers = 8;
+    int interval = 10000;
+    int timeout = 2000;
+    double duration = 0.0;
+    int loadTest = 0;
+    bool windowSet = false;
+    bool latenessSet = false;
+    bool quiet = false;
+    CollectorOptions collector;
+    LoadTestOptions test;
+};
+
+static std::atomic<bool> interrupted(false);
+
+static void onSignal(int) {
+    interrupted.store(true);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: kaminari-collector [options]\n"
+        "\n"
+        "Input:\n"
+        "  --nodes FILE         read the nodes from FILE, lines of\n"
+        "                       '<name> <host>[:<port>]|- [<latitude> <longitude>]'\n"
+        "  --mqtt-stdin         read MQTT messages from stdin, as '<topic> <payload>'\n"
+        "                       lines (e.g. from 'mosquitto_sub -v')\n"
+        "  --pollers N          number of /status polling threads (default 8)\n"
+        "  --interval S         /status polling interval, in s (default 10)\n"
+        "  --timeout MS         HTTP timeout, in ms (default 2000)\n"
+        "  --duration S         stop after S seconds (default: run until interrupted)\n"
+        "\n"
+        "Processing:\n"
+        "  --workers N          number of ingestion workers (default 4)\n"
+        "  --window MS          correlation window, in ms (default 2000)\n"
+        "  --lateness MS        maximum message delay, in ms (default: polling interval\n"
+        "                       plus 2000)\n"
+        "  --retention S        time to keep strikes, in s (default 3600)\n"
+        "\n"
+        "Load test:\n"
+        "  --load-test N        run a load test with N simulated nodes\n"
+        "  --rate N             lightnings per second, 0 for maximum (default 100)\n"
+        "  --publishers N       number of publishing threads (default 4)\n"
+        "  --spacing KM         distance between the nodes, in km (default 25)\n"
+        "  --duplicates P       probability of a duplicate MQTT message (default 0.05)\n"
+        "  --noise-floors P     probability of a noise floor change after a lightning,\n"
+        "                       which repeats the lightning via MQTT (default 0.2)\n"
+        "  --retained P         probability that a retained MQTT message is delivered\n"
+        "                       again after a reconnection (default 0.02)\n"
+        "  --seed N             random seed (default 1)\n"
+        "\n"
+        "Output:\n"
+        "  --quiet              do not print the correlated lightnings\n");
+}
+
+static bool parseOptions(int argc, char** argv, Options& opt) {
+    for (int ix = 1; ix < argc; ix++) {
+        std::string arg = argv[ix];
+        const char* value = ix + 1 < argc ? argv[ix + 1] : NULL;
+
+        if (arg == "--mqtt-stdin") {
+            opt.mqttStdin = true;
+        } else if (arg == "--quiet") {
+            opt.quiet = true;
+        } else if (value == NULL) {
+            return false;
+        } else {
+            ix++;
+            if (arg == "--nodes") {
+                opt.nodes = value;
+            } else if (arg == "--pollers") {
+                opt.pollers = atoi(value);
+            } else if (arg == "--interval") {
+                opt.interval = (int) (atof(value) * 1000.0);
+            } else if (arg == "--timeout") {
+                opt.timeout = atoi(value);
+            } else if (arg == "--duration") {
+                opt.duration = atof(value);
+                opt.test.duration = opt.duration;
+            } else if (arg == "--workers") {
+                opt.collector.workers = atoi(value);
+            } else if (arg == "--window") {
+                opt.collector.window = atol(value);
+                opt.windowSet = true;
+            } else if (arg == "--lateness") {
+                opt.collector.lateness = atol(value);
+                opt.latenessSet = true;
+            } else if (arg == "--retention") {
+                opt.collector.retention = atol(value) * 1000;
+            } else if (arg == "--load-test") {
+                opt.loadTest = atoi(value);
+            } else if (arg == "--rate") {
+                opt.test.rate = atof(value);
+            } else if (arg == "--publishers") {
+                opt.test.publishers = atoi(value);
+            } else if (arg == "--spacing") {
+                opt.test.spacing = atof(value);
+            } else if (arg == "--duplicates") {
+                opt.test.duplicates = atof(value);
+            } else if (arg == "--noise-floors") {
+                opt.test.noiseFloors = atof(value);
+            } else if (arg == "--retained") {
+                opt.test.retained = atof(value);
+            } else if (arg == "--seed") {
+                opt.test.seed = strtoul(value, NULL, 10);
+            } else {
+                return false;
+            }
+        }
+    }
+    return opt.collector.workers > 0 && opt.pollers > 0 && opt.interval > 0
+        && opt.test.publishers > 0 && opt.test.spacing > 0.0 && opt.loadTest <= MAX_NODES;
+}
+
+static void printCorrelation(const Fleet& fleet, const Correlation& correlation) {
+    printf("{\"id\":%u,\"time\":%lld,\"reports\":[", correlation.id, (long long) correlation.time);
+    for (size_t ix = 0; ix < correlation.nodes.size(); ix++) {
+        printf("%s{\"node\":\"%s\",\"energy\":%u,\"distance\":", ix > 0 ? "," : "",
+                fleet[correlation.nodes[ix]].name.c_str(), correlation.energies[ix]);
+        if (correlation.distances[ix] == OUT_OF_RANGE) {
+            printf("null}");
+        } else {
+            printf("%d}", correlation.distances[ix]);
+        }
+    }
+    printf("]");
+    if (correlation.located) {
+        double latitude, longitude;
+        fleet.toLatLon(correlation.x, correlation.y, latitude, longitude);
+        printf(",\"latitude\":%.4f,\"longitude\":%.4f,\"residual\":%.1f", latitude, longitude, correlation.residual);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+/**
+ * Read MQTT messages from stdin. Unknown topics are added as new nodes.
+ */
+static void readMqtt(Fleet& fleet, Collector& collector) {
+    std::string line;
+    while (!interrupted.load() && std::getline(std::cin, line)) {
+        size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            continue;
+        }
+        std::string topic = line.substr(0, space);
+        int node = fleet.find(topic);
+        if (node < 0) {
+            node = fleet.add(topic);
+            if (node < 0) {
+                continue;
+            }
+            fprintf(stderr, "New node: %s\n", topic.c_str());
+        }
+
+        Message message;
+        message.node = node;
+        message.type = MESSAGE_MQTT;
+        message.received = wallTime();
+        message.stamp = monotonicTime();
+        message.payload = line.substr(space + 1);
+        collector.submit(message);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+
+    if (opt.loadTest > 0) {
+        // simulated nodes have exact clocks and no polling delay
+        if (!opt.windowSet) {
+            opt.collector.window = 50;
+        }
+        if (!opt.latenessSet) {
+            opt.collector.lateness = 1000;
+        }
+        opt.test.nodes = opt.loadTest;
+        return runLoadTest(opt.test, opt.collector) ? 0 : 1;
+    }
+
+    if (opt.nodes == NULL && !opt.mqttStdin) {
+        fprintf(stderr, "Either --nodes or --mqtt-stdin is required\n");
+        usage();
+        return 2;
+    }
+
+    Fleet fleet;
+    if (opt.nodes != NULL && !fleet.load(opt.nodes)) {
+        return 1;
+    }
+
+    if (!opt.latenessSet) {
+        opt.collector.lateness = opt.interval + 2000;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Collector collector(fleet, opt.collector);
+    collector.start([&fleet, &opt](const Correlation& correlation) {
+        if (!opt.quiet) {
+            printCorrelation(fleet, correlation);
+        }
+    });
+
+    Poller poller(fleet, collector, opt.pollers, opt.interval, opt.timeout);
+    size_t polled = poller.start();
+    fprintf(stderr, "Collecting from %zu nodes, polling %zu of them\n", fleet.size(), polled);
+
+    int64_t end = opt.duration > 0.0 ? monotonicTime() + (int64_t) (opt.duration * 1000000.0) : 0;
+    if (opt.mqttStdin) {
+        readMqtt(fleet, collector);
+    }
+    while (!interrupted.load() && (end == 0 || monotonicTime() < end) && (!opt.mqttStdin || polled > 0)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    poller.stop();
+    collector.stop();
+
+    CollectorStats stats = collector.getStats();
+    const CorrelatorStats& cstats = collector.getCorrelatorStats();
+    fprintf(stderr, "Messages: %lu (%lu invalid), polls: %lu (%lu failed)\n",
+            stats.messages, stats.invalid, poller.getPolls(), poller.getFailures());
+    fprintf(stderr, "Strikes: %lu stored, %lu duplicates, %lu correlations, %lu located, %lu late\n",
+            stats.stored, stats.duplicates, cstats.correlations, cstats.located, cstats.late);
+    return 0;
+}
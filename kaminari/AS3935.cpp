@@ -20,239 +20,314 @@
 
 #include "AS3935.h"
 
+#include "EventQueue.h"
+
+using namespace as3935;
+
 #define BITRATE 1400000         // max bitrate is 2 MHz, should not be dividable by 500 kHz
-#define NOISE_LEVEL_RAISE_DELAY      60000  // Delay before noise level can be raised again
-#define NOISE_LEVEL_REDUCTION_DELAY 600000  // Delay before noise reduction is lowered again
+#define INTERRUPT_SETTLE_TIME 2000  // Time (µs) to wait before reading the interrupt register
+#define CALIBRATION_MAX_RETRIES 4   // Maximum number of measurements per calibration bit
+#define SHADOW_REGISTERS    0x1F7   // Registers 0x00-0x08 are shadowed, except for 0x03
+#define RESULT_REGISTERS    0x0F0   // Registers 0x04-0x07 change on every event
+#define MAX_INTERRUPTS_PER_UPDATE 4 // Interrupts processed per update(), for sharing the bus
+#define NOISE_SAMPLE_INTERVAL 60000 // Time (ms) between two samples of the noise floor level
 
 const int outdoorLevels[]   = { 390,  630,  860, 1100, 1140, 1570, 1800, 2000 };
 const int indoorLevels[]    = {  28,   45,   62,   78,   95,  112,  130,  146 };
 const int minNumLightning[] = { 1, 5, 9, 16 };
 
-volatile static unsigned long counter = 0;       // Internal counter
+static_assert(AS3935_MAX_INSTANCES >= 1 && AS3935_MAX_INSTANCES <= 4, "1 to 4 instances are supported");
+
+AS3935* AS3935::instances[4];
+static int spiUsers = 0;
+
+template<int N>
+ICACHE_RAM_ATTR void AS3935::isr() {
+    AS3935* instance = instances[N];
+    if (instance != NULL) {
+        instance->handleInterrupt();
+    }
+}
 
-ICACHE_RAM_ATTR static void counterISR() {
-    counter++;
+// Interrupt handlers cannot take arguments, so there is a trampoline for every slot
+void (* const AS3935::trampolines[4])() = {
+    AS3935::isr<0>, AS3935::isr<1>, AS3935::isr<2>, AS3935::isr<3>
+};
+
+ICACHE_RAM_ATTR void AS3935::handleInterrupt() {
+    if (calibrating) {
+        calibrationCounter++;
+    } else {
+        seenInterrupts++;
+        pendingInterrupts.push(micros());
+    }
 }
 
 
 AS3935::AS3935(int csPin, int intPin) {
-    unsigned long now = millis();
     this->csPin = csPin;
     this->intPin = intPin;
+    this->slot = -1;
+    this->calibrationCounter = 0;
+    this->calibrating = false;
+    this->seenInterrupts = 0;
     this->frequency = 0;
-    this->lastNoiseLevelChange = now;
-    this->lastNoiseLevelRaise = now;
-    this->noiseLevelBalance = 0;
     this->currentNoiseFloorLevel = -1;
     this->currentOutdoorMode = false;
     this->noiseFloorLevelOutOfRange = false;
-    this->disturberCounterStart = now;
-    this->disturberCounter = 0;
     this->lastDisturber = 0;
+    this->calibrationState = CALIBRATION_IDLE;
+    this->calibrationJob = 0;
+    this->validRegisters = 0;
+    this->processedInterrupts = 0;
+    this->spiTransactions = 0;
+    this->spiStart = 0;
+    this->spiTime = 0;
+    this->eventHandler = NULL;
+    this->noiseController = &balanceNoiseController;
+    this->noiseControllerRestart = true;
+    this->capture = NULL;
+    this->captureId = 0;
+    this->capturedLost = 0;
+    this->calibrationBit = -1;
+    for (int ix = 0; ix < 4; ix++) {
+        this->calibrationFrequencies[ix] = 0;
+    }
 
     clearDetections();
 }
 
-void AS3935::begin() {
-    SPI.begin();
+bool AS3935::begin() {
+    if (slot < 0) {
+        for (int ix = 0; ix < AS3935_MAX_INSTANCES; ix++) {
+            if (instances[ix] == NULL) {
+                slot = ix;
+                break;
+            }
+        }
+        if (slot < 0) {
+            Serial.println("Too many AS3935 instances");
+            return false;
+        }
+        instances[slot] = this;
+
+        if (spiUsers++ == 0) {
+            SPI.begin();
+        }
+    }
 
     pinMode(this->csPin, OUTPUT);
     digitalWrite(this->csPin, HIGH);
 
     pinMode(this->intPin, INPUT);
 
-    attachInterrupt(digitalPinToInterrupt(this->intPin), counterISR, RISING);
+    attachInterrupt(digitalPinToInterrupt(this->intPin), trampolines[slot], RISING);
+    return true;
 }
 
 void AS3935::end() {
+    if (slot < 0) {
+        return;
+    }
+
     detachInterrupt(digitalPinToInterrupt(this->intPin));
     digitalWrite(this->csPin, HIGH);
-    SPI.end();
+    instances[slot] = NULL;
+    slot = -1;
+
+    // Keep the bus running as long as other detectors use it
+    if (--spiUsers == 0) {
+        SPI.end();
+    }
 }
 
 bool AS3935::update() {
+    if (isCalibrating()) {
+        // The interrupt pin is used for frequency measurement while calibrating
+        return updateCalibration();
+    }
+
     bool hasChanged = false;
     unsigned long now = millis();
 
-    if (counter > 0) {
-        counter = 0;
+    // Process pending interrupts whose settle time has passed. Younger interrupts, and
+    // interrupts exceeding the limit, stay in the queue until one of the next invocations.
+    unsigned long interruptMicros;
+    int processed = 0;
+    while (processed < MAX_INTERRUPTS_PER_UPDATE && pendingInterrupts.peek(interruptMicros)) {
+        unsigned long age = micros() - interruptMicros;
+        if (age < INTERRUPT_SETTLE_TIME) {
+            break;
+        }
+        pendingInterrupts.pop();
+        processedInterrupts++;
+        processed++;
 
-        open();
-        delay(2);       // wait 2 ms before reading the interrupt register!
-        char interrupt = spiRead(0x03) & 0x0F;
-        close();
+        unsigned long eventTime = now - age / 1000;
 
-        if ((interrupt & 0x01) != 0 && (now - lastNoiseLevelRaise) > NOISE_LEVEL_RAISE_DELAY) {
-            // Noise level too high
-            lastNoiseLevelChange = now;
-            lastNoiseLevelRaise = now;
-            noiseLevelBalance++;
-            if (noiseLevelBalance > 1) {
-                noiseLevelBalance--;
-                if (raiseNoiseFloorLevel()) {
-                    noiseFloorLevelOutOfRange = false;
-                    hasChanged = true;
-                } else {
-                    noiseFloorLevelOutOfRange = true;
-                }
-            }
+        // Read the interrupt register and the results in a single burst
+        byte results[5];
+        readRegisters(INTERRUPT::address, results, sizeof(results));
+        char interrupt = INTERRUPT::decode(results[0]);
+
+        if (capture != NULL && capture->isActive()) {
+            captureInterrupt(eventTime, age, results);
+        }
+
+        noiseController->onInterrupt(now, interrupt);
+
+        if ((interrupt & INT_NH) != 0) {
+            noiseRate.add(now);
         }
 
-        if ((interrupt & 0x04) != 0) {
+        if ((interrupt & INT_D) != 0) {
             // Disturber detected
-            disturberCounter++;
-            this->lastDisturber = now;
+            disturberRate.add(now);
+            this->lastDisturber = eventTime;
+            notify(AS3935_DISTURBER);
         }
 
-        if ((interrupt & 0x08) != 0) {
+        if ((interrupt & INT_L) != 0) {
             // Lightning detected
-            for (int ix = sizeof(lastLightningDetections) / sizeof(Lightning) - 1; ix > 0; ix--) {
-                lastLightningDetections[ix] = lastLightningDetections[ix - 1];
+            Lightning& lightning = lastLightningDetections.add();
+            lightning.time = eventTime;
+            lightning.energy = getEnergy();
+            lightning.distance = getEstimatedDistance();
+            lightningRate.add(now);
+            stormTracker.add(lightning.time, lightning.distance);
+            energyQuantiles.add(lightning.energy);
+            if (lightning.distance < 0x3F) {
+                distanceQuantiles.add(lightning.distance);
             }
-            lastLightningDetections[0].time = now;
-            lastLightningDetections[0].energy = getEnergy();
-            lastLightningDetections[0].distance = getEstimatedDistance();
             hasChanged = true;
+            notify(AS3935_LIGHTNING);
         }
     }
 
-    // Try to reduce the noise level again
-    if ((now - lastNoiseLevelChange) > NOISE_LEVEL_REDUCTION_DELAY) {
-        lastNoiseLevelChange = now;
-        noiseLevelBalance--;
-        if (noiseLevelBalance < -1) {
-            noiseLevelBalance++;
-            if (noiseFloorLevelOutOfRange) {
-                noiseFloorLevelOutOfRange = false;
-            } else {
-                reduceNoiseFloorLevel();
-                hasChanged = true;
-            }
+    if (now - lastNoiseSample >= NOISE_SAMPLE_INTERVAL) {
+        lastNoiseSample = now;
+        if (currentNoiseFloorLevel >= 0) {
+            noiseFloorQuantiles.add(currentNoiseFloorLevel);
         }
     }
 
+    // Let the noise controller adjust the settings
+    NoiseSettings settings = getNoiseSettings();
+    if (noiseControllerRestart) {
+        noiseControllerRestart = false;
+        noiseController->begin(now, settings);
+    }
+    if (noiseController->update(now, settings)) {
+        hasChanged |= applyNoiseSettings(settings);
+    }
+
     return hasChanged;
 }
 
 void AS3935::powerDown() {
-    open();
-    spiWrite(0x00, 0x25);
-    close();
+    Transaction transaction;
+    transaction.set<AFE_GB, AFE_GB_INDOOR>().set<PWD, 1>();
+    apply(transaction);
 }
 
 void AS3935::reset() {
     open();
-    spiWrite(0x3C, 0x96);       // PRESET_DEFAULT: Reset all registers
+    spiWrite(PRESET_DEFAULT, DIRECT_COMMAND);
     delay(2);
-    spiRead(0x03);              // Clear interrupts
-    counter = 0;
+    spiRead(INTERRUPT::address);  // Clear interrupts
     close();
+    invalidateRegisters(SHADOW_REGISTERS);
+    calibrating = false;
+    calibrationState = CALIBRATION_IDLE;
+    pendingInterrupts.clear();
+    noiseFloorLevelOutOfRange = false;
+
+    // All registers are back to default, so the controller's changes are gone as well
+    NoiseSettings discarded = NoiseSettings();
+    noiseController->end(discarded);
+    noiseControllerRestart = true;
 }
 
 unsigned long AS3935::calibrate(unsigned long freq) {
+    startCalibration(freq);
+    while (isCalibrating()) {
+        updateCalibration();
+        yield();
+    }
+    return this->frequency;
+}
+
+unsigned int AS3935::startCalibration(unsigned long freq) {
     open();
-    if (spiRead(0x00) & 0x37 == 0x00) {
+    if ((spiRead(AFE_GB::address) & 0x37) == 0x00) {
         Serial.println("The AS3935 does not respond. Please check your SPI wiring!");
     }
 
-    spiWrite(0x03, 0xC0);       // Set division ratio to 128
-
-    byte mask = 0x00;
-    unsigned long actualFreq;
-    unsigned long bestFreq;
-    byte testMask;
-    byte bestMask;
-    long bestDiff = 1000000;
-    long currentDiff;
-    for (int bit = 3; bit >= 0; bit--) {
-        testMask = mask | (1 << bit);
-        spiWrite(0x08, 0x80 | testMask);
-        delay(50);             // Let oscillator settle...
-
-        // Measure frequency for 500ms, repeat if not plausible
-        do {
-            counter = 0;
-            delay(500);
-            actualFreq = counter * 128 * 2;
-            currentDiff = actualFreq - freq;
-            if (currentDiff < 0) {
-                currentDiff = -currentDiff;
-            }
-        } while (actualFreq > 0 && currentDiff > 50000);
-
-        // Remember the best frequency and corresponding bit mask
-        if (currentDiff < bestDiff) {
-            bestDiff = currentDiff;
-            bestFreq = actualFreq;
-            bestMask = testMask;
-            if (bestDiff < 500) {
-                break;
-            }
-        }
-
-        // Test the next bit
-        if (actualFreq/1000 > freq/1000) {
-            mask = testMask;
-        }
+    spiWrite(LCO_FDIV::address, LCO_FDIV::encode(3));   // Set division ratio to 128
+    calibrating = true;
+    close();
+    invalidateRegisters(SHADOW_REGISTERS);
+
+    calibrationFreq = freq;
+    calibrationBit = 3;
+    calibrationMask = 0x00;
+    calibrationBestMask = 0x00;
+    calibrationBestFreq = 0;
+    calibrationBestDiff = 1000000;
+    calibrationRetries = 0;
+    for (int ix = 0; ix < 4; ix++) {
+        calibrationFrequencies[ix] = 0;
     }
+    calibrationJob++;
 
-    if (bestFreq == 0) {
-        Serial.println("No interrupt was detected during calibration. Please check your IRQ wiring!");
-    } else if (bestFreq < 483092 || bestFreq > 517500) {
-        Serial.println("Warning: calibrated frequency is out of tolerance range.");
-    }
+    startCalibrationBit();
+    return calibrationJob;
+}
 
-    this->frequency = bestFreq;
+bool AS3935::isCalibrating() const {
+    return calibrationState != CALIBRATION_IDLE;
+}
 
-    spiWrite(0x08, bestMask);       // Set the target frequency, disable DISP_LCO output
-    delay(50);                      // Let everything settle for a while
-    spiWrite(0x3D, 0x96);           // CALIB_RCO: Now calibrate the RCOs
-    spiWrite(0x08, 0x20 | bestMask); // Enable TRCO for calibration
-    delay(2);                       // Wait another 2 ms
-    spiWrite(0x08, bestMask);       // Disable TRCO again
-    delay(50);                      // Let everything settle again
-    spiRead(0x03);                  // Clear interrupts
-    counter = 0;
+unsigned int AS3935::getCalibrationJob() const {
+    return calibrationJob;
+}
 
-    close();
-    return bestFreq;
+int AS3935::getCalibrationBit() const {
+    return isCalibrating() ? calibrationBit : -1;
+}
+
+unsigned long AS3935::getCalibrationFrequency(int bit) const {
+    if (bit >= 0 && bit < 4) {
+        return calibrationFrequencies[bit];
+    }
+    return 0;
 }
 
 bool AS3935::raiseNoiseFloorLevel() {
     bool success = false;
-    open();
-    byte current = spiRead(0x01);
-    int value = (current >> 4) & 0x07;
-    value++;
-    if (value <= 7) {
-        spiWrite(0x01, (current & 0x8F) | value << 4);
+    Transaction transaction;
+    if (transaction.set<NF_LEV>(readField<NF_LEV>() + 1)) {
+        apply(transaction);
         success = true;
     }
     updateNoiseFloorLevel();
-    close();
     return success;
 }
 
 bool AS3935::reduceNoiseFloorLevel() {
     bool success = false;
-    open();
-    byte current = spiRead(0x01);
-    int value = (current >> 4) & 0x07;
-    value--;
-    if (value >= 0) {
-        spiWrite(0x01, (current & 0x8F) | value << 4);
+    Transaction transaction;
+    if (transaction.set<NF_LEV>(readField<NF_LEV>() - 1)) {
+        apply(transaction);
         success = true;
     }
     updateNoiseFloorLevel();
-    close();
     return success;
 }
 
 int AS3935::getNoiseFloorLevel() {
     if (currentNoiseFloorLevel == -1) {
-        open();
         updateNoiseFloorLevel();
-        close();
     }
     return currentNoiseFloorLevel;
 }
@@ -261,48 +336,49 @@ bool AS3935::isNoiseFloorLevelOutOfRange() const {
     return noiseFloorLevelOutOfRange;
 }
 
+void AS3935::setNoiseController(NoiseController* controller) {
+    stopNoiseController();
+    noiseController = controller != NULL ? controller : &balanceNoiseController;
+}
+
 bool AS3935::getOutdoorMode() const {
     return currentOutdoorMode;
 }
 
 void AS3935::setOutdoorMode(bool outdoor) {
-    open();
-    spiWrite(0x00, outdoor ? 0x1C : 0x24);
+    stopNoiseController();
+    Transaction transaction;
+    transaction.set<AFE_GB>(outdoor ? AFE_GB_OUTDOOR : AFE_GB_INDOOR);
+    transaction.set<PWD, 0>();
+    apply(transaction);
     updateNoiseFloorLevel();
-    close();
 }
 
 int AS3935::getWatchdogThreshold() {
-    open();
-    int current = spiRead(0x01) & 0x0F;
-    close();
-    return current;
+    return readField<WDTH>();
 }
 
 void AS3935::setWatchdogThreshold(int threshold) {
-    open();
-    byte current = spiRead(0x01);
-    current = (current & 0xF0) | (threshold & 0x0F);
-    spiWrite(0x01, current);
-    close();
+    stopNoiseController();
+    Transaction transaction;
+    if (transaction.set<WDTH>(threshold)) {
+        apply(transaction);
+    }
 }
 
 void AS3935::clearStatistics() {
-    open();
-    byte current = spiRead(0x02);
-    current &= 0xBF;
-    spiWrite(0x02, current);
+    Transaction low;
+    low.set<CL_STAT, 0>();
+    apply(low);
     delay(2);
-    current |= 0x40;
-    spiWrite(0x02, current);
-    close();
+    Transaction high;
+    high.set<CL_STAT, 1>();
+    apply(high);
+    invalidateRegisters(RESULT_REGISTERS);
 }
 
 int AS3935::getMinimumNumberOfLightning() const {
-    open();
-    int value = (spiRead(0x02) & 0x30) >> 4;
-    close();
-    return minNumLightning[value];
+    return minNumLightning[readField<MIN_NUM_LIGH>()];
 }
 
 void AS3935::setMinimumNumberOfLightning(int num) {
@@ -313,30 +389,42 @@ void AS3935::setMinimumNumberOfLightning(int num) {
         case  9: value = 0x02; break;
         case 16: value = 0x03; break;
     }
-    if (value >= 0) {
-        open();
-        byte current = spiRead(0x02);
-        current &= 0xCF;
-        current |= value << 4;
-        spiWrite(0x02, current);
-        close();
+    Transaction transaction;
+    if (transaction.set<MIN_NUM_LIGH>(value)) {
+        apply(transaction);
     }
 }
 
 int AS3935::getSpikeRejection() const {
-    open();
-    int value = spiRead(0x02) & 0x0F;
-    close();
-    return value;
+    return readField<SREJ>();
 }
 
 void AS3935::setSpikeRejection(int rejection) {
-    open();
-    byte current = spiRead(0x02);
-    current &= 0xF0;
-    current |= rejection & 0x0F;
-    spiWrite(0x02, current);
-    close();
+    stopNoiseController();
+    Transaction transaction;
+    if (transaction.set<SREJ>(rejection)) {
+        apply(transaction);
+    }
+}
+
+void AS3935::configure(const AS3935Settings& settings) {
+    stopNoiseController();
+    Transaction transaction;
+    transaction.set<AFE_GB>(settings.outdoorMode ? AFE_GB_OUTDOOR : AFE_GB_INDOOR);
+    transaction.set<PWD, 0>();
+    transaction.set<WDTH>(settings.watchdogThreshold);
+    for (int ix = 0; ix < 4; ix++) {
+        if (minNumLightning[ix] == settings.minimumNumberOfLightning) {
+            transaction.set<MIN_NUM_LIGH>(ix);
+        }
+    }
+    transaction.set<SREJ>(settings.spikeRejection);
+
+    // Completes register 0x02, so it does not need to be read first
+    transaction.set<CL_STAT, 1>();
+
+    apply(transaction);
+    updateNoiseFloorLevel();
 }
 
 unsigned long AS3935::getFrequency() const {
@@ -344,81 +432,129 @@ unsigned long AS3935::getFrequency() const {
 }
 
 unsigned long AS3935::getEnergy() const {
-    open();
-    byte mmsb = spiRead(0x06) & 0x1F;
-    byte msb  = spiRead(0x05) & 0xFF;
-    byte lsb  = spiRead(0x04) & 0xFF;
-    unsigned long energy = (mmsb << 16) | (msb << 8) | lsb;
-    close();
-    return energy;
+    byte mmsb = readField<S_LIG_MM>();
+    byte msb  = readField<S_LIG_M>();
+    byte lsb  = readField<S_LIG_L>();
+    return ((unsigned long) mmsb << 16) | (msb << 8) | lsb;
 }
 
 unsigned int AS3935::getEstimatedDistance() const {
-    open();
-    unsigned int distance = spiRead(0x07) & 0x3F;
-    close();
-    return distance;
+    return readField<DISTANCE>();
 }
 
 unsigned int AS3935::getDisturbersPerMinute() const {
-    return (60 * 1000L * disturberCounter) / (millis() - disturberCounterStart);
+    return disturberRate.getCount(RATE_1_MIN, millis());
+}
+
+void AS3935::getStormStatus(StormStatus& status) const {
+    stormTracker.getStatus(millis(), status);
+}
+
+unsigned int AS3935::getLightningCount(RateWindow window) const {
+    return lightningRate.getCount(window, millis());
+}
+
+unsigned int AS3935::getDisturberCount(RateWindow window) const {
+    return disturberRate.getCount(window, millis());
+}
+
+unsigned int AS3935::getNoiseCount(RateWindow window) const {
+    return noiseRate.getCount(window, millis());
+}
+
+const QuantileSketch& AS3935::getEnergyQuantiles() const {
+    return energyQuantiles;
+}
+
+const QuantileSketch& AS3935::getDistanceQuantiles() const {
+    return distanceQuantiles;
+}
+
+const QuantileSketch& AS3935::getNoiseFloorQuantiles() const {
+    return noiseFloorQuantiles;
+}
+
+unsigned long AS3935::getQuantilesSince() const {
+    return quantilesSince;
+}
+
+void AS3935::clearQuantiles() {
+    energyQuantiles.clear();
+    distanceQuantiles.clear();
+    noiseFloorQuantiles.clear();
+    quantilesSince = millis();
+    lastNoiseSample = quantilesSince;
 }
 
 bool AS3935::getLastLightningDetection(int index, Lightning& lightning) const {
-    if (index >= 0
-            && index < sizeof(lastLightningDetections) / sizeof(Lightning)
-            && lastLightningDetections[index].time != 0) {
-        lightning.time = lastLightningDetections[index].time;
-        lightning.energy = lastLightningDetections[index].energy;
-        lightning.distance = lastLightningDetections[index].distance;
+    if (index >= 0 && (size_t) index < lastLightningDetections.size()) {
+        lightning = lastLightningDetections[index];
         return true;
     }
     return false;
 }
 
+const AS3935History& AS3935::getLightnings() const {
+    return lastLightningDetections;
+}
+
+unsigned long AS3935::getLostInterrupts() const {
+    return pendingInterrupts.getDropped();
+}
+
+unsigned long AS3935::getInterrupts() const {
+    return seenInterrupts;
+}
+
+unsigned long AS3935::getProcessedInterrupts() const {
+    return processedInterrupts;
+}
+
+unsigned long AS3935::getSpiTransactions() const {
+    return spiTransactions;
+}
+
+unsigned long long AS3935::getSpiTime() const {
+    return spiTime;
+}
+
 unsigned long AS3935::getLastDisturber() const {
     return this->lastDisturber;
 }
 
 void AS3935::clearDetections() {
-    for (int ix = 0; ix < sizeof(lastLightningDetections) / sizeof(Lightning); ix++) {
-        lastLightningDetections[ix].time = 0;
-    }
-    disturberCounterStart = millis();
-    disturberCounter = 0;
+    lastLightningDetections.clear();
+    unsigned long now = millis();
+    lightningRate.clear(now);
+    disturberRate.clear(now);
+    noiseRate.clear(now);
+    stormTracker.clear();
+    clearQuantiles();
 }
 
 void AS3935::dump(byte* dump) const {
-    open();
-    digitalWrite(csPin, LOW);
-    SPI.transfer(0x40);
-    for (int i = 0; i < 0x33; i++) {
-        dump[i] = SPI.transfer(0x00);
-    }
-    digitalWrite(csPin, HIGH);
-    close();
+    readRegisters(0x00, dump, 0x33);
 }
 
 void AS3935::debug() const {
     char output[40];
-    open();
-    digitalWrite(csPin, LOW);
-    SPI.transfer(0x40);
+    byte values[0x33];
+    readRegisters(0x00, values, sizeof(values));
     for (int i = 0; i <= 0x32; i++) {
-        byte value = SPI.transfer(0x00);
-        sprintf(output, "%02X = %02X", i, value);
+        sprintf(output, "%02X = %02X", i, values[i]);
         Serial.println(output);
     }
-    digitalWrite(csPin, HIGH);
-    close();
 }
 
 void AS3935::open() const {
+    spiStart = micros();
+    spiTransactions++;
     SPI.beginTransaction(SPISettings(BITRATE, MSBFIRST, SPI_MODE1));
 }
 
 void AS3935::close() const {
     SPI.endTransaction();
+    spiTime += micros() - spiStart;
 }
 
 void AS3935::spiWrite(byte address, byte value) const {
@@ -436,8 +572,330 @@ byte AS3935::spiRead(byte address) const {
     return result;
 }
 
+void AS3935::spiReadBurst(byte address, byte* values, size_t length) const {
+    memset(values, 0, length);
+    digitalWrite(csPin, LOW);
+    SPI.transfer(0x40 | (address & 0x3F));
+    SPI.transferBytes(values, values, length);
+    digitalWrite(csPin, HIGH);
+}
+
+void AS3935::startCalibrationBit() {
+    open();
+    byte tuning = TUN_CAP::encode(calibrationMask | (1 << calibrationBit));
+    spiWrite(TUN_CAP::address, DISP_LCO::encode(1) | tuning);   // Show LCO on the IRQ pin
+    close();
+    calibrationState = CALIBRATION_SETTLE;
+    calibrationTimer = millis();
+}
+
+bool AS3935::updateCalibration() {
+    unsigned long now = millis();
+    unsigned long elapsed = now - calibrationTimer;
+
+    switch (calibrationState) {
+        case CALIBRATION_IDLE:
+            return false;
+
+        case CALIBRATION_SETTLE:
+            // Let oscillator settle...
+            if (elapsed >= 50) {
+                calibrationCounter = 0;
+                calibrationTimer = now;
+                calibrationState = CALIBRATION_MEASURE;
+            }
+            return false;
+
+        case CALIBRATION_MEASURE: {
+            // Measure frequency for 500ms, repeat if not plausible
+            if (elapsed < 500) {
+                return false;
+            }
+            unsigned long actualFreq = (calibrationCounter * 128 * 1000) / elapsed;
+            long currentDiff = actualFreq - calibrationFreq;
+            if (currentDiff < 0) {
+                currentDiff = -currentDiff;
+            }
+            if (actualFreq > 0 && currentDiff > 50000 && ++calibrationRetries < CALIBRATION_MAX_RETRIES) {
+                calibrationCounter = 0;
+                calibrationTimer = now;
+                return false;
+            }
+            calibrationRetries = 0;
+            calibrationFrequencies[calibrationBit] = actualFreq;
+
+            // Remember the best frequency and corresponding bit mask
+            byte testMask = calibrationMask | (1 << calibrationBit);
+            if (currentDiff < calibrationBestDiff) {
+                calibrationBestDiff = currentDiff;
+                calibrationBestFreq = actualFreq;
+                calibrationBestMask = testMask;
+            }
+
+            // Test the next bit
+            if (actualFreq/1000 > calibrationFreq/1000) {
+                calibrationMask = testMask;
+            }
+            if (calibrationBestDiff >= 500 && calibrationBit > 0) {
+                calibrationBit--;
+                startCalibrationBit();
+                return false;
+            }
+
+            open();
+            // Set the target frequency, disable DISP_LCO output
+            spiWrite(TUN_CAP::address, TUN_CAP::encode(calibrationBestMask));
+            close();
+            calibrationTimer = now;
+            calibrationState = CALIBRATION_TUNE;
+            return false;
+        }
+
+        case CALIBRATION_TUNE:
+            // Let everything settle for a while
+            if (elapsed >= 50) {
+                open();
+                // Now calibrate the RCOs, with TRCO enabled for calibration
+                spiWrite(CALIB_RCO, DIRECT_COMMAND);
+                spiWrite(TUN_CAP::address, DISP_TRCO::encode(1) | TUN_CAP::encode(calibrationBestMask));
+                close();
+                calibrationTimer = now;
+                calibrationState = CALIBRATION_RCO;
+            }
+            return false;
+
+        case CALIBRATION_RCO:
+            // Wait another 2 ms
+            if (elapsed >= 2) {
+                open();
+                // Disable TRCO again
+                spiWrite(TUN_CAP::address, TUN_CAP::encode(calibrationBestMask));
+                close();
+                calibrationTimer = now;
+                calibrationState = CALIBRATION_FINISH;
+            }
+            return false;
+
+        case CALIBRATION_FINISH:
+            // Let everything settle again
+            if (elapsed < 50) {
+                return false;
+            }
+            open();
+            spiRead(INTERRUPT::address);  // Clear interrupts
+            close();
+            invalidateRegisters(SHADOW_REGISTERS);
+            calibrating = false;
+            pendingInterrupts.clear();
+
+            if (calibrationBestFreq == 0) {
+                Serial.println("No interrupt was detected during calibration. Please check your IRQ wiring!");
+            } else if (calibrationBestFreq < 483092 || calibrationBestFreq > 517500) {
+                Serial.println("Warning: calibrated frequency is out of tolerance range.");
+            }
+
+            this->frequency = calibrationBestFreq;
+            calibrationState = CALIBRATION_IDLE;
+            return true;
+    }
+
+    return false;
+}
+
+byte AS3935::readRegister(byte address) const {
+    unsigned int bit = address < 9 ? 1 << address : 0;
+    if ((validRegisters & bit) != 0) {
+        return registers[address];
+    }
+    open();
+    byte value = spiRead(address);
+    close();
+    if ((SHADOW_REGISTERS & bit) != 0) {
+        registers[address] = value;
+        validRegisters |= bit;
+    }
+    return value;
+}
+
+void AS3935::readRegisters(byte address, byte* values, size_t length) const {
+    open();
+    spiReadBurst(address, values, length);
+    close();
+    for (size_t ix = 0; ix < length && address + ix < 9; ix++) {
+        unsigned int bit = 1 << (address + ix);
+        if ((SHADOW_REGISTERS & bit) != 0) {
+            registers[address + ix] = values[ix];
+            validRegisters |= bit;
+        }
+    }
+}
+
+void AS3935::writeRegister(byte address, byte value) {
+    open();
+    spiWrite(address, value);
+    close();
+    unsigned int bit = address < 9 ? 1 << address : 0;
+    if ((SHADOW_REGISTERS & bit) != 0) {
+        registers[address] = value;
+        validRegisters |= bit;
+    }
+}
+
+void AS3935::invalidateRegisters(unsigned int mask) const {
+    validRegisters &= ~mask;
+}
+
+void AS3935::apply(const Transaction& transaction) {
+    // Registers that are only partially changed need their current value
+    unsigned int readMask = 0;
+    for (byte address = 0x00; address < 0x09; address++) {
+        unsigned int bit = 1 << address;
+        if (transaction.getMask(address) != 0
+                && !transaction.isComplete(address)
+                && (SHADOW_REGISTERS & bit) != 0
+                && (validRegisters & bit) == 0) {
+            readMask |= bit;
+        }
+    }
+
+    // The SPI transaction is only opened if the detector needs to be accessed at all
+    bool opened = false;
+
+    byte values[9];
+    for (byte address = 0x00; address < 0x09;) {
+        if ((readMask & (1 << address)) == 0) {
+            address++;
+            continue;
+        }
+        byte last = address;
+        while (last < 0x08 && (readMask & (1 << (last + 1))) != 0) {
+            last++;
+        }
+        if (!opened) {
+            open();
+            opened = true;
+        }
+        spiReadBurst(address, &values[address], last - address + 1);
+        for (; address <= last; address++) {
+            registers[address] = values[address];
+            validRegisters |= 1 << address;
+        }
+    }
+
+    for (byte address = 0x00; address < 0x09; address++) {
+        byte mask = transaction.getMask(address);
+        if (mask == 0) {
+            continue;
+        }
+        unsigned int bit = 1 << address;
+        bool known = (validRegisters & bit) != 0;
+        byte current = known ? registers[address] : 0x00;
+        byte value = (current & ~mask) | transaction.getValue(address);
+        if (!known || value != current) {
+            if (!opened) {
+                open();
+                opened = true;
+            }
+            spiWrite(address, value);
+        }
+        if ((SHADOW_REGISTERS & bit) != 0) {
+            registers[address] = value;
+            validRegisters |= bit;
+        }
+    }
+
+    if (opened) {
+        close();
+    }
+}
+
+void AS3935::onEvent(AS3935EventHandler handler) {
+    this->eventHandler = handler;
+}
+
+void AS3935::setCapture(CaptureRing* ring, int id) {
+    this->capture = ring;
+    this->captureId = id;
+    this->capturedLost = pendingInterrupts.getDropped();
+}
+
+void AS3935::captureInterrupt(unsigned long time, unsigned long delay, const byte* results) {
+    CaptureRecord record;
+    record.time = time;
+    record.delay = delay < 0xFFFF ? delay : 0xFFFF;
+    record.detector = captureId;
+
+    unsigned long dropped = pendingInterrupts.getDropped();
+    unsigned long lost = dropped - capturedLost;
+    capturedLost = dropped;
+    record.lost = lost < 0xFF ? lost : 0xFF;
+
+    // The settings are shadowed, so they usually do not need another SPI transaction
+    for (byte address = 0x00; address < 0x03; address++) {
+        record.registers[address] = readRegister(address);
+    }
+    memcpy(&record.registers[3], results, 5);
+    capture->add(record);
+}
+
+void AS3935::notify(AS3935Event event) {
+    if (eventHandler != NULL) {
+        eventHandler(*this, event);
+    }
+}
+
 void AS3935::updateNoiseFloorLevel() {
-    int level = (spiRead(0x01) >> 4) & 0x07;
-    currentOutdoorMode = spiRead(0x00) == 0x1C;
+    int level = readField<NF_LEV>();
+    int previousNoiseFloorLevel = currentNoiseFloorLevel;
+    currentOutdoorMode = readField<AFE_GB>() == AFE_GB_OUTDOOR;
     currentNoiseFloorLevel = currentOutdoorMode ? outdoorLevels[level] : indoorLevels[level];
+    if (previousNoiseFloorLevel != -1 && previousNoiseFloorLevel != currentNoiseFloorLevel) {
+        notify(AS3935_NOISE_FLOOR);
+    }
+}
+
+NoiseSettings AS3935::getNoiseSettings() const {
+    NoiseSettings settings;
+    settings.noiseFloorLevel = readField<NF_LEV>();
+    settings.watchdogThreshold = readField<WDTH>();
+    settings.spikeRejection = readField<SREJ>();
+    settings.outOfRange = noiseFloorLevelOutOfRange;
+    return settings;
+}
+
+bool AS3935::applyNoiseSettings(const NoiseSettings& settings) {
+    noiseFloorLevelOutOfRange = settings.outOfRange;
+
+    // Both registers are changed in a single SPI transaction
+    NoiseSettings current = getNoiseSettings();
+    Transaction transaction;
+    if (settings.noiseFloorLevel != current.noiseFloorLevel) {
+        transaction.set<NF_LEV>(settings.noiseFloorLevel);
+    }
+    if (settings.watchdogThreshold != current.watchdogThreshold) {
+        transaction.set<WDTH>(settings.watchdogThreshold);
+    }
+    if (settings.spikeRejection != current.spikeRejection) {
+        transaction.set<SREJ>(settings.spikeRejection);
+    }
+    if (transaction.isEmpty()) {
+        return false;
+    }
+
+    apply(transaction);
+    if (settings.noiseFloorLevel != current.noiseFloorLevel) {
+        updateNoiseFloorLevel();
+    }
+    return true;
+}
+
+void AS3935::stopNoiseController() {
+    // Only read the registers if there is something to hand back
+    if (noiseController->isBoosted()) {
+        NoiseSettings settings = getNoiseSettings();
+        if (noiseController->end(settings)) {
+            applyNoiseSettings(settings);
+        }
+    }
+    noiseControllerRestart = true;
 }
@@ -18,10 +18,48 @@
 #ifndef __AS3935__
 #define __AS3935__
 
-struct Lightning {
-    unsigned long time;
-    unsigned long energy;
-    unsigned int distance;
+#include "AS3935Registers.h"
+#include "CaptureRing.h"
+#include "EventQueue.h"
+#include "LightningHistory.h"
+#include "NoiseController.h"
+#include "QuantileSketch.h"
+#include "RateCounter.h"
+#include "StormTracker.h"
+
+// Number of lightnings to be kept in the history. Can be raised on boards with spare RAM.
+#ifndef AS3935_HISTORY_SIZE
+#define AS3935_HISTORY_SIZE 64
+#endif
+
+// Maximum number of detectors that can be connected to a single microcontroller.
+#ifndef AS3935_MAX_INSTANCES
+#define AS3935_MAX_INSTANCES 4
+#endif
+
+typedef LightningHistory<AS3935_HISTORY_SIZE> AS3935History;
+
+class AS3935;
+
+/**
+ * Events that are reported by the AS3935 driver.
+ */
+enum AS3935Event {
+    AS3935_LIGHTNING,           // a lightning was detected and added to the history
+    AS3935_DISTURBER,           // a disturber was detected
+    AS3935_NOISE_FLOOR,         // the noise floor level has changed
+};
+
+typedef void (*AS3935EventHandler)(AS3935& detector, AS3935Event event);
+
+/**
+ * Detector configuration, as it is applied by AS3935::configure().
+ */
+struct AS3935Settings {
+    bool outdoorMode;               // outdoor mode enabled
+    int watchdogThreshold;          // watchdog threshold, 0 to 15
+    int minimumNumberOfLightning;   // minimum number of lightning, 1, 5, 9 or 16
+    int spikeRejection;             // spike rejection, 0 to 15
 };
 
 /**
@@ -29,14 +67,29 @@ struct Lightning {
  *
  * The driver takes care for automatic adjustment of the noise floor level. If too much
  * noise is detected, the noise floor level is raised automatically. After a while, the
- * noise floor level is lowered again.
+ * noise floor level is lowered again. The adjustment is done by a NoiseController, which
+ * can be replaced.
  *
- * The driver collects the time, energy and distance of up to 64 lightning events. After
- * that, if another lightning is detected, the oldest event is removed.
+ * The driver collects the time, energy and distance of up to AS3935_HISTORY_SIZE (64 by
+ * default) lightning events. After that, if another lightning is detected, the oldest
+ * event is removed.
  *
  * All returned times represent the system time (millis()) when the event occurred.
  *
- * Note that for technical reasons, you can only run one instance per microcontroller.
+ * The distributions of the lightning energy and distance, and of the noise floor level,
+ * are estimated by QuantileSketches, so percentiles are available over any period
+ * without keeping the lightnings.
+ *
+ * The configuration and result registers are shadowed, so reading the settings does not
+ * cause SPI traffic. The shadow is invalidated on reset and calibration, and the result
+ * registers on every interrupt.
+ *
+ * Up to AS3935_MAX_INSTANCES detectors can share the SPI bus. Each detector needs its
+ * own chip select and interrupt pin, and has its own interrupt handler and interrupt
+ * queue. All SPI transactions are carried out by update() and the other methods in the
+ * main loop, never in an interrupt context, so they are always serialized. update()
+ * only processes a few interrupts per invocation, so the detectors take turns on the
+ * bus even if one of them is flooded with interrupts.
  */
 class AS3935 {
 public:
@@ -51,8 +104,10 @@ public:
 
     /**
      * Begin working with the detector. This call initiates the hardware.
+     *
+     * @return false if there are already AS3935_MAX_INSTANCES active detectors
      */
-    void begin();
+    bool begin();
 
     /**
      * End working with the detector. Resources are freed.
@@ -61,7 +116,8 @@ public:
 
     /**
      * Update the detector status. This method should be invoked frequently, e.g. in
-     * loop().
+     * loop(). It never blocks. Interrupts are queued by the ISR, and are processed
+     * after the interrupt register has settled.
      *
      * @return true if something has changed, false if nothing happened
      */
@@ -85,11 +141,51 @@ public:
      * cannot be reached, the closest possible frequency is used instead. System RCO and
      * Timer RCO are calibrated as well.
      *
+     * This method blocks until the calibration is completed. Use startCalibration() for
+     * a non-blocking calibration.
+     *
      * @param freq      Target frequency in Hz, 500 kHz by default
      * @return Actual tuned-in resonator frequency (measured, not 100% accurate)
      */
     unsigned long calibrate(unsigned long freq = 500000);
 
+    /**
+     * Start auto-tuning the antenna resonator to the given frequency, and return
+     * immediately. The calibration is advanced by update(), which returns true when the
+     * calibration is completed. No lightnings are detected while calibrating.
+     *
+     * A running calibration is restarted. reset() aborts a running calibration.
+     *
+     * @param freq      Target frequency in Hz, 500 kHz by default
+     * @return Job number of this calibration run
+     */
+    unsigned int startCalibration(unsigned long freq = 500000);
+
+    /**
+     * Return true if a calibration is currently in progress.
+     */
+    bool isCalibrating() const;
+
+    /**
+     * Return the job number of the current or last calibration run. 0 if the detector
+     * has not been calibrated yet.
+     */
+    unsigned int getCalibrationJob() const;
+
+    /**
+     * Return the tuning capacitor bit that is currently tested, from 3 down to 0, or -1
+     * if no calibration is in progress.
+     */
+    int getCalibrationBit() const;
+
+    /**
+     * Return the frequency that was measured while testing the given tuning capacitor
+     * bit in the current or last calibration run. 0 if the bit was not tested.
+     *
+     * @param bit       Tuning capacitor bit, 0 to 3
+     */
+    unsigned long getCalibrationFrequency(int bit) const;
+
     /**
      * Raise the noise floor level. The detector will be less sensitive to noise, but also
      * less sensitive to lightning events.
@@ -123,6 +219,15 @@ public:
      */
     bool isNoiseFloorLevelOutOfRange() const;
 
+    /**
+     * Set the controller that adjusts the noise floor level. The controller is restarted
+     * whenever the outdoor mode, watchdog threshold or spike rejection is changed.
+     *
+     * @param controller    NoiseController to be used, or NULL to use the built-in
+     *                      BalanceNoiseController
+     */
+    void setNoiseController(NoiseController* controller);
+
     /**
      * Return the current outdoor mode setting.
      */
@@ -170,6 +275,13 @@ public:
      */
     void setSpikeRejection(int rejection);
 
+    /**
+     * Apply a complete configuration. All registers are changed in a single SPI
+     * transaction, so this is faster than invoking the individual setters. Invalid
+     * values are ignored, like the setters do.
+     */
+    void configure(const AS3935Settings& settings);
+
     /**
      * Read the resonator frequency since last calibration run. If 0, the detector has not
      * been calibrated yet. The frequency was measured and is not 100% accurate.
@@ -190,11 +302,65 @@ public:
     unsigned int getEstimatedDistance() const;
 
     /**
-     * Return the number of detected disturbers per minute. The value is cleared when
-     * clearDetections() is invoked.
+     * Return the number of disturbers that were detected within the last minute. The
+     * value is cleared when clearDetections() is invoked.
      */
     unsigned int getDisturbersPerMinute() const;
 
+    /**
+     * Return the number of lightnings that were detected within the given window. The
+     * rate counters are cleared when clearDetections() is invoked.
+     */
+    unsigned int getLightningCount(RateWindow window) const;
+
+    /**
+     * Return the number of disturbers that were detected within the given window.
+     */
+    unsigned int getDisturberCount(RateWindow window) const;
+
+    /**
+     * Return the number of noise interrupts within the given window.
+     */
+    unsigned int getNoiseCount(RateWindow window) const;
+
+    /**
+     * Return a summary of the current storm, derived from the detected lightnings. The
+     * storm is forgotten when clearDetections() is invoked.
+     *
+     * @param status    Target structure
+     */
+    void getStormStatus(StormStatus& status) const;
+
+    /**
+     * Return the distribution of the energy of all lightnings since the quantiles were
+     * cleared.
+     */
+    const QuantileSketch& getEnergyQuantiles() const;
+
+    /**
+     * Return the distribution of the estimated distance of all lightnings within range
+     * since the quantiles were cleared, in km.
+     */
+    const QuantileSketch& getDistanceQuantiles() const;
+
+    /**
+     * Return the distribution of the noise floor level since the quantiles were cleared,
+     * in µVrms. The level is sampled once per minute, so the distribution is weighted by
+     * the time the level was used.
+     */
+    const QuantileSketch& getNoiseFloorQuantiles() const;
+
+    /**
+     * Return the time when the quantiles were cleared.
+     */
+    unsigned long getQuantilesSince() const;
+
+    /**
+     * Clear the distributions of energy, distance and noise floor level. They are also
+     * cleared when clearDetections() is invoked.
+     */
+    void clearQuantiles();
+
     /**
      * Return one of the last detected lightnings. Lightnings are always returned in
      * descending order, starting from the most recent event.
@@ -206,6 +372,39 @@ public:
      */
     bool getLastLightningDetection(int index, Lightning& lightning) const;
 
+    /**
+     * Return the history of the last detected lightnings. It can be iterated in place,
+     * starting from the most recent event.
+     */
+    const AS3935History& getLightnings() const;
+
+    /**
+     * Return the number of interrupts that were lost because update() was not invoked
+     * frequently enough.
+     */
+    unsigned long getLostInterrupts() const;
+
+    /**
+     * Return the number of detector interrupts that were seen by the interrupt
+     * handler. Interrupts during calibration are not counted.
+     */
+    unsigned long getInterrupts() const;
+
+    /**
+     * Return the number of detector interrupts that were processed by update().
+     */
+    unsigned long getProcessedInterrupts() const;
+
+    /**
+     * Return the number of SPI transactions with the detector.
+     */
+    unsigned long getSpiTransactions() const;
+
+    /**
+     * Return the total time spent in SPI transactions with the detector, in µs.
+     */
+    unsigned long long getSpiTime() const;
+
     /**
      * Return the time of the last detected disturber.
      */
@@ -216,6 +415,26 @@ public:
      */
     void clearDetections();
 
+    /**
+     * Set a handler that is invoked on every detector event. The handler is invoked by
+     * update() or by the method that changed the noise floor level, so it runs in the
+     * main loop and not in an interrupt context. The detector that caused the event is
+     * passed to the handler, so a single handler can serve several detectors.
+     *
+     * @param handler   Event handler, or NULL to remove the handler
+     */
+    void onEvent(AS3935EventHandler handler);
+
+    /**
+     * Capture every processed interrupt with the raw contents of the registers 0x00 to
+     * 0x07. Nothing is captured while the ring is not active. Several detectors can
+     * share a ring.
+     *
+     * @param ring      CaptureRing to record to, or NULL to stop capturing
+     * @param id        Index of the detector that is stored in the records
+     */
+    void setCapture(CaptureRing* ring, int id = 0);
+
     /**
      * Dump the AS3935 register set.
      *
@@ -229,19 +448,75 @@ public:
     void debug() const;
 
 private:
+    enum CalibrationState {
+        CALIBRATION_IDLE,
+        CALIBRATION_SETTLE,
+        CALIBRATION_MEASURE,
+        CALIBRATION_TUNE,
+        CALIBRATION_RCO,
+        CALIBRATION_FINISH,
+    };
+
+    static AS3935* instances[4];
+    static void (* const trampolines[4])();
+
     int csPin;
     int intPin;
+    int slot;
+    volatile unsigned long calibrationCounter;
+    volatile bool calibrating;
+    volatile unsigned long seenInterrupts;
+    EventQueue<unsigned long, 32> pendingInterrupts;
     unsigned long frequency;
-    unsigned long lastNoiseLevelChange;
-    unsigned long lastNoiseLevelRaise;
-    unsigned long disturberCounterStart;
+    CalibrationState calibrationState;
+    unsigned int calibrationJob;
+    unsigned long calibrationTimer;
+    unsigned long calibrationFreq;
+    unsigned long calibrationBestFreq;
+    unsigned long calibrationFrequencies[4];
+    long calibrationBestDiff;
+    int calibrationBit;
+    int calibrationRetries;
+    byte calibrationMask;
+    byte calibrationBestMask;
     unsigned long lastDisturber;
-    int noiseLevelBalance;
     int currentNoiseFloorLevel;
-    unsigned int disturberCounter;
     bool currentOutdoorMode;
     bool noiseFloorLevelOutOfRange;
-    Lightning lastLightningDetections[64];
+    AS3935History lastLightningDetections;
+    RateCounter lightningRate;
+    RateCounter disturberRate;
+    RateCounter noiseRate;
+    StormTracker stormTracker;
+    QuantileSketch energyQuantiles;
+    QuantileSketch distanceQuantiles;
+    QuantileSketch noiseFloorQuantiles;
+    unsigned long quantilesSince;
+    unsigned long lastNoiseSample;
+    AS3935EventHandler eventHandler;
+    BalanceNoiseController balanceNoiseController;
+    NoiseController* noiseController;
+    bool noiseControllerRestart;
+    CaptureRing* capture;
+    uint8_t captureId;
+    unsigned long capturedLost;
+    mutable byte registers[9];
+    mutable unsigned int validRegisters;
+    unsigned long processedInterrupts;
+    mutable unsigned long spiTransactions;
+    mutable unsigned long spiStart;
+    mutable unsigned long long spiTime;
+
+    /**
+     * Interrupt handler trampoline of an instance slot.
+     */
+    template<int N>
+    static void isr();
+
+    /**
+     * Handle an interrupt of this detector. Runs in interrupt context.
+     */
+    void handleInterrupt();
 
     /**
      * Open the connection to the detector.
@@ -271,12 +546,120 @@ private:
      */
     byte spiRead(byte address) const;
 
+    /**
+     * Read a sequence of registers in a single burst, using the auto-increment of the
+     * register address.
+     *
+     * @param address       Address of the first register to read
+     * @param values        Target buffer for the register values
+     * @param length        Number of registers to read
+     */
+    void spiReadBurst(byte address, byte* values, size_t length) const;
+
+    /**
+     * Read from a register, using the shadow register if possible. A separate SPI
+     * transaction is used if the register needs to be read from the detector.
+     *
+     * @param address       Register address to read
+     * @return Current register value
+     */
+    byte readRegister(byte address) const;
+
+    /**
+     * Write to a register, and update the shadow register. A separate SPI transaction is
+     * used.
+     *
+     * @param address       Register address to write
+     * @param value         New register value
+     */
+    void writeRegister(byte address, byte value);
+
+    /**
+     * Read a sequence of registers from the detector in a single SPI transaction, and
+     * update the shadow registers. The shadow is not used for reading.
+     *
+     * @param address       Address of the first register to read
+     * @param values        Target buffer for the register values
+     * @param length        Number of registers to read
+     */
+    void readRegisters(byte address, byte* values, size_t length) const;
+
+    /**
+     * Invalidate shadow registers, so they are read from the detector again.
+     *
+     * @param mask          Bit mask of the registers to invalidate, bit 0 is register 0x00
+     */
+    void invalidateRegisters(unsigned int mask) const;
+
+    /**
+     * Read a register field, using the shadow register if possible.
+     */
+    template<typename FIELD>
+    byte readField() const {
+        return FIELD::decode(readRegister(FIELD::address));
+    }
+
+    /**
+     * Apply all field updates of a transaction in a single SPI transaction, and update
+     * the shadow registers. Registers that are only partially changed are read first,
+     * unless they are shadowed. Consecutive registers are read in a single burst.
+     * Registers are only written if their value has changed.
+     *
+     * @param transaction   Field updates to apply
+     */
+    void apply(const as3935::Transaction& transaction);
+
+    /**
+     * Start measuring the resonator frequency with the current calibration bit set.
+     */
+    void startCalibrationBit();
+
+    /**
+     * Advance the calibration state machine.
+     *
+     * @return true if the calibration has been completed
+     */
+    bool updateCalibration();
+
+    /**
+     * Add a processed interrupt to the capture ring.
+     *
+     * @param time          Time of the interrupt
+     * @param delay         Time from the interrupt until the registers were read, in µs
+     * @param results       Registers 0x03 to 0x07, as read after the interrupt
+     */
+    void captureInterrupt(unsigned long time, unsigned long delay, const byte* results);
+
+    /**
+     * Notify the event handler about an event.
+     */
+    void notify(AS3935Event event);
+
     /**
      * Read the current noise floor level from the detector, and update the object's
      * state accordingly.
      */
     void updateNoiseFloorLevel();
 
+    /**
+     * Read the detector settings that are adjusted by the noise controller.
+     */
+    NoiseSettings getNoiseSettings() const;
+
+    /**
+     * Write the detector settings that were adjusted by the noise controller.
+     *
+     * @return true if the settings were changed
+     */
+    bool applyNoiseSettings(const NoiseSettings& settings);
+
+    /**
+     * Stop the noise controller, and write back the settings that it hands back. It is
+     * restarted with the next update(). Must be invoked before the noise controller is
+     * replaced, or before the settings it adjusts are changed.
+     */
+    void stopNoiseController();
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,230 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AS3935Registers__
+#define __AS3935Registers__
+
+#include <stdint.h>
+
+/**
+ * The register set of the AS3935, as described in its datasheet.
+ */
+namespace as3935 {
+
+    /**
+     * Return the position of the lowest bit of a mask.
+     */
+    constexpr uint8_t lowestBit(uint8_t mask) {
+        return (mask & 0x01) != 0 ? 0 : 1 + lowestBit(mask >> 1);
+    }
+
+    /**
+     * Return the reserved bits of a register. They are written with their default.
+     */
+    constexpr uint8_t reservedBits(uint8_t address) {
+        return address == 0x00 ? 0xC0
+             : address == 0x01 ? 0x80
+             : address == 0x02 ? 0x80
+             : address == 0x03 ? 0x10
+             : address == 0x08 ? 0x10
+             : 0x00;
+    }
+
+    /**
+     * Return the default of the reserved bits of a register.
+     */
+    constexpr uint8_t reservedDefault(uint8_t address) {
+        return address == 0x02 ? 0x80 : 0x00;
+    }
+
+    /**
+     * Return true if the register can be changed by a Transaction. The results are read
+     * only, and the calibration and direct command registers are not shadowed. Register
+     * 0x03 is excluded as well, as it cannot be read without clearing the interrupt, so
+     * a partial change would overwrite its other fields.
+     */
+    constexpr bool isWritable(uint8_t address) {
+        return address <= 0x02 || address == 0x08;
+    }
+
+    /**
+     * A field of a register.
+     *
+     * @param ADDRESS   Register address
+     * @param MASK      Bits of the field within the register
+     * @param LOWEST    Lowest legal value
+     * @param HIGHEST   Highest legal value, by default all bits of the field
+     */
+    template<uint8_t ADDRESS, uint8_t MASK, uint8_t LOWEST = 0, uint8_t HIGHEST = (MASK >> lowestBit(MASK))>
+    struct Field {
+        static_assert(MASK != 0, "A field needs at least one bit");
+        static_assert(HIGHEST <= (MASK >> lowestBit(MASK)), "HIGHEST does not fit into the field");
+
+        enum : uint8_t {
+            address = ADDRESS,
+            mask = MASK,
+            shift = lowestBit(MASK),
+            lowest = LOWEST,
+            highest = HIGHEST,
+        };
+
+        /**
+         * Return true if the value is legal for this field.
+         */
+        static constexpr bool isLegal(int value) {
+            return value >= LOWEST && value <= HIGHEST;
+        }
+
+        /**
+         * Return the field value at its position in the register.
+         */
+        static constexpr uint8_t encode(uint8_t value) {
+            return (value << shift) & MASK;
+        }
+
+        /**
+         * Return the field value of a register value.
+         */
+        static constexpr uint8_t decode(uint8_t registerValue) {
+            return (registerValue & MASK) >> shift;
+        }
+    };
+
+    typedef Field<0x00, 0x3E, 0x0E, 0x12> AFE_GB;   // AFE gain boost
+    typedef Field<0x00, 0x01> PWD;                  // power down
+    typedef Field<0x01, 0x70> NF_LEV;               // noise floor level
+    typedef Field<0x01, 0x0F> WDTH;                 // watchdog threshold
+    typedef Field<0x02, 0x40> CL_STAT;              // clear statistics, when toggled high-low-high
+    typedef Field<0x02, 0x30> MIN_NUM_LIGH;         // minimum number of lightning, 1, 5, 9 or 16
+    typedef Field<0x02, 0x0F> SREJ;                 // spike rejection
+    typedef Field<0x03, 0xC0> LCO_FDIV;             // frequency division ratio of the antenna output
+    typedef Field<0x03, 0x20> MASK_DIST;            // mask disturber
+    typedef Field<0x03, 0x0F> INTERRUPT;            // interrupt, read only, cleared on read
+    typedef Field<0x04, 0xFF> S_LIG_L;              // energy of the lightning, LSB
+    typedef Field<0x05, 0xFF> S_LIG_M;              // energy of the lightning, MSB
+    typedef Field<0x06, 0x1F> S_LIG_MM;             // energy of the lightning, MMSB
+    typedef Field<0x07, 0x3F> DISTANCE;             // distance estimation
+    typedef Field<0x08, 0x80> DISP_LCO;             // display LCO on the IRQ pin
+    typedef Field<0x08, 0x40> DISP_SRCO;            // display SRCO on the IRQ pin
+    typedef Field<0x08, 0x20> DISP_TRCO;            // display TRCO on the IRQ pin
+    typedef Field<0x08, 0x0F> TUN_CAP;              // internal tuning capacitors
+    typedef Field<0x3A, 0x80> TRCO_CALIB_DONE;      // TRCO calibration successful
+    typedef Field<0x3A, 0x40> TRCO_CALIB_NOK;       // TRCO calibration not successful
+    typedef Field<0x3B, 0x80> SRCO_CALIB_DONE;      // SRCO calibration successful
+    typedef Field<0x3B, 0x40> SRCO_CALIB_NOK;       // SRCO calibration not successful
+
+    const uint8_t AFE_GB_INDOOR = 0x12;
+    const uint8_t AFE_GB_OUTDOOR = 0x0E;
+
+    const uint8_t INT_NH = 0x01;                    // interrupt: noise level too high
+    const uint8_t INT_D = 0x04;                     // interrupt: disturber detected
+    const uint8_t INT_L = 0x08;                     // interrupt: lightning detected
+
+    const uint8_t PRESET_DEFAULT = 0x3C;            // direct command: reset all registers
+    const uint8_t CALIB_RCO = 0x3D;                 // direct command: calibrate the RCOs
+    const uint8_t DIRECT_COMMAND = 0x96;            // value that triggers a direct command
+
+    /**
+     * Collects updates of register fields, so they can be applied to the detector at
+     * once. Updates of fields of the same register are merged, so every register is read
+     * and written at most once.
+     *
+     * Constant values are checked at compile time, by set<FIELD, VALUE>(). Other values
+     * are checked at runtime, by set<FIELD>(value).
+     */
+    class Transaction {
+    public:
+        Transaction() {
+            for (int ix = 0; ix < 9; ix++) {
+                masks[ix] = 0;
+                values[ix] = 0;
+            }
+        }
+
+        /**
+         * Set a field to a constant value.
+         */
+        template<typename FIELD, uint8_t VALUE>
+        Transaction& set() {
+            static_assert(isWritable(FIELD::address), "The register cannot be written");
+            static_assert(FIELD::isLegal(VALUE), "The value is not legal for this field");
+            put(FIELD::address, FIELD::mask, FIELD::encode(VALUE));
+            return *this;
+        }
+
+        /**
+         * Set a field to a value.
+         *
+         * @return false if the value is not legal for this field, and was ignored
+         */
+        template<typename FIELD>
+        bool set(int value) {
+            static_assert(isWritable(FIELD::address), "The register cannot be written");
+            if (!FIELD::isLegal(value)) {
+                return false;
+            }
+            put(FIELD::address, FIELD::mask, FIELD::encode(value));
+            return true;
+        }
+
+        /**
+         * Return true if no field was set.
+         */
+        bool isEmpty() const {
+            for (int ix = 0; ix < 9; ix++) {
+                if (masks[ix] != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Return the bits of a register that are changed.
+         */
+        uint8_t getMask(uint8_t address) const {
+            return masks[address];
+        }
+
+        /**
+         * Return the new values of the changed bits of a register.
+         */
+        uint8_t getValue(uint8_t address) const {
+            return values[address];
+        }
+
+        /**
+         * Return true if all bits of a register are set, so it can be written without
+         * reading it first.
+         */
+        bool isComplete(uint8_t address) const {
+            return (masks[address] | reservedBits(address)) == 0xFF;
+        }
+
+    private:
+        uint8_t masks[9];
+        uint8_t values[9];
+
+        void put(uint8_t address, uint8_t mask, uint8_t value) {
+            masks[address] |= mask | reservedBits(address);
+            values[address] = (values[address] & ~mask & ~reservedBits(address))
+                    | value | reservedDefault(address);
+        }
+    };
+}
+
+#endif
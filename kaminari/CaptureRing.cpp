@@ -0,0 +1,85 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+
+#include "CaptureRing.h"
+
+CaptureRing::CaptureRing() {
+    this->records = NULL;
+    this->start = 0;
+    this->head = 0;
+    this->count = 0;
+    this->overwritten = 0;
+}
+
+CaptureRing::~CaptureRing() {
+    end();
+}
+
+bool CaptureRing::begin() {
+    if (records == NULL) {
+        records = (CaptureRecord*) malloc(CAPTURE_RING_SIZE * sizeof(CaptureRecord));
+        if (records == NULL) {
+            return false;
+        }
+    }
+    start = millis();
+    head = 0;
+    count = 0;
+    overwritten = 0;
+    return true;
+}
+
+void CaptureRing::end() {
+    free(records);
+    records = NULL;
+    head = 0;
+    count = 0;
+}
+
+void CaptureRing::add(const CaptureRecord& record) {
+    if (records == NULL) {
+        return;
+    }
+    records[head] = record;
+    head = (head + 1) % CAPTURE_RING_SIZE;
+    if (count < CAPTURE_RING_SIZE) {
+        count++;
+    } else {
+        overwritten++;
+    }
+}
+
+void CaptureRing::write(Print& out, uint32_t epoch) const {
+    CaptureHeader header;
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.recordSize = sizeof(CaptureRecord);
+    header.count = count;
+    header.overwritten = overwritten;
+    header.start = start;
+    header.time = millis();
+    header.epoch = epoch;
+    out.write((const uint8_t*) &header, sizeof(header));
+
+    // The oldest record is at the head if the ring is full, otherwise at the start
+    size_t tail = (head + CAPTURE_RING_SIZE - count) % CAPTURE_RING_SIZE;
+    for (size_t ix = 0; ix < count; ix++) {
+        out.write((const uint8_t*) &records[(tail + ix) % CAPTURE_RING_SIZE], sizeof(CaptureRecord));
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __CaptureRing__
+#define __CaptureRing__
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#define CAPTURE_RING_SIZE   256     // Number of records kept while capturing
+#define CAPTURE_MAGIC "KCAP"        // Magic of a capture blob
+#define CAPTURE_VERSION       1     // Format version of a capture blob
+
+/**
+ * A single detector interrupt, as it was seen by the driver.
+ */
+struct CaptureRecord {
+    uint32_t time;              // millis() when the interrupt occurred
+    uint16_t delay;             // µs from the interrupt until its registers were read
+    uint8_t detector;           // index of the detector
+    uint8_t lost;               // interrupts lost by queue overflow before this one
+    uint8_t registers[8];       // registers 0x00 to 0x07 after the interrupt
+};
+
+static_assert(sizeof(CaptureRecord) == 16, "CaptureRecord must not be padded");
+
+/**
+ * Header of a capture blob. It is followed by the records, oldest first. All values
+ * are little endian, as the structures are written as they are kept in RAM.
+ */
+struct CaptureHeader {
+    char magic[4];              // CAPTURE_MAGIC
+    uint8_t version;            // CAPTURE_VERSION
+    uint8_t recordSize;         // sizeof(CaptureRecord)
+    uint16_t count;             // number of records that follow
+    uint32_t overwritten;       // records that were overwritten by newer ones
+    uint32_t start;             // millis() when capturing was started
+    uint32_t time;              // millis() when the blob was written
+    uint32_t epoch;             // seconds since epoch when the blob was written, or 0
+};
+
+static_assert(sizeof(CaptureHeader) == 24, "CaptureHeader must not be padded");
+
+/**
+ * Records every detector interrupt with its raw register contents, for analyzing
+ * phantom or missed lightnings offline, and for replaying them in the simulator.
+ *
+ * The ring only takes memory while capturing. If it is full, the oldest record is
+ * overwritten.
+ */
+class CaptureRing {
+public:
+    CaptureRing();
+
+    ~CaptureRing();
+
+    /**
+     * Start capturing. Previous records are removed.
+     *
+     * @return false if there is not enough memory
+     */
+    bool begin();
+
+    /**
+     * Stop capturing, and free the memory.
+     */
+    void end();
+
+    /**
+     * Return true if interrupts are currently captured.
+     */
+    bool isActive() const                   { return records != NULL; }
+
+    /**
+     * Add a record. The oldest record is overwritten if the ring is full. Does nothing
+     * if the ring is not active.
+     */
+    void add(const CaptureRecord& record);
+
+    /**
+     * Return the number of records in the ring.
+     */
+    size_t size() const                     { return count; }
+
+    /**
+     * Return the number of records that were overwritten since begin().
+     */
+    unsigned long getOverwritten() const    { return overwritten; }
+
+    /**
+     * Write the ring as a capture blob.
+     *
+     * @param out       Target to write to
+     * @param epoch     Current time in seconds since epoch, or 0 if unknown
+     */
+    void write(Print& out, uint32_t epoch) const;
+
+private:
+    CaptureRecord* records;
+    unsigned long start;
+    size_t head;
+    size_t count;
+    unsigned long overwritten;
+};
+
+#endif
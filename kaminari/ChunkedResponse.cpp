@@ -0,0 +1,72 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+
+#include "ChunkedResponse.h"
+
+ChunkedResponse::ChunkedResponse(HttpServer& server) : server(server) {
+    this->length = 0;
+}
+
+void ChunkedResponse::begin(int status, const char* contentType) {
+    length = 0;
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(status, contentType, "");
+}
+
+void ChunkedResponse::end() {
+    sendChunk();
+    server.sendContent("");     // an empty chunk terminates the response
+}
+
+void ChunkedResponse::flush() {
+    sendChunk();
+}
+
+size_t ChunkedResponse::write(uint8_t c) {
+    if (length >= sizeof(buffer)) {
+        sendChunk();
+    }
+    buffer[length++] = c;
+    return 1;
+}
+
+size_t ChunkedResponse::write(const uint8_t* data, size_t size) {
+    size_t remaining = size;
+    while (remaining > 0) {
+        if (length >= sizeof(buffer)) {
+            sendChunk();
+        }
+        size_t part = sizeof(buffer) - length;
+        if (part > remaining) {
+            part = remaining;
+        }
+        memcpy(buffer + length, data, part);
+        length += part;
+        data += part;
+        remaining -= part;
+    }
+    return size;
+}
+
+void ChunkedResponse::sendChunk() {
+    if (length > 0) {
+        server.sendContent(buffer, length);
+        length = 0;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __ChunkedResponse__
+#define __ChunkedResponse__
+
+#include "HttpServer.h"
+
+#define CHUNKED_RESPONSE_BUFFER_SIZE 512
+
+/**
+ * Streams a response body to the client, using chunked transfer encoding.
+ *
+ * The body is collected in a fixed-size buffer, and a chunk is passed to the server
+ * whenever the buffer is full. The server queues the chunks and sends them without
+ * blocking, so the size of the response is only limited by its output queue.
+ */
+class ChunkedResponse : public Print {
+public:
+
+    /**
+     * Create a new chunked response.
+     *
+     * @param server    Web server that is currently handling the request
+     */
+    ChunkedResponse(HttpServer& server);
+
+    /**
+     * Send the response header. Must be invoked before the body is written.
+     *
+     * @param status        HTTP status code
+     * @param contentType   Content type of the body
+     */
+    void begin(int status, const char* contentType);
+
+    /**
+     * Send the rest of the body, and terminate the response.
+     */
+    void end();
+
+    /**
+     * Send the buffered part of the body, without terminating the response. This is
+     * used by the steps of a response that is streamed by HttpServer::stream().
+     */
+    void flush() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t* data, size_t size) override;
+
+    using Print::write;
+
+private:
+    HttpServer& server;
+    char buffer[CHUNKED_RESPONSE_BUFFER_SIZE];
+    size_t length;
+
+    /**
+     * Send the buffer content as a chunk, if not empty.
+     */
+    void sendChunk();
+};
+
+#endif
@@ -17,25 +17,88 @@
 
 #include <Arduino.h>
 #include <EEPROM_Rotate.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "Config.h"
 
-#define CHECKSUM_ADDRESS 0xF00
-#define CHECKSUM_VALUE 0x8F
+#define CONFIG_ADDRESS      0x000     // Address of the config record
+#define CONFIG_MAGIC        0x4B43    // "KC"
+#define CONFIG_VERSION      3         // Current schema version of Config
+#define COMMIT_DELAY        3000      // Write after this time without further changes
+#define COMMIT_MAX_DELAY    30000     // Write after this time even if there are changes
+
+#define LEGACY_CHECKSUM_ADDRESS 0xF00 // Legacy config marker byte
+#define LEGACY_CHECKSUM_V1  0x8F      // Legacy marker of schema version 1
+#define LEGACY_CHECKSUM_V2  0x90      // Legacy marker of schema version 2
+
+/**
+ * Header of the config record. It is followed by the Config structure.
+ */
+struct ConfigHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t length;
+    uint32_t crc;
+};
+
+static_assert(sizeof(Config) <= 255, "Config is too large for the record header");
+
+static const uint32_t CRC_TABLE[16] PROGMEM = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/**
+ * Update a CRC-32, using a 16 entry table to save flash memory.
+ */
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length) {
+    while (length--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ pgm_read_dword(&CRC_TABLE[crc & 0x0F]);
+        crc = (crc >> 4) ^ pgm_read_dword(&CRC_TABLE[crc & 0x0F]);
+    }
+    return crc;
+}
+
+ConfigManager::ConfigManager() {
+    this->pending = false;
+    this->firstChange = 0;
+    this->lastChange = 0;
+    this->writes = 0;
+}
 
 void ConfigManager::begin() {
     EEPROMr.offset(0xFF0);
     EEPROMr.begin(4096);
-    EEPROMr.get(0, config);
 
-    int checksum = EEPROMr.read(CHECKSUM_ADDRESS);
-    if (checksum != CHECKSUM_VALUE) {
-        EEPROMr.write(CHECKSUM_ADDRESS, CHECKSUM_VALUE);
-        init();
+    defaults();
+    if (load()) {
+        memcpy(&persisted, &config, sizeof(Config));
+        return;
+    }
+
+    if (loadLegacy()) {
+        Serial.println("Configuration was migrated.");
+        // Remove the legacy marker, so the legacy config is never read again
+        EEPROMr.write(LEGACY_CHECKSUM_ADDRESS, 0xFF);
+    } else {
+        Serial.println("Configuration was initialized.");
     }
+    // make sure the config record is written
+    memset(&persisted, 0xFF, sizeof(Config));
+    commit();
+    flush();
 }
 
 void ConfigManager::init() {
+    defaults();
+    Serial.println("Configuration was initialized.");
+    commit();
+}
+
+void ConfigManager::defaults() {
+    memset(&config, 0, sizeof(Config));
     config.ledEnabled = true;
     config.blueBrightness = 48;
     config.disturberBrightness = 100;
@@ -43,16 +106,132 @@ void ConfigManager::init() {
     config.minimumNumberOfLightning = 1;
     config.spikeRejection = 2;
     config.outdoorMode = false;
+    config.adaptiveNoiseFloor = true;
+    config.noiseRecoveryTime = 5;
+    config.disturberLimit = 0;
+    config.mqttMessagePack = false;
+}
 
-    Serial.println("Configuration was initialized.");
-    commit();
+void ConfigManager::migrate(uint8_t version) {
+    switch (version) {
+        case 1:
+            // Version 2 added the adaptive noise floor. Devices that were set up before
+            // keep the previous noise floor behavior.
+            config.adaptiveNoiseFloor = false;
+            // fall through
+        case 2:
+            // Version 3 added the MQTT payload format, the default is fine
+            // fall through
+        case CONFIG_VERSION:
+            break;
+    }
+}
+
+bool ConfigManager::load() {
+    ConfigHeader header;
+    EEPROMr.get(CONFIG_ADDRESS, header);
+    if (header.magic != CONFIG_MAGIC
+            || header.version < 1 || header.version > CONFIG_VERSION
+            || header.length > sizeof(Config)) {
+        return false;
+    }
+
+    const uint8_t* data = EEPROMr.getDataPtr() + CONFIG_ADDRESS + sizeof(ConfigHeader);
+    if (crc32(crc(header.version, header.length), data, header.length) != header.crc) {
+        Serial.println("Configuration is corrupted.");
+        return false;
+    }
+
+    read(CONFIG_ADDRESS + sizeof(ConfigHeader), header.length);
+    migrate(header.version);
+    return true;
+}
+
+bool ConfigManager::loadLegacy() {
+    // Legacy configs were stored at address 0, marked by a single checksum byte
+    switch (EEPROMr.read(LEGACY_CHECKSUM_ADDRESS)) {
+        case LEGACY_CHECKSUM_V1:
+            read(0, offsetof(Config, adaptiveNoiseFloor));
+            migrate(1);
+            return true;
+
+        case LEGACY_CHECKSUM_V2:
+            read(0, offsetof(Config, disturberLimit) + sizeof(config.disturberLimit));
+            migrate(2);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void ConfigManager::read(int address, size_t length) {
+    uint8_t* target = (uint8_t*) &config;
+    for (size_t ix = 0; ix < length; ix++) {
+        target[ix] = EEPROMr.read(address + ix);
+    }
+}
+
+uint32_t ConfigManager::crc(uint8_t version, size_t length) const {
+    uint8_t prefix[] = { version, (uint8_t) length };
+    return crc32(0xFFFFFFFF, prefix, sizeof(prefix));
 }
 
 void ConfigManager::commit() {
-    EEPROMr.put(0, config);
+    if (memcmp(&config, &persisted, sizeof(Config)) == 0) {
+        // nothing was changed, or changes were reverted
+        pending = false;
+        return;
+    }
+
+    unsigned long now = millis();
+    if (!pending) {
+        pending = true;
+        firstChange = now;
+    }
+    lastChange = now;
+}
+
+void ConfigManager::update() {
+    if (pending) {
+        unsigned long now = millis();
+        if (now - lastChange >= COMMIT_DELAY || now - firstChange >= COMMIT_MAX_DELAY) {
+            flush();
+        }
+    }
+}
+
+bool ConfigManager::flush() {
+    if (!pending) {
+        return true;
+    }
+
+    ConfigHeader header;
+    header.magic = CONFIG_MAGIC;
+    header.version = CONFIG_VERSION;
+    header.length = sizeof(Config);
+    header.crc = crc32(crc(header.version, header.length), (const uint8_t*) &config, sizeof(Config));
+    EEPROMr.put(CONFIG_ADDRESS, header);
+    EEPROMr.put(CONFIG_ADDRESS + sizeof(ConfigHeader), config);
+
+    writes++;
     if (EEPROMr.commit()) {
+        memcpy(&persisted, &config, sizeof(Config));
+        pending = false;
         Serial.println("Configuration was persisted.");
+        return true;
     } else {
+        // keep the changes pending, and try again later
+        firstChange = lastChange = millis();
         Serial.println("Failed to persist configuration.");
+        return false;
     }
 }
+
+bool ConfigManager::isPending() const {
+    return pending;
+}
+
+unsigned long ConfigManager::getWrites() const {
+    return writes;
+}
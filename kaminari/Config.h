@@ -31,13 +31,29 @@ struct Config {
     bool ledEnabled;
     bool outdoorMode;
     int disturberBrightness;
+    bool adaptiveNoiseFloor;
+    int noiseRecoveryTime;
+    int disturberLimit;
+    bool mqttMessagePack;
 };
 
 /**
  * Manager for the configuration structure.
+ *
+ * The configuration is stored in the EEPROM with a header containing a schema version,
+ * the length of the stored structure, and a CRC-32. New fields must only be appended
+ * to the Config structure, and CONFIG_VERSION must be increased then. When an older
+ * configuration is read, the missing fields keep their default values, and migrate()
+ * can adapt existing fields to the new schema.
+ *
+ * Changes are not written immediately. commit() only schedules a write if the
+ * configuration was actually changed, and update() writes it to the EEPROM as soon as
+ * there were no further changes for a few seconds. This way, a burst of changes only
+ * causes a single flash write.
  */
 class ConfigManager {
 public:
+    ConfigManager();
 
     /**
      * Set up the config, reading the config from EEPROM.
@@ -50,10 +66,34 @@ public:
     void init();
 
     /**
-     * Commit changes to the config in the EEPROM.
+     * Commit changes to the config. The changes are written to the EEPROM by the next
+     * update() calls. Nothing is written if the config was not changed.
      */
     void commit();
 
+    /**
+     * Write committed changes to the EEPROM, when it is time to do so. Must be invoked
+     * in the main loop.
+     */
+    void update();
+
+    /**
+     * Immediately write committed changes to the EEPROM.
+     *
+     * @return true if the config is persisted
+     */
+    bool flush();
+
+    /**
+     * Check if there are committed changes that have not been written to the EEPROM yet.
+     */
+    bool isPending() const;
+
+    /**
+     * Return the number of EEPROM writes since start.
+     */
+    unsigned long getWrites() const;
+
     /**
      * The configuration itself.
      */
@@ -61,6 +101,18 @@ public:
 
 private:
     EEPROM_Rotate EEPROMr;
+    Config persisted;
+    bool pending;
+    unsigned long firstChange;
+    unsigned long lastChange;
+    unsigned long writes;
+
+    void defaults();
+    bool load();
+    bool loadLegacy();
+    void read(int address, size_t length);
+    void migrate(uint8_t version);
+    uint32_t crc(uint8_t version, size_t length) const;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "EventLog.h"
+
+#define QUERY_BATCH_SIZE 32     // Records that are read from flash at once
+
+EventLog::EventLog() {
+    this->directory = NULL;
+    this->segmentCount = 0;
+    this->buffered = 0;
+    this->bufferedSince = 0;
+    this->dropped = 0;
+}
+
+void EventLog::begin(const char* directory) {
+    this->directory = directory;
+    this->segmentCount = 0;
+    LittleFS.mkdir(directory);
+
+    // Build the index of the existing segments, sorted by their number
+    Dir dir = LittleFS.openDir(directory);
+    while (dir.next()) {
+        size_t count = dir.fileSize() / sizeof(EventLogRecord);
+        unsigned long number = strtoul(dir.fileName().c_str(), NULL, 10);
+        if (dir.fileSize() % sizeof(EventLogRecord) != 0) {
+            // The last record was only written partially, e.g. because the flash was full
+            File file = dir.openFile("r+");
+            if (!file || !file.truncate(count * sizeof(EventLogRecord))) {
+                Serial.println("Could not repair event log segment");
+                file.close();
+                continue;
+            }
+            file.close();
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        Segment segment;
+        segment.number = number;
+        segment.count = count;
+        File file = dir.openFile("r");
+        EventLogRecord record;
+        file.read((uint8_t*) &record, sizeof(record));
+        segment.first = record.time;
+        file.seek((count - 1) * sizeof(record), SeekSet);
+        file.read((uint8_t*) &record, sizeof(record));
+        segment.last = record.time;
+        file.close();
+
+        if (segmentCount == EVENT_LOG_SEGMENTS) {
+            // Too many segments, e.g. because EVENT_LOG_SEGMENTS was reduced
+            if (number < segments[0].number) {
+                char path[32];
+                segmentPath(path, sizeof(path), number);
+                LittleFS.remove(path);
+                continue;
+            }
+            char path[32];
+            segmentPath(path, sizeof(path), segments[0].number);
+            LittleFS.remove(path);
+            memmove(&segments[0], &segments[1], sizeof(Segment) * (segmentCount - 1));
+            segmentCount--;
+        }
+
+        int ix = segmentCount;
+        while (ix > 0 && segments[ix - 1].number > number) {
+            segments[ix] = segments[ix - 1];
+            ix--;
+        }
+        segments[ix] = segment;
+        segmentCount++;
+    }
+}
+
+void EventLog::append(uint32_t time, unsigned long energy, unsigned int distance) {
+    if (buffered == EVENT_LOG_BUFFER_SIZE) {
+        // The buffer could not be written, so the oldest record makes room
+        memmove(&buffer[0], &buffer[1], sizeof(EventLogRecord) * (buffered - 1));
+        buffered--;
+        dropped++;
+    }
+    if (buffered == 0) {
+        bufferedSince = millis();
+    }
+    EventLogRecord& record = buffer[buffered++];
+    record.time = time;
+    record.energy = energy;
+    record.distance = distance;
+    if (buffered == EVENT_LOG_BUFFER_SIZE) {
+        flush();
+    }
+}
+
+void EventLog::update() {
+    if (buffered > 0 && millis() - bufferedSince > EVENT_LOG_FLUSH_DELAY) {
+        flush();
+    }
+}
+
+void EventLog::flush() {
+    if (directory == NULL || buffered == 0) {
+        return;
+    }
+
+    size_t written = 0;
+    while (written < buffered) {
+        if (segmentCount == 0 || segments[segmentCount - 1].count >= EVENT_LOG_SEGMENT_RECORDS) {
+            rotate();
+        }
+
+        Segment& segment = segments[segmentCount - 1];
+        size_t part = EVENT_LOG_SEGMENT_RECORDS - segment.count;
+        if (part > buffered - written) {
+            part = buffered - written;
+        }
+
+        char path[32];
+        segmentPath(path, sizeof(path), segment.number);
+        File file = LittleFS.open(path, "a");
+        if (!file) {
+            Serial.println("Could not write to event log");
+            break;
+        }
+        size_t bytes = file.write((const uint8_t*) &buffer[written], part * sizeof(EventLogRecord));
+        size_t complete = bytes / sizeof(EventLogRecord);
+        if (bytes % sizeof(EventLogRecord) != 0) {
+            // Remove the partial record, so the segment stays aligned to the records
+            file.truncate((segment.count + complete) * sizeof(EventLogRecord));
+        }
+        file.close();
+
+        if (complete > 0) {
+            if (segment.count == 0) {
+                segment.first = buffer[written].time;
+            }
+            segment.last = buffer[written + complete - 1].time;
+            segment.count += complete;
+            written += complete;
+        }
+        if (complete < part) {
+            Serial.println("Could not write to event log, file system is full");
+            break;
+        }
+    }
+
+    // Records that could not be written are kept, and written with the next flush
+    buffered -= written;
+    memmove(&buffer[0], &buffer[written], sizeof(EventLogRecord) * buffered);
+    bufferedSince = millis();
+}
+
+bool EventLog::query(uint32_t from, uint32_t to, size_t limit, EventLogVisitor visitor) {
+    EventLogRecord records[QUERY_BATCH_SIZE];
+    size_t visited = 0;
+
+    for (int ix = 0; ix < segmentCount; ix++) {
+        const Segment& segment = segments[ix];
+        if (segment.last < from || segment.first > to) {
+            continue;
+        }
+
+        char path[32];
+        segmentPath(path, sizeof(path), segment.number);
+        File file = LittleFS.open(path, "r");
+        if (!file) {
+            continue;
+        }
+
+        // Binary search for the first record within the time range
+        size_t low = 0;
+        size_t high = segment.count;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            file.seek(mid * sizeof(EventLogRecord), SeekSet);
+            file.read((uint8_t*) &records[0], sizeof(EventLogRecord));
+            if (records[0].time < from) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        // Stream the records in batches, until the end of the time range is reached
+        file.seek(low * sizeof(EventLogRecord), SeekSet);
+        size_t pos = low;
+        while (pos < segment.count) {
+            size_t batch = segment.count - pos;
+            if (batch > QUERY_BATCH_SIZE) {
+                batch = QUERY_BATCH_SIZE;
+            }
+            size_t read = file.read((uint8_t*) records, batch * sizeof(EventLogRecord))
+                    / sizeof(EventLogRecord);
+            if (read == 0) {
+                break;
+            }
+            for (size_t rx = 0; rx < read; rx++) {
+                if (records[rx].time > to) {
+                    file.close();
+                    return false;
+                }
+                if (visited == limit) {
+                    file.close();
+                    return true;
+                }
+                visitor(records[rx]);
+                visited++;
+            }
+            pos += read;
+        }
+        file.close();
+    }
+
+    // Records that are not written yet
+    for (size_t ix = 0; ix < buffered; ix++) {
+        if (buffer[ix].time < from) {
+            continue;
+        }
+        if (buffer[ix].time > to) {
+            break;
+        }
+        if (visited == limit) {
+            return true;
+        }
+        visitor(buffer[ix]);
+        visited++;
+    }
+
+    return false;
+}
+
+unsigned long EventLog::size() const {
+    unsigned long total = buffered;
+    for (int ix = 0; ix < segmentCount; ix++) {
+        total += segments[ix].count;
+    }
+    return total;
+}
+
+void EventLog::segmentPath(char* target, size_t size, unsigned long number) const {
+    snprintf(target, size, "%s/%lu", directory, number);
+}
+
+void EventLog::rotate() {
+    unsigned long number = segmentCount > 0 ? segments[segmentCount - 1].number + 1 : 0;
+
+    if (segmentCount == EVENT_LOG_SEGMENTS) {
+        char path[32];
+        segmentPath(path, sizeof(path), segments[0].number);
+        LittleFS.remove(path);
+        memmove(&segments[0], &segments[1], sizeof(Segment) * (segmentCount - 1));
+        segmentCount--;
+    }
+
+    Segment& segment = segments[segmentCount++];
+    segment.number = number;
+    segment.first = 0;
+    segment.last = 0;
+    segment.count = 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __EventLog__
+#define __EventLog__
+
+#include <functional>
+#include <stdint.h>
+
+#define EVENT_LOG_SEGMENTS          8   // Maximum number of segment files
+#define EVENT_LOG_SEGMENT_RECORDS 4096  // Maximum number of records per segment file
+#define EVENT_LOG_BUFFER_SIZE      16   // Records that are buffered before writing
+#define EVENT_LOG_FLUSH_DELAY   60000   // Maximum time a record is kept in the buffer
+
+/**
+ * A single lightning in the event log.
+ */
+struct EventLogRecord {
+    uint32_t time;              // seconds since epoch
+    uint32_t energy : 24;
+    uint32_t distance : 8;
+};
+
+typedef std::function<void(const EventLogRecord& record)> EventLogVisitor;
+
+/**
+ * An append-only log of lightnings on LittleFS.
+ *
+ * The log is split into segment files of a fixed maximum size. If the maximum number
+ * of segments is reached, the oldest segment is removed. This way the flash usage is
+ * bounded. New records are buffered, and written in batches to reduce flash wear. If
+ * the flash is full, the records stay in the buffer, and the oldest of them are dropped
+ * when it overflows.
+ *
+ * The time range of every segment is kept in RAM, so a time range query only needs to
+ * read the affected segments. Records are expected to be appended in chronological
+ * order, so the start of a time range can be found by a binary search.
+ */
+class EventLog {
+public:
+
+    EventLog();
+
+    /**
+     * Open the event log and build the index of existing segments. LittleFS must be
+     * mounted.
+     *
+     * @param directory     Directory of the segment files
+     */
+    void begin(const char* directory);
+
+    /**
+     * Append a lightning to the log.
+     *
+     * @param time          Time of the lightning, in seconds since epoch
+     * @param energy        Lightning energy
+     * @param distance      Estimated distance
+     */
+    void append(uint32_t time, unsigned long energy, unsigned int distance);
+
+    /**
+     * Write buffered records if they were kept in the buffer for too long. This method
+     * should be invoked frequently, e.g. in loop().
+     */
+    void update();
+
+    /**
+     * Write all buffered records to the file system. Records that could not be written,
+     * e.g. because the file system is full, are kept in the buffer.
+     */
+    void flush();
+
+    /**
+     * Visit all records within the given time range, in chronological order. The
+     * records are streamed from the file system, so only a few of them are kept in
+     * memory at the same time.
+     *
+     * @param from      Start of the time range, inclusive
+     * @param to        End of the time range, inclusive
+     * @param limit     Maximum number of records to visit
+     * @param visitor   Visitor that is invoked for every record
+     * @return true if there are more records in the time range than the limit
+     */
+    bool query(uint32_t from, uint32_t to, size_t limit, EventLogVisitor visitor);
+
+    /**
+     * Return the total number of records in the log.
+     */
+    unsigned long size() const;
+
+    /**
+     * Return the number of records that were dropped because the buffer could not be
+     * written.
+     */
+    unsigned long getDropped() const {
+        return dropped;
+    }
+
+private:
+    struct Segment {
+        unsigned long number;
+        uint32_t first;
+        uint32_t last;
+        size_t count;
+    };
+
+    const char* directory;
+    Segment segments[EVENT_LOG_SEGMENTS];
+    int segmentCount;
+    EventLogRecord buffer[EVENT_LOG_BUFFER_SIZE];
+    size_t buffered;
+    unsigned long bufferedSince;
+    unsigned long dropped;
+
+    /**
+     * Write the file name of a segment to the given target.
+     */
+    void segmentPath(char* target, size_t size, unsigned long number) const;
+
+    /**
+     * Start a new segment, removing the oldest segment if necessary.
+     */
+    void rotate();
+};
+
+#endif
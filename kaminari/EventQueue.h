@@ -0,0 +1,112 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __EventQueue__
+#define __EventQueue__
+
+#include <stddef.h>
+
+/**
+ * A lock-free single producer, single consumer queue.
+ *
+ * It is meant to pass events from an interrupt service routine (the producer) to the
+ * main loop (the consumer). push() must only be invoked by the producer, while peek(),
+ * pop() and clear() must only be invoked by the consumer. If the queue is full, new
+ * events are dropped and counted.
+ *
+ * All methods are inlined, so they end up in IRAM if they are used by an ISR.
+ *
+ * @param T     Type of the events
+ * @param N     Capacity of the queue, must be a power of 2
+ */
+template<typename T, size_t N>
+class EventQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+    EventQueue() : head(0), tail(0), dropped(0) {}
+
+    /**
+     * Add an event to the queue. Producer side only.
+     *
+     * @return true if the event was added, false if the queue was full
+     */
+    inline __attribute__((always_inline)) bool push(const T& event) {
+        size_t h = head;
+        if (h - tail >= N) {
+            dropped++;
+            return false;
+        }
+        entries[h & (N - 1)] = event;
+        __asm__ __volatile__ ("" ::: "memory");
+        head = h + 1;
+        return true;
+    }
+
+    /**
+     * Read the oldest event without removing it. Consumer side only.
+     *
+     * @return true if there was an event, false if the queue is empty
+     */
+    inline bool peek(T& event) const {
+        size_t t = tail;
+        if (head == t) {
+            return false;
+        }
+        __asm__ __volatile__ ("" ::: "memory");
+        event = entries[t & (N - 1)];
+        return true;
+    }
+
+    /**
+     * Remove the oldest event. Consumer side only.
+     */
+    inline void pop() {
+        if (head != tail) {
+            tail = tail + 1;
+        }
+    }
+
+    /**
+     * Remove all events. Consumer side only.
+     */
+    inline void clear() {
+        tail = head;
+    }
+
+    /**
+     * Return the number of queued events.
+     */
+    inline size_t size() const {
+        return head - tail;
+    }
+
+    /**
+     * Return the number of events that were dropped because the queue was full.
+     */
+    inline unsigned long getDropped() const {
+        return dropped;
+    }
+
+private:
+    T entries[N];
+    volatile size_t head;
+    volatile size_t tail;
+    volatile unsigned long dropped;
+};
+
+#endif
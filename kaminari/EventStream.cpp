@@ -0,0 +1,131 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include "EventStream.h"
+
+EventStream::EventStream() {
+    this->dropped = 0;
+    for (int ix = 0; ix < EVENT_STREAM_SUBSCRIBERS; ix++) {
+        subscribers[ix].active = false;
+        subscribers[ix].length = 0;
+    }
+}
+
+bool EventStream::subscribe(WiFiClient& client) {
+    for (int ix = 0; ix < EVENT_STREAM_SUBSCRIBERS; ix++) {
+        Subscriber& subscriber = subscribers[ix];
+        if (!subscriber.active) {
+            subscriber.client = client;
+            subscriber.client.setNoDelay(true);
+            subscriber.active = true;
+            subscriber.length = 0;
+            subscriber.lastSent = millis();
+            append(subscriber,
+                    "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/event-stream\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "Connection: keep-alive\r\n"
+                    "Access-Control-Allow-Origin: *\r\n"
+                    "\r\n");
+            return true;
+        }
+    }
+    return false;
+}
+
+void EventStream::publish(const char* event, const char* data) {
+    for (int ix = 0; ix < EVENT_STREAM_SUBSCRIBERS; ix++) {
+        Subscriber& subscriber = subscribers[ix];
+        if (subscriber.active) {
+            if (!(append(subscriber, "event: ")
+                    && append(subscriber, event)
+                    && append(subscriber, "\ndata: ")
+                    && append(subscriber, data)
+                    && append(subscriber, "\n\n"))) {
+                // Client is too slow, drop it instead of blocking the loop
+                dropped++;
+                disconnect(subscriber);
+            }
+        }
+    }
+}
+
+void EventStream::update() {
+    unsigned long now = millis();
+    for (int ix = 0; ix < EVENT_STREAM_SUBSCRIBERS; ix++) {
+        Subscriber& subscriber = subscribers[ix];
+        if (!subscriber.active) {
+            continue;
+        }
+
+        if (!subscriber.client.connected()) {
+            disconnect(subscriber);
+            continue;
+        }
+
+        if (subscriber.length == 0 && now - subscriber.lastSent > EVENT_STREAM_KEEPALIVE) {
+            append(subscriber, ":\n\n");
+        }
+
+        if (subscriber.length > 0) {
+            size_t size = subscriber.client.availableForWrite();
+            if (size > subscriber.length) {
+                size = subscriber.length;
+            }
+            if (size > 0) {
+                size = subscriber.client.write((const uint8_t*) subscriber.buffer, size);
+                subscriber.length -= size;
+                memmove(subscriber.buffer, subscriber.buffer + size, subscriber.length);
+                subscriber.lastSent = now;
+            }
+        }
+    }
+}
+
+int EventStream::getSubscribers() const {
+    int count = 0;
+    for (int ix = 0; ix < EVENT_STREAM_SUBSCRIBERS; ix++) {
+        if (subscribers[ix].active) {
+            count++;
+        }
+    }
+    return count;
+}
+
+unsigned long EventStream::getDropped() const {
+    return dropped;
+}
+
+bool EventStream::append(Subscriber& subscriber, const char* str) {
+    size_t size = strlen(str);
+    if (subscriber.length + size > sizeof(subscriber.buffer)) {
+        return false;
+    }
+    memcpy(subscriber.buffer + subscriber.length, str, size);
+    subscriber.length += size;
+    return true;
+}
+
+void EventStream::disconnect(Subscriber& subscriber) {
+    subscriber.client.stop();
+    subscriber.client = WiFiClient();
+    subscriber.active = false;
+    subscriber.length = 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __EventStream__
+#define __EventStream__
+
+#include <WiFiClient.h>
+
+#define EVENT_STREAM_SUBSCRIBERS 3      // Maximum number of concurrent subscribers
+#define EVENT_STREAM_BUFFER_SIZE 384    // Pending bytes per subscriber
+#define EVENT_STREAM_KEEPALIVE 15000    // Send a keep-alive comment after this idle time
+
+/**
+ * Pushes events to subscribed clients, as Server-Sent Events (text/event-stream).
+ *
+ * Every subscriber has a fixed-size buffer of pending bytes. The buffers are sent to
+ * the clients by update(), but only as much as the client is able to accept without
+ * blocking. If a subscriber is too slow and its buffer overflows, it is disconnected.
+ */
+class EventStream {
+public:
+
+    EventStream();
+
+    /**
+     * Subscribe a client to the event stream. The response header is sent to the
+     * client. If there are already too many subscribers, the client is rejected.
+     *
+     * @param client    Client that requested the event stream
+     * @return true if the client was subscribed, false if it was rejected
+     */
+    bool subscribe(WiFiClient& client);
+
+    /**
+     * Publish an event to all subscribers.
+     *
+     * @param event     Event name
+     * @param data      Event data, must not contain line breaks
+     */
+    void publish(const char* event, const char* data);
+
+    /**
+     * Send pending data to the subscribers, and remove disconnected subscribers. This
+     * method should be invoked frequently, e.g. in loop().
+     */
+    void update();
+
+    /**
+     * Return the number of current subscribers.
+     */
+    int getSubscribers() const;
+
+    /**
+     * Return the number of subscribers that were dropped because they were too slow.
+     */
+    unsigned long getDropped() const;
+
+private:
+    struct Subscriber {
+        WiFiClient client;
+        bool active;
+        size_t length;
+        unsigned long lastSent;
+        char buffer[EVENT_STREAM_BUFFER_SIZE];
+    };
+
+    Subscriber subscribers[EVENT_STREAM_SUBSCRIBERS];
+    unsigned long dropped;
+
+    /**
+     * Add a string to the pending bytes of a subscriber.
+     *
+     * @return true if the string was added, false if the buffer overflowed
+     */
+    bool append(Subscriber& subscriber, const char* str);
+
+    /**
+     * Disconnect a subscriber and free its slot.
+     */
+    void disconnect(Subscriber& subscriber);
+};
+
+#endif
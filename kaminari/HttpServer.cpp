@@ -0,0 +1,704 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+#include <WiFiServer.h>
+#include <WiFiClient.h>
+
+#include "HttpServer.h"
+
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+static const char* reasonPhrase(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 414: return "URI Too Long";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default:  return "Unknown";
+    }
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static String urlDecode(const char* str, size_t length, bool query) {
+    String result;
+    result.reserve(length);
+    for (size_t ix = 0; ix < length; ix++) {
+        char c = str[ix];
+        if (c == '+' && query) {
+            c = ' ';
+        } else if (c == '%' && ix + 2 < length) {
+            int high = hexValue(str[ix + 1]);
+            int low = hexValue(str[ix + 2]);
+            if (high >= 0 && low >= 0) {
+                c = (char) (high << 4 | low);
+                ix += 2;
+            }
+        }
+        result += c;
+    }
+    return result;
+}
+
+HttpServer::HttpServer(int port) : server(port) {
+    this->routeCount = 0;
+    this->headerKeyCount = 0;
+    this->next = 0;
+    this->deferred = 0;
+    this->timeouts = 0;
+    this->overflows = 0;
+    this->current = NULL;
+    this->argCount = 0;
+    this->contentLength = CONTENT_LENGTH_NOT_SET;
+    this->responded = false;
+    this->taken = false;
+    for (int ix = 0; ix < HTTP_MAX_CONNECTIONS; ix++) {
+        connections[ix].state = CONNECTION_FREE;
+        connections[ix].first = NULL;
+        connections[ix].last = NULL;
+        connections[ix].pending = 0;
+    }
+}
+
+void HttpServer::begin() {
+    server.begin();
+    server.setNoDelay(true);
+}
+
+void HttpServer::handleClient() {
+    unsigned long now = millis();
+    accept(now);
+
+    // Connections are visited round robin, so every request gets its turn
+    bool dispatched = false;
+    int start = next;
+    for (int ix = 0; ix < HTTP_MAX_CONNECTIONS; ix++) {
+        int index = (start + ix) % HTTP_MAX_CONNECTIONS;
+        Connection& connection = connections[index];
+
+        if (connection.state == CONNECTION_RECEIVING || connection.state == CONNECTION_DISCARDING) {
+            receive(connection, now);
+        }
+
+        // Only one handler per invocation, so the main loop is never held up for long
+        if (connection.state == CONNECTION_READY && !dispatched) {
+            if (canDispatch()) {
+                dispatch(connection);
+                dispatched = true;
+                next = (index + 1) % HTTP_MAX_CONNECTIONS;
+            } else if (!connection.waiting) {
+                connection.waiting = true;
+                deferred++;
+            }
+        }
+
+        if (connection.state == CONNECTION_SENDING && connection.content && !dispatched
+                && connection.pending < HTTP_BLOCK_SIZE) {
+            produce(connection);
+            dispatched = true;
+            next = (index + 1) % HTTP_MAX_CONNECTIONS;
+        }
+
+        if (connection.state == CONNECTION_SENDING) {
+            transmit(connection, now);
+        }
+    }
+}
+
+void HttpServer::on(const char* uri, THandlerFunction handler) {
+    if (routeCount < HTTP_MAX_ROUTES) {
+        routes[routeCount].uri = uri;
+        routes[routeCount].handler = handler;
+        routeCount++;
+    }
+}
+
+void HttpServer::onNotFound(THandlerFunction handler) {
+    notFoundHandler = handler;
+}
+
+void HttpServer::collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+    headerKeyCount = 0;
+    for (size_t ix = 0; ix < headerKeysCount && ix < HTTP_MAX_HEADERS; ix++) {
+        this->headerKeys[headerKeyCount++] = headerKeys[ix];
+    }
+}
+
+String HttpServer::uri() const {
+    return currentUri;
+}
+
+String HttpServer::arg(const char* name) const {
+    for (int ix = 0; ix < argCount; ix++) {
+        if (argNames[ix] == name) {
+            return argValues[ix];
+        }
+    }
+    return String();
+}
+
+bool HttpServer::hasArg(const char* name) const {
+    for (int ix = 0; ix < argCount; ix++) {
+        if (argNames[ix] == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+String HttpServer::header(const char* name) const {
+    if (current != NULL) {
+        for (int ix = 0; ix < headerKeyCount; ix++) {
+            if (strcasecmp(headerKeys[ix], name) == 0) {
+                return current->headers[ix];
+            }
+        }
+    }
+    return String();
+}
+
+bool HttpServer::hasHeader(const char* name) const {
+    return header(name).length() > 0;
+}
+
+WiFiClient HttpServer::client() {
+    if (current == NULL) {
+        return WiFiClient();
+    }
+    taken = true;
+    return current->client;
+}
+
+void HttpServer::sendHeader(const char* name, const String& value) {
+    responseHeaders += name;
+    responseHeaders += ": ";
+    responseHeaders += value;
+    responseHeaders += "\r\n";
+}
+
+void HttpServer::setContentLength(size_t contentLength) {
+    this->contentLength = contentLength;
+}
+
+void HttpServer::send(int code, const char* contentType, const String& content) {
+    send(code, contentType, content.c_str(), content.length());
+}
+
+void HttpServer::send(int code, const char* contentType, const char* content, size_t contentSize) {
+    if (current == NULL || responded) {
+        return;
+    }
+    Connection& connection = *current;
+    responded = true;
+
+    size_t length = contentLength != CONTENT_LENGTH_NOT_SET ? contentLength : contentSize;
+    contentLength = CONTENT_LENGTH_NOT_SET;
+    connection.chunked = length == CONTENT_LENGTH_UNKNOWN && !connection.http10;
+    if (length == CONTENT_LENGTH_UNKNOWN && !connection.chunked) {
+        // HTTP/1.0 clients detect the end of the body by the closed connection
+        connection.keepAlive = false;
+    }
+
+    char line[64];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code, reasonPhrase(code));
+    queue(connection, line);
+    if (contentType != NULL) {
+        queue(connection, "Content-Type: ");
+        queue(connection, contentType);
+        queue(connection, "\r\n");
+    }
+    if (responseHeaders.length() > 0) {
+        queue(connection, responseHeaders.c_str());
+        responseHeaders = String();
+    }
+    // A Not Modified response has no body, so it does not announce a length either
+    if (connection.chunked) {
+        queue(connection, "Transfer-Encoding: chunked\r\n");
+    } else if (length != CONTENT_LENGTH_UNKNOWN && code != 304) {
+        snprintf(line, sizeof(line), "Content-Length: %u\r\n", (unsigned int) length);
+        queue(connection, line);
+    }
+    queue(connection, connection.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    if (contentSize > 0) {
+        queue(connection, (const uint8_t*) content, contentSize);
+    }
+}
+
+void HttpServer::sendContent(const char* content, size_t length) {
+    if (current == NULL || !responded) {
+        return;
+    }
+    if (current->chunked) {
+        char size[12];
+        snprintf(size, sizeof(size), "%x\r\n", (unsigned int) length);
+        queue(*current, size);
+        queue(*current, (const uint8_t*) content, length);
+        queue(*current, "\r\n");
+    } else {
+        queue(*current, (const uint8_t*) content, length);
+    }
+}
+
+void HttpServer::sendContent(const String& content) {
+    sendContent(content.c_str(), content.length());
+}
+
+void HttpServer::stream(TContentFunction content) {
+    if (current != NULL && responded && !current->aborted) {
+        current->content = content;
+    }
+}
+
+int HttpServer::getConnections() const {
+    int count = 0;
+    for (int ix = 0; ix < HTTP_MAX_CONNECTIONS; ix++) {
+        if (connections[ix].state != CONNECTION_FREE) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void HttpServer::accept(unsigned long now) {
+    if (!server.hasClient()) {
+        return;
+    }
+
+    Connection* slot = NULL;
+    for (int ix = 0; ix < HTTP_MAX_CONNECTIONS && slot == NULL; ix++) {
+        if (connections[ix].state == CONNECTION_FREE) {
+            slot = &connections[ix];
+        }
+    }
+
+    if (slot == NULL) {
+        // Make room by closing the connection that is idle for the longest time. Clients
+        // often send their next request right after a response, so they get some time.
+        for (int ix = 0; ix < HTTP_MAX_CONNECTIONS; ix++) {
+            Connection& connection = connections[ix];
+            if (connection.state == CONNECTION_RECEIVING && connection.received == 0
+                    && now - connection.since >= HTTP_EVICT_TIME
+                    && (slot == NULL || now - connection.since > now - slot->since)) {
+                slot = &connection;
+            }
+        }
+        if (slot == NULL) {
+            // All connections are busy, the client waits in the backlog
+            return;
+        }
+        close(*slot);
+    }
+
+    slot->client = server.available();
+    if (!slot->client) {
+        return;
+    }
+    slot->client.setNoDelay(true);
+    reset(*slot, now);
+}
+
+void HttpServer::receive(Connection& connection, unsigned long now) {
+    while (connection.state == CONNECTION_RECEIVING || connection.state == CONNECTION_DISCARDING) {
+        int available = connection.client.available();
+        if (available <= 0) {
+            break;
+        }
+
+        if (connection.state == CONNECTION_DISCARDING) {
+            // The request body is not used, but must be skipped for the next request
+            uint8_t buffer[64];
+            size_t size = sizeof(buffer);
+            if (size > (size_t) available) {
+                size = available;
+            }
+            if (size > connection.contentLength) {
+                size = connection.contentLength;
+            }
+            size = connection.client.read(buffer, size);
+            connection.contentLength -= size;
+            if (connection.contentLength == 0) {
+                connection.state = CONNECTION_READY;
+            }
+        } else {
+            // Bytewise, so the bytes of a following request stay in the client
+            int c = connection.client.read();
+            if (c < 0) {
+                break;
+            }
+            if (connection.received++ == 0) {
+                connection.since = now;
+            }
+            receiveByte(connection, (char) c);
+        }
+    }
+
+    if (connection.state == CONNECTION_RECEIVING || connection.state == CONNECTION_DISCARDING) {
+        if (connection.received == 0) {
+            if (now - connection.since > HTTP_IDLE_TIMEOUT || !connection.client.connected()) {
+                close(connection);
+            }
+        } else if (now - connection.since > HTTP_REQUEST_TIMEOUT || !connection.client.connected()) {
+            timeouts++;
+            close(connection);
+        }
+    }
+}
+
+void HttpServer::receiveByte(Connection& connection, char c) {
+    if (c == '\n') {
+        connection.line[connection.lineLength] = '\0';
+        parseLine(connection);
+        connection.lineLength = 0;
+        connection.overflow = false;
+    } else if (c != '\r') {
+        if (connection.lineLength < HTTP_LINE_SIZE - 1) {
+            connection.line[connection.lineLength++] = c;
+        } else {
+            connection.overflow = true;
+        }
+    }
+}
+
+void HttpServer::parseLine(Connection& connection) {
+    char* line = connection.line;
+
+    if (connection.target.length() == 0) {
+        // Request line, empty lines before it are ignored
+        if (connection.lineLength == 0) {
+            return;
+        }
+        if (connection.overflow) {
+            reject(connection, 414);
+            return;
+        }
+        char* target = strchr(line, ' ');
+        char* version = target != NULL ? strchr(target + 1, ' ') : NULL;
+        if (version == NULL || target[1] != '/') {
+            reject(connection, 400);
+            return;
+        }
+        *version++ = '\0';
+        connection.target = target + 1;
+        connection.http10 = strcmp(version, "HTTP/1.0") == 0;
+        connection.keepAlive = !connection.http10;
+        return;
+    }
+
+    if (connection.lineLength == 0) {
+        // End of the header
+        connection.state = connection.contentLength > 0 ? CONNECTION_DISCARDING : CONNECTION_READY;
+        return;
+    }
+
+    char* colon = strchr(line, ':');
+    if (connection.overflow || colon == NULL) {
+        // Long header lines cannot be of interest
+        return;
+    }
+    *colon = '\0';
+    char* value = colon + 1;
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+
+    if (strcasecmp(line, "Connection") == 0) {
+        if (strcasecmp(value, "close") == 0) {
+            connection.keepAlive = false;
+        } else if (strcasecmp(value, "keep-alive") == 0) {
+            connection.keepAlive = true;
+        }
+    } else if (strcasecmp(line, "Content-Length") == 0) {
+        connection.contentLength = strtoul(value, NULL, 10);
+    } else {
+        for (int ix = 0; ix < headerKeyCount; ix++) {
+            if (strcasecmp(line, headerKeys[ix]) == 0) {
+                connection.headers[ix] = value;
+            }
+        }
+    }
+}
+
+void HttpServer::dispatch(Connection& connection) {
+    current = &connection;
+    parseTarget(connection.target);
+    contentLength = CONTENT_LENGTH_NOT_SET;
+    responseHeaders = String();
+    responded = false;
+    taken = false;
+    connection.state = CONNECTION_SENDING;
+
+    bool found = false;
+    for (int ix = 0; ix < routeCount && !found; ix++) {
+        if (currentUri == routes[ix].uri) {
+            routes[ix].handler();
+            found = true;
+        }
+    }
+    if (!found) {
+        if (notFoundHandler) {
+            notFoundHandler();
+        } else {
+            send(404, "text/plain", "Not found\n");
+        }
+    }
+
+    if (!responded) {
+        if (taken) {
+            // The handler took over the connection
+            release(connection);
+        } else {
+            send(500, "text/plain", "No response\n");
+        }
+    }
+    if (connection.aborted) {
+        connection.content = nullptr;
+        if (connection.pending == 0) {
+            close(connection);
+        }
+    }
+
+    current = NULL;
+    currentUri = String();
+    for (int ix = 0; ix < argCount; ix++) {
+        argNames[ix] = String();
+        argValues[ix] = String();
+    }
+    argCount = 0;
+}
+
+void HttpServer::produce(Connection& connection) {
+    current = &connection;
+    responded = true;
+    if (!connection.content() || connection.aborted) {
+        connection.content = nullptr;
+    }
+    if (connection.aborted && connection.pending == 0) {
+        close(connection);
+    }
+    current = NULL;
+}
+
+void HttpServer::parseTarget(const String& target) {
+    const char* str = target.c_str();
+    const char* query = strchr(str, '?');
+    size_t pathLength = query != NULL ? (size_t) (query - str) : target.length();
+    currentUri = urlDecode(str, pathLength, false);
+
+    argCount = 0;
+    if (query == NULL) {
+        return;
+    }
+    const char* pos = query + 1;
+    while (*pos != '\0' && argCount < HTTP_MAX_ARGS) {
+        const char* end = strchr(pos, '&');
+        if (end == NULL) {
+            end = pos + strlen(pos);
+        }
+        const char* equals = (const char*) memchr(pos, '=', end - pos);
+        if (end > pos) {
+            if (equals != NULL) {
+                argNames[argCount] = urlDecode(pos, equals - pos, true);
+                argValues[argCount] = urlDecode(equals + 1, end - equals - 1, true);
+            } else {
+                argNames[argCount] = urlDecode(pos, end - pos, true);
+                argValues[argCount] = String();
+            }
+            argCount++;
+        }
+        pos = *end != '\0' ? end + 1 : end;
+    }
+}
+
+bool HttpServer::canDispatch() const {
+    size_t pending = 0;
+    for (int ix = 0; ix < HTTP_MAX_CONNECTIONS; ix++) {
+        pending += connections[ix].pending;
+    }
+    return pending < HTTP_PENDING_LIMIT && ESP.getFreeHeap() >= HTTP_MIN_FREE_HEAP + HTTP_BLOCK_SIZE;
+}
+
+void HttpServer::transmit(Connection& connection, unsigned long now) {
+    if (writeOutput(connection) > 0) {
+        connection.since = now;
+    }
+
+    if (connection.pending == 0 && !connection.content) {
+        if (connection.keepAlive) {
+            reset(connection, now);
+        } else {
+            close(connection);
+        }
+    } else if (now - connection.since > HTTP_WRITE_TIMEOUT || !connection.client.connected()) {
+        timeouts++;
+        close(connection);
+    }
+}
+
+size_t HttpServer::writeOutput(Connection& connection) {
+    size_t written = 0;
+    while (connection.first != NULL) {
+        Block* block = connection.first;
+        size_t size = connection.client.availableForWrite();
+        if (size > block->length - block->offset) {
+            size = block->length - block->offset;
+        }
+        if (size == 0) {
+            break;
+        }
+        size = connection.client.write(block->data + block->offset, size);
+        if (size == 0) {
+            break;
+        }
+        block->offset += size;
+        connection.pending -= size;
+        connection.sent += size;
+        written += size;
+        if (block->offset == block->length) {
+            connection.first = block->next;
+            if (connection.first == NULL) {
+                connection.last = NULL;
+            }
+            delete block;
+        }
+    }
+    return written;
+}
+
+void HttpServer::queue(Connection& connection, const uint8_t* data, size_t length) {
+    while (length > 0 && !connection.aborted) {
+        Block* block = connection.last;
+        if (block == NULL || block->length == HTTP_BLOCK_SIZE) {
+            block = NULL;
+            if (connection.pending < HTTP_OUTPUT_LIMIT
+                    && ESP.getFreeHeap() >= HTTP_MIN_FREE_HEAP + sizeof(Block)) {
+                block = new Block();
+            }
+            if (block == NULL) {
+                // Never wait for the client, but send what it is able to accept right now
+                if (writeOutput(connection) == 0) {
+                    abort(connection);
+                }
+                continue;
+            }
+            block->next = NULL;
+            block->length = 0;
+            block->offset = 0;
+            if (connection.last != NULL) {
+                connection.last->next = block;
+            } else {
+                connection.first = block;
+            }
+            connection.last = block;
+        }
+
+        size_t part = HTTP_BLOCK_SIZE - block->length;
+        if (part > length) {
+            part = length;
+        }
+        memcpy(block->data + block->length, data, part);
+        block->length += part;
+        connection.pending += part;
+        data += part;
+        length -= part;
+    }
+}
+
+void HttpServer::abort(Connection& connection) {
+    overflows++;
+    bool replaceable = connection.sent == 0 && connection.pending > 0;
+    freeOutput(connection);
+    if (replaceable) {
+        // Nothing was sent yet, so the client gets a proper error response instead
+        reject(connection, 503);
+    }
+    connection.aborted = true;
+}
+
+void HttpServer::queue(Connection& connection, const char* str) {
+    queue(connection, (const uint8_t*) str, strlen(str));
+}
+
+void HttpServer::reject(Connection& connection, int code) {
+    connection.keepAlive = false;
+    connection.state = CONNECTION_SENDING;
+    char response[96];
+    snprintf(response, sizeof(response),
+            "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+            code, reasonPhrase(code));
+    queue(connection, response);
+}
+
+void HttpServer::reset(Connection& connection, unsigned long now) {
+    connection.state = CONNECTION_RECEIVING;
+    connection.since = now;
+    connection.http10 = false;
+    connection.keepAlive = false;
+    connection.chunked = false;
+    connection.overflow = false;
+    connection.waiting = false;
+    connection.aborted = false;
+    connection.sent = 0;
+    connection.received = 0;
+    connection.contentLength = 0;
+    connection.lineLength = 0;
+    connection.target = String();
+    for (int ix = 0; ix < HTTP_MAX_HEADERS; ix++) {
+        connection.headers[ix] = String();
+    }
+}
+
+void HttpServer::close(Connection& connection) {
+    connection.client.stop();
+    release(connection);
+}
+
+void HttpServer::release(Connection& connection) {
+    freeOutput(connection);
+    connection.content = nullptr;
+    connection.client = WiFiClient();
+    connection.state = CONNECTION_FREE;
+    connection.target = String();
+    for (int ix = 0; ix < HTTP_MAX_HEADERS; ix++) {
+        connection.headers[ix] = String();
+    }
+}
+
+void HttpServer::freeOutput(Connection& connection) {
+    while (connection.first != NULL) {
+        Block* block = connection.first;
+        connection.first = block->next;
+        delete block;
+    }
+    connection.last = NULL;
+    connection.pending = 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __HttpServer__
+#define __HttpServer__
+
+#include <functional>
+#include <WiFiServer.h>
+#include <WiFiClient.h>
+
+#define HTTP_MAX_CONNECTIONS      3     // Size of the connection pool
+#define HTTP_MAX_ROUTES          16     // Maximum number of routes
+#define HTTP_MAX_ARGS            12     // Maximum number of URL parameters of a request
+#define HTTP_MAX_HEADERS          4     // Maximum number of collected request headers
+#define HTTP_LINE_SIZE          256     // Maximum length of a request line or header line
+#define HTTP_BLOCK_SIZE         512     // Size of a block of the output queue
+#define HTTP_OUTPUT_LIMIT      6144     // Output bytes that are queued per response
+#define HTTP_PENDING_LIMIT     8192     // Output bytes of all connections before requests are deferred
+#define HTTP_MIN_FREE_HEAP     8192     // Heap that is always left for the rest of the firmware
+#define HTTP_REQUEST_TIMEOUT   3000     // Maximum time to receive the request header
+#define HTTP_IDLE_TIMEOUT      5000     // Time a keep-alive connection is kept without request
+#define HTTP_EVICT_TIME        1000     // Idle time before a connection is closed for a new one
+#define HTTP_WRITE_TIMEOUT     5000     // Maximum time a client may stall the output
+
+#ifndef CONTENT_LENGTH_UNKNOWN
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#endif
+
+/**
+ * A small web server that never blocks the main loop while clients are connected.
+ *
+ * The connections are kept in a pool of fixed size. handleClient() only reads what has
+ * already arrived, so requests are received and parsed step by step, over as many loop
+ * iterations as the clients need. A complete request is dispatched to its handler, and
+ * the response is collected in an output queue that is sent to the client as fast as
+ * it is able to accept it. Slow clients therefore delay neither the main loop nor other
+ * clients. Connections are kept alive for further requests.
+ *
+ * Large responses are produced step by step via stream(), whenever the client has
+ * received the previous part. Handlers of small responses just send them.
+ *
+ * If the pool is full, new connections wait in the TCP backlog until a slot is free.
+ * Connections that are idle for a while are closed first to make room. While much output is still
+ * pending, no further requests are dispatched. If a single step produces more output
+ * than the queue permits, or the heap runs short, the response is aborted with 503, or
+ * the connection is closed if a part of the response was already sent. Handlers whose
+ * output may exceed HTTP_OUTPUT_LIMIT must use stream().
+ *
+ * The API is a subset of ESP8266WebServer, so handlers look the same.
+ */
+class HttpServer {
+public:
+    typedef std::function<void(void)> THandlerFunction;
+    typedef std::function<bool(void)> TContentFunction;
+
+    /**
+     * Create a new HttpServer.
+     *
+     * @param port      Port to listen at
+     */
+    HttpServer(int port);
+
+    /**
+     * Start listening.
+     */
+    void begin();
+
+    /**
+     * Accept new connections, receive requests, dispatch at most one request to its
+     * handler, and send pending output. Never blocks. This method should be invoked
+     * frequently, e.g. in loop().
+     */
+    void handleClient();
+
+    /**
+     * Register a handler for a path.
+     */
+    void on(const char* uri, THandlerFunction handler);
+
+    /**
+     * Register a handler for all paths without a handler.
+     */
+    void onNotFound(THandlerFunction handler);
+
+    /**
+     * Set the names of the request headers that are available via header().
+     */
+    void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+
+    /**
+     * Return the path of the current request.
+     */
+    String uri() const;
+
+    /**
+     * Return the value of a URL parameter of the current request, or an empty string.
+     */
+    String arg(const char* name) const;
+
+    /**
+     * Check if the current request has the given URL parameter.
+     */
+    bool hasArg(const char* name) const;
+
+    /**
+     * Return the value of a collected request header, or an empty string.
+     */
+    String header(const char* name) const;
+
+    /**
+     * Check if the current request has the given collected header.
+     */
+    bool hasHeader(const char* name) const;
+
+    /**
+     * Return the client of the current request. If the handler does not send a response,
+     * the connection is handed over to the caller, and released from the pool.
+     */
+    WiFiClient client();
+
+    /**
+     * Add a header to the response. Must be invoked before send().
+     */
+    void sendHeader(const char* name, const String& value);
+
+    /**
+     * Set the content length of the next send(). With CONTENT_LENGTH_UNKNOWN, the
+     * body is passed to sendContent() afterwards, and sent with chunked encoding.
+     */
+    void setContentLength(size_t contentLength);
+
+    /**
+     * Send the response header and body.
+     *
+     * @param code          HTTP status code
+     * @param contentType   Content type, or NULL if there is no body
+     * @param content       Response body
+     */
+    void send(int code, const char* contentType = NULL, const String& content = String());
+
+    void send(int code, const char* contentType, const char* content, size_t length);
+
+    /**
+     * Send a part of the response body, after send() with an unknown content length.
+     * An empty part terminates the body.
+     */
+    void sendContent(const char* content, size_t length);
+
+    void sendContent(const String& content);
+
+    /**
+     * Continue the response in the background, after send() with an unknown content
+     * length. The function is invoked whenever the client has received the pending
+     * output, and sends the next part of the body via sendContent(). It returns false
+     * after it has terminated the body. URL parameters and headers are not available
+     * to the function, so it must keep the state it needs by itself.
+     */
+    void stream(TContentFunction content);
+
+    /**
+     * Return the number of open connections.
+     */
+    int getConnections() const;
+
+    /**
+     * Return the number of requests that were deferred because of pending output.
+     */
+    unsigned long getDeferred() const {
+        return deferred;
+    }
+
+    /**
+     * Return the number of connections that were closed because the client was too slow.
+     */
+    unsigned long getTimeouts() const {
+        return timeouts;
+    }
+
+    /**
+     * Return the number of responses that were aborted because they exceeded the output
+     * queue. They were answered with 503 if nothing was sent yet, otherwise the
+     * connection was closed.
+     */
+    unsigned long getOverflows() const {
+        return overflows;
+    }
+
+private:
+    enum ConnectionState {
+        CONNECTION_FREE,            // slot is not in use
+        CONNECTION_RECEIVING,       // receiving the request line and header
+        CONNECTION_DISCARDING,      // discarding the request body
+        CONNECTION_READY,           // request is complete, waiting for dispatch
+        CONNECTION_SENDING,         // sending the output queue
+    };
+
+    struct Block {
+        Block* next;
+        size_t length;
+        size_t offset;
+        uint8_t data[HTTP_BLOCK_SIZE];
+    };
+
+    struct Connection {
+        WiFiClient client;
+        ConnectionState state;
+        unsigned long since;        // time of the last progress
+        bool http10;
+        bool keepAlive;
+        bool chunked;
+        bool overflow;              // current line is too long
+        bool waiting;               // request was deferred
+        bool aborted;               // response exceeded the output queue
+        size_t received;
+        size_t contentLength;
+        size_t lineLength;
+        char line[HTTP_LINE_SIZE];
+        String target;
+        String headers[HTTP_MAX_HEADERS];
+        TContentFunction content;   // produces the rest of the response
+        Block* first;
+        Block* last;
+        size_t pending;
+        size_t sent;                // bytes of the current response sent so far
+    };
+
+    struct Route {
+        const char* uri;
+        THandlerFunction handler;
+    };
+
+    WiFiServer server;
+    Connection connections[HTTP_MAX_CONNECTIONS];
+    Route routes[HTTP_MAX_ROUTES];
+    int routeCount;
+    THandlerFunction notFoundHandler;
+    const char* headerKeys[HTTP_MAX_HEADERS];
+    int headerKeyCount;
+    int next;
+    unsigned long deferred;
+    unsigned long timeouts;
+    unsigned long overflows;
+
+    // State of the request that is currently dispatched
+    Connection* current;
+    String currentUri;
+    String argNames[HTTP_MAX_ARGS];
+    String argValues[HTTP_MAX_ARGS];
+    int argCount;
+    String responseHeaders;
+    size_t contentLength;
+    bool responded;
+    bool taken;
+
+    void accept(unsigned long now);
+    void receive(Connection& connection, unsigned long now);
+    void receiveByte(Connection& connection, char c);
+    void parseLine(Connection& connection);
+    void dispatch(Connection& connection);
+    void produce(Connection& connection);
+    void parseTarget(const String& target);
+    bool canDispatch() const;
+
+    /**
+     * Send pending output, and finish the response when all of it was sent.
+     */
+    void transmit(Connection& connection, unsigned long now);
+
+    /**
+     * Send as much of the output queue as the client accepts without blocking.
+     *
+     * @return number of bytes that were sent
+     */
+    size_t writeOutput(Connection& connection);
+
+    /**
+     * Add data to the output queue. If the queue is full, the response is aborted.
+     */
+    void queue(Connection& connection, const uint8_t* data, size_t length);
+
+    void queue(Connection& connection, const char* str);
+
+    /**
+     * Abort a response that does not fit into the output queue. It is replaced by 503 if
+     * nothing was sent yet. Further output of the handler is discarded.
+     */
+    void abort(Connection& connection);
+
+    /**
+     * Answer a malformed request, and close the connection afterwards.
+     */
+    void reject(Connection& connection, int code);
+
+    void reset(Connection& connection, unsigned long now);
+    void close(Connection& connection);
+    void release(Connection& connection);
+    void freeOutput(Connection& connection);
+};
+
+#endif
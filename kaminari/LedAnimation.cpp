@@ -0,0 +1,186 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LedAnimation.h"
+
+#include <stddef.h>
+
+/**
+ * Compile-time sequence of indexes 0..N-1, for generating the lookup tables.
+ * std::index_sequence is not available in C++11.
+ */
+template<size_t... I>
+struct IndexSequence {};
+
+template<size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template<size_t... I>
+struct MakeIndexSequence<0, I...> {
+    typedef IndexSequence<I...> type;
+};
+
+/**
+ * A lookup table with 256 entries, stored in flash.
+ */
+struct LedTable {
+    uint8_t values[256];
+};
+
+/**
+ * Gamma curve, approximating a gamma of 2.2 by 0.8 x² + 0.2 x³, as pow() cannot be
+ * evaluated at compile time.
+ */
+constexpr uint8_t gammaCurve(unsigned long x) {
+    return (4UL * x * x * 255UL + x * x * x + 5UL * 255UL * 255UL / 2UL) / (5UL * 255UL * 255UL);
+}
+
+/**
+ * Smoothstep curve, 3 x² - 2 x³.
+ */
+constexpr unsigned long smoothstepCurve(unsigned long x) {
+    return (3UL * x * x * 255UL - 2UL * x * x * x + 255UL * 255UL / 2UL) / (255UL * 255UL);
+}
+
+/**
+ * Fade out curve. It starts and ends softly, and is gamma corrected so the fade is
+ * perceived as even.
+ */
+constexpr uint8_t fadeCurve(unsigned long progress) {
+    return gammaCurve(smoothstepCurve(255UL - progress));
+}
+
+template<size_t... I>
+constexpr LedTable makeGammaTable(IndexSequence<I...>) {
+    return LedTable {{ gammaCurve(I)... }};
+}
+
+template<size_t... I>
+constexpr LedTable makeFadeTable(IndexSequence<I...>) {
+    return LedTable {{ fadeCurve(I)... }};
+}
+
+static constexpr LedTable GAMMA_TABLE PROGMEM = makeGammaTable(MakeIndexSequence<256>::type());
+static constexpr LedTable FADE_TABLE PROGMEM = makeFadeTable(MakeIndexSequence<256>::type());
+
+static_assert(GAMMA_TABLE.values[0] == 0 && GAMMA_TABLE.values[255] == 255, "bad gamma table");
+static_assert(FADE_TABLE.values[0] == 255 && FADE_TABLE.values[255] == 0, "bad fade table");
+
+/**
+ * Fixed-point timeline of an animation. It maps the elapsed time to a progress of
+ * 0..255, using a precomputed 16.16 reciprocal of the duration instead of a division.
+ *
+ * @param DURATION  Duration of the animation, in milliseconds
+ */
+template<unsigned long DURATION>
+struct Timeline {
+    static constexpr unsigned long SCALE = (256UL << 16) / DURATION;
+
+    /**
+     * Return the progress of the animation. elapsed must be lower than DURATION.
+     */
+    static inline unsigned int progress(unsigned long elapsed) {
+        return (elapsed * SCALE) >> 16;
+    }
+};
+
+static inline uint8_t lookup(const LedTable& table, unsigned int index) {
+    return pgm_read_byte(&table.values[index]);
+}
+
+static inline uint8_t scale(uint8_t value, uint8_t factor) {
+    return (value * (factor + 1U)) >> 8;
+}
+
+LedAnimation::LedAnimation() {
+    this->blue = 0;
+    this->blinkBlue = 0;
+    this->disturberBrightness = 0;
+    this->white = 0;
+    this->red = 0;
+    this->green = 0;
+    this->hasLightning = false;
+    this->hasDisturber = false;
+    this->lightningTime = 0;
+    this->disturberTime = 0;
+}
+
+void LedAnimation::setNoiseFloor(uint8_t brightness, uint8_t blinkBrightness) {
+    blue = brightness;
+    blinkBlue = blinkBrightness;
+}
+
+void LedAnimation::setDisturberBrightness(uint8_t brightness) {
+    disturberBrightness = brightness;
+}
+
+void LedAnimation::lightning(unsigned long time, unsigned long energy, unsigned int distance) {
+    if (distance > 40) {
+        return;
+    }
+    unsigned long w = energy * 255UL / 300000UL;
+    white = w < 255 ? w : 255;
+    green = distance * 255U / 40U;
+    red = (40U - distance) * 255U / 40U;
+    lightningTime = time;
+    hasLightning = true;
+}
+
+void LedAnimation::disturber(unsigned long time) {
+    disturberTime = time;
+    hasDisturber = true;
+}
+
+uint32_t LedAnimation::frame(unsigned long now, bool outOfRange) {
+    uint8_t w = 0;
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = blue;
+
+    if (outOfRange) {
+        // blink about once per second
+        b = (now & 0x3FF) < 0x200 ? blinkBlue : 0;
+    }
+
+    if (hasLightning) {
+        unsigned long elapsed = now - lightningTime;
+        if (elapsed < ENERGY_ANIMATION_TIME) {
+            w = scale(white, lookup(FADE_TABLE, Timeline<ENERGY_ANIMATION_TIME>::progress(elapsed)));
+            b = 0;
+        } else if (elapsed < ENERGY_ANIMATION_TIME + DISTANCE_ANIMATION_TIME) {
+            // red and green start at full brightness after the white flash, while blue
+            // ramps up again over the entire animation
+            uint8_t fade = lookup(FADE_TABLE, Timeline<DISTANCE_ANIMATION_TIME>::progress(elapsed - ENERGY_ANIMATION_TIME));
+            r = scale(red, fade);
+            g = scale(green, fade);
+            b = scale(b, lookup(GAMMA_TABLE, Timeline<ENERGY_ANIMATION_TIME + DISTANCE_ANIMATION_TIME>::progress(elapsed)));
+        } else {
+            hasLightning = false;
+        }
+    }
+
+    if (hasDisturber && disturberBrightness > 0) {
+        unsigned long elapsed = now - disturberTime;
+        if (elapsed < DISTURBER_ANIMATION_TIME) {
+            r = scale(disturberBrightness, lookup(FADE_TABLE, Timeline<DISTURBER_ANIMATION_TIME>::progress(elapsed)));
+        } else {
+            hasDisturber = false;
+        }
+    }
+
+    return (uint32_t) w << 24 | (uint32_t) r << 16 | (uint32_t) g << 8 | b;
+}
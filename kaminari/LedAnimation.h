@@ -0,0 +1,94 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __LedAnimation__
+#define __LedAnimation__
+
+#include <Arduino.h>
+
+#define DISTANCE_ANIMATION_TIME 5000
+#define ENERGY_ANIMATION_TIME    500
+#define DISTURBER_ANIMATION_TIME 1000
+
+/**
+ * Computes the color of the status LED.
+ *
+ * All values that only change on a detector event or a configuration change are
+ * precomputed when they change, so rendering a frame just needs a few table lookups,
+ * multiplications and shifts. Fades use a compile-time generated, gamma corrected
+ * lookup table, and the animation progress is computed on a fixed-point timeline.
+ *
+ * The resulting color is a packed WRGB word, as used by Adafruit_NeoPixel.
+ */
+class LedAnimation {
+public:
+    LedAnimation();
+
+    /**
+     * Set the brightness of the noise floor indicator.
+     *
+     * @param brightness    Blue brightness of the current noise floor level
+     * @param blinkBrightness   Blue brightness if the noise floor level is out of range
+     */
+    void setNoiseFloor(uint8_t brightness, uint8_t blinkBrightness);
+
+    /**
+     * Set the maximum brightness of the disturber flash. 0 disables the flash.
+     */
+    void setDisturberBrightness(uint8_t brightness);
+
+    /**
+     * Start a lightning animation. It flashes white by the energy, and then fades
+     * from red (overhead) to green (distant) by the distance of the lightning.
+     * Lightnings that are out of range are ignored.
+     *
+     * @param time      Time of the lightning, in milliseconds
+     * @param energy    Energy of the lightning
+     * @param distance  Estimated distance of the lightning, in km
+     */
+    void lightning(unsigned long time, unsigned long energy, unsigned int distance);
+
+    /**
+     * Start a disturber animation.
+     *
+     * @param time      Time of the disturber, in milliseconds
+     */
+    void disturber(unsigned long time);
+
+    /**
+     * Render a frame. Finished animations are discarded.
+     *
+     * @param now       Current time, in milliseconds
+     * @param outOfRange    true if the noise floor level is out of range
+     * @return WRGB color of this frame
+     */
+    uint32_t frame(unsigned long now, bool outOfRange);
+
+private:
+    uint8_t blue;
+    uint8_t blinkBlue;
+    uint8_t disturberBrightness;
+    uint8_t white;
+    uint8_t red;
+    uint8_t green;
+    bool hasLightning;
+    bool hasDisturber;
+    unsigned long lightningTime;
+    unsigned long disturberTime;
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __LightningHistory__
+#define __LightningHistory__
+
+#include <stddef.h>
+
+/**
+ * A single detected lightning.
+ *
+ * The AS3935 delivers a 21 bit energy value and a 6 bit distance, so both are packed
+ * into a single word.
+ */
+struct Lightning {
+    unsigned long time;
+    unsigned long energy : 24;
+    unsigned long distance : 8;
+};
+
+/**
+ * A ring buffer of the most recent lightnings.
+ *
+ * Adding a lightning is O(1). If the buffer is full, the oldest lightning is overwritten.
+ * All lightnings are always returned in descending order, starting from the most recent
+ * event. The entries can be iterated in place, without copying them.
+ *
+ * Every added lightning gets a sequence number, starting from 1. Sequence numbers are
+ * monotonically increasing, and are not reset when the history is cleared. They are
+ * derived from the position in the buffer, so they do not need any memory.
+ *
+ * @param N     Maximum number of lightnings to be stored
+ */
+template<size_t N>
+class LightningHistory {
+public:
+
+    class Iterator {
+    public:
+        Iterator(const LightningHistory* history, size_t index)
+            : history(history), index(index) {}
+
+        const Lightning& operator*() const {
+            return (*history)[index];
+        }
+
+        const Lightning* operator->() const {
+            return &(*history)[index];
+        }
+
+        Iterator& operator++() {
+            index++;
+            return *this;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return index != other.index;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return index == other.index;
+        }
+
+    private:
+        const LightningHistory* history;
+        size_t index;
+    };
+
+    LightningHistory() : sequence(0), overwritten(0) {
+        clear();
+    }
+
+    /**
+     * Add a new lightning. If the history is full, the oldest lightning is removed.
+     *
+     * @return Reference to the new entry, to be filled by the caller
+     */
+    Lightning& add() {
+        Lightning& entry = entries[head];
+        head = head + 1 < N ? head + 1 : 0;
+        if (count < N) {
+            count++;
+        } else {
+            overwritten = sequence + 1 - N;
+        }
+        sequence++;
+        return entry;
+    }
+
+    /**
+     * Remove all lightnings. The sequence numbers are not reset.
+     */
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    /**
+     * Return the number of stored lightnings.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * Return true if no lightnings are stored.
+     */
+    bool empty() const {
+        return count == 0;
+    }
+
+    /**
+     * Return the maximum number of lightnings that can be stored.
+     */
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    /**
+     * Return a lightning. Index 0 is the most recent lightning. The index must be
+     * lower than size().
+     */
+    const Lightning& operator[](size_t index) const {
+        size_t pos = head + N - 1 - index;
+        return entries[pos < N ? pos : pos - N];
+    }
+
+    /**
+     * Return the sequence number of a lightning. Index 0 is the most recent lightning.
+     * The index must be lower than size().
+     */
+    unsigned long getSequence(size_t index) const {
+        return sequence - index;
+    }
+
+    /**
+     * Return the sequence number of the most recently added lightning, or 0 if no
+     * lightning has been added yet.
+     */
+    unsigned long getSequence() const {
+        return sequence;
+    }
+
+    /**
+     * Check if lightnings that were added after the given sequence number have been
+     * overwritten because the history was full.
+     *
+     * @param since     Sequence number of the last lightning that is already known
+     * @return true if lightnings after that sequence number are lost
+     */
+    bool isOverwritten(unsigned long since) const {
+        return since < overwritten;
+    }
+
+    /**
+     * Invoke the visitor for every stored lightning, starting with the most recent one.
+     *
+     * @param visitor   Callable that accepts a const Lightning&
+     */
+    template<typename V>
+    void forEach(V visitor) const {
+        for (size_t ix = 0; ix < count; ix++) {
+            visitor((*this)[ix]);
+        }
+    }
+
+    Iterator begin() const {
+        return Iterator(this, 0);
+    }
+
+    Iterator end() const {
+        return Iterator(this, count);
+    }
+
+private:
+    Lightning entries[N];
+    size_t head;
+    size_t count;
+    unsigned long sequence;
+    unsigned long overwritten;
+};
+
+#endif
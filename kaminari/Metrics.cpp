@@ -0,0 +1,96 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+
+#include "Metrics.h"
+
+static void formatSeconds(char* buffer, size_t size, unsigned long long micros) {
+    snprintf(buffer, size, "%lu.%06lu",
+            (unsigned long) (micros / 1000000), (unsigned long) (micros % 1000000));
+}
+
+MetricsWriter::MetricsWriter(Print& out) : out(out) {
+}
+
+void MetricsWriter::family(const char* name, const char* type, const char* help) {
+    out.print("# HELP ");
+    out.print(name);
+    out.print(" ");
+    out.println(help);
+    out.print("# TYPE ");
+    out.print(name);
+    out.print(" ");
+    out.println(type);
+}
+
+void MetricsWriter::value(const char* name, unsigned long value, const char* labels) {
+    series(name, NULL, labels, NULL);
+    out.println(value);
+}
+
+void MetricsWriter::seconds(const char* name, unsigned long long micros, const char* labels) {
+    series(name, NULL, labels, NULL);
+    printSeconds(micros);
+}
+
+void MetricsWriter::histogram(const char* name, const Histogram& histogram, const char* labels) {
+    char le[24];
+    unsigned long cumulated = 0;
+    for (int ix = 0; ix < HISTOGRAM_BUCKETS; ix++) {
+        cumulated += histogram.getBucket(ix);
+        formatSeconds(le, sizeof(le), Histogram::getBound(ix));
+        series(name, "_bucket", labels, le);
+        out.println(cumulated);
+    }
+    series(name, "_bucket", labels, "+Inf");
+    out.println(histogram.getCount());
+    series(name, "_sum", labels, NULL);
+    printSeconds(histogram.getSum());
+    series(name, "_count", labels, NULL);
+    out.println(histogram.getCount());
+}
+
+void MetricsWriter::series(const char* name, const char* suffix, const char* labels, const char* le) {
+    bool hasLabels = labels != NULL && *labels != '\0';
+    out.print(name);
+    if (suffix != NULL) {
+        out.print(suffix);
+    }
+    if (hasLabels || le != NULL) {
+        out.print("{");
+        if (hasLabels) {
+            out.print(labels);
+        }
+        if (le != NULL) {
+            if (hasLabels) {
+                out.print(",");
+            }
+            out.print("le=\"");
+            out.print(le);
+            out.print("\"");
+        }
+        out.print("}");
+    }
+    out.print(" ");
+}
+
+void MetricsWriter::printSeconds(unsigned long long micros) {
+    char buffer[24];
+    formatSeconds(buffer, sizeof(buffer), micros);
+    out.println(buffer);
+}
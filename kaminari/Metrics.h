@@ -0,0 +1,151 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Metrics__
+#define __Metrics__
+
+#include <Arduino.h>
+
+#define HISTOGRAM_BUCKETS 12
+
+/**
+ * A histogram of durations, with fixed buckets from 50 µs to 1 s.
+ *
+ * Observing a duration is cheap and does not allocate memory, so it can be used in
+ * hot paths.
+ */
+class Histogram {
+public:
+    Histogram() : count(0), sum(0) {
+        for (int ix = 0; ix <= HISTOGRAM_BUCKETS; ix++) {
+            buckets[ix] = 0;
+        }
+    }
+
+    /**
+     * Add a duration.
+     *
+     * @param micros    Duration, in µs
+     */
+    inline void observe(unsigned long micros) {
+        int ix = 0;
+        while (ix < HISTOGRAM_BUCKETS && micros > getBound(ix)) {
+            ix++;
+        }
+        buckets[ix]++;
+        count++;
+        sum += micros;
+    }
+
+    /**
+     * Return the number of durations in the given bucket. The bucket at index
+     * HISTOGRAM_BUCKETS contains all durations that are longer than the last bound.
+     */
+    unsigned long getBucket(int index) const {
+        return buckets[index];
+    }
+
+    /**
+     * Return the upper bound of the given bucket, in µs.
+     */
+    static unsigned long getBound(int index) {
+        static const unsigned long bounds[HISTOGRAM_BUCKETS] = {
+            50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 1000000
+        };
+        return bounds[index];
+    }
+
+    /**
+     * Return the number of durations.
+     */
+    unsigned long getCount() const {
+        return count;
+    }
+
+    /**
+     * Return the sum of all durations, in µs.
+     */
+    unsigned long long getSum() const {
+        return sum;
+    }
+
+private:
+    unsigned long buckets[HISTOGRAM_BUCKETS + 1];
+    unsigned long count;
+    unsigned long long sum;
+};
+
+/**
+ * Writes metrics in the Prometheus text format.
+ *
+ * Durations are kept in µs, but written in seconds, as Prometheus expects it.
+ */
+class MetricsWriter {
+public:
+
+    /**
+     * Create a new MetricsWriter.
+     *
+     * @param out   Print to write the metrics to
+     */
+    MetricsWriter(Print& out);
+
+    /**
+     * Start a new metric family. Must be invoked once, before the values of the
+     * family are written.
+     *
+     * @param name  Metric name
+     * @param type  "counter", "gauge" or "histogram"
+     * @param help  Description of the metric
+     */
+    void family(const char* name, const char* type, const char* help);
+
+    /**
+     * Write a value.
+     *
+     * @param name      Metric name
+     * @param value     Value
+     * @param labels    Labels, like 'route="/status"', or NULL
+     */
+    void value(const char* name, unsigned long value, const char* labels = NULL);
+
+    /**
+     * Write a duration, in seconds.
+     *
+     * @param name      Metric name
+     * @param micros    Duration, in µs
+     * @param labels    Labels, or NULL
+     */
+    void seconds(const char* name, unsigned long long micros, const char* labels = NULL);
+
+    /**
+     * Write a histogram.
+     *
+     * @param name      Metric name
+     * @param histogram Histogram to write
+     * @param labels    Labels, or NULL
+     */
+    void histogram(const char* name, const Histogram& histogram, const char* labels = NULL);
+
+private:
+    Print& out;
+
+    void series(const char* name, const char* suffix, const char* labels, const char* le);
+    void printSeconds(unsigned long long micros);
+};
+
+#endif
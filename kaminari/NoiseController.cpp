@@ -0,0 +1,280 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "NoiseController.h"
+
+#define NOISE_LEVEL_RAISE_DELAY      60000  // Delay before noise level can be raised again
+#define NOISE_LEVEL_REDUCTION_DELAY 600000  // Delay before noise reduction is lowered again
+
+#define ADAPTIVE_TICK             1000  // Interval of rate smoothing and adjustments
+#define ADAPTIVE_RATE_SCALE         16  // Fixed point scale of the smoothed rates
+#define ADAPTIVE_RAISE_HOLD       2000  // Time for the detector to re-evaluate the noise after a raise
+#define ADAPTIVE_QUIET_RATE          1  // Noise rate per minute that is considered quiet
+#define ADAPTIVE_LOWER_STEP       2000  // Minimum time between two lowering steps
+#define ADAPTIVE_MAX_BACKOFF         8  // Maximum multiplier of the recovery time
+#define ADAPTIVE_MAX_BOOST           4  // Maximum raise of watchdog threshold and spike rejection
+#define ADAPTIVE_TUNE_HOLD       10000  // Minimum time between two disturber adjustments
+#define ADAPTIVE_TUNE_RELEASE    60000  // Minimum time before a disturber adjustment is released
+#define ADAPTIVE_RECOVERY_TIME    5000  // Default recovery time
+
+BalanceNoiseController::BalanceNoiseController() {
+    this->lastChange = 0;
+    this->lastRaise = 0;
+    this->balance = 0;
+    this->pendingRaise = false;
+}
+
+void BalanceNoiseController::begin(unsigned long now, const NoiseSettings& settings) {
+    lastChange = now;
+    lastRaise = now;
+    balance = 0;
+    pendingRaise = false;
+}
+
+void BalanceNoiseController::onInterrupt(unsigned long now, int interrupt) {
+    if ((interrupt & 0x01) != 0 && (now - lastRaise) > NOISE_LEVEL_RAISE_DELAY) {
+        // Noise level too high
+        lastChange = now;
+        lastRaise = now;
+        balance++;
+        if (balance > 1) {
+            balance--;
+            pendingRaise = true;
+        }
+    }
+}
+
+bool BalanceNoiseController::update(unsigned long now, NoiseSettings& settings) {
+    bool changed = false;
+
+    if (pendingRaise) {
+        pendingRaise = false;
+        if (settings.noiseFloorLevel < 7) {
+            settings.noiseFloorLevel++;
+            settings.outOfRange = false;
+        } else {
+            settings.outOfRange = true;
+        }
+        changed = true;
+    }
+
+    // Try to reduce the noise level again
+    if ((now - lastChange) > NOISE_LEVEL_REDUCTION_DELAY) {
+        lastChange = now;
+        balance--;
+        if (balance < -1) {
+            balance++;
+            if (settings.outOfRange) {
+                settings.outOfRange = false;
+            } else if (settings.noiseFloorLevel > 0) {
+                settings.noiseFloorLevel--;
+            }
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+bool BalanceNoiseController::isBoosted() const {
+    return false;
+}
+
+bool BalanceNoiseController::end(NoiseSettings& settings) {
+    // Only the noise floor level is changed, and it has no base value
+    return false;
+}
+
+
+AdaptiveNoiseController::AdaptiveNoiseController() {
+    this->recoveryTime = ADAPTIVE_RECOVERY_TIME;
+    this->disturberLimit = 0;
+    begin(0, NoiseSettings());
+}
+
+void AdaptiveNoiseController::setRecoveryTime(unsigned long recoveryTime) {
+    this->recoveryTime = recoveryTime;
+}
+
+unsigned long AdaptiveNoiseController::getRecoveryTime() const {
+    return recoveryTime;
+}
+
+void AdaptiveNoiseController::setDisturberLimit(unsigned int disturberLimit) {
+    this->disturberLimit = disturberLimit;
+}
+
+unsigned int AdaptiveNoiseController::getDisturberLimit() const {
+    return disturberLimit;
+}
+
+unsigned int AdaptiveNoiseController::getNoiseRate() const {
+    return noiseRate / ADAPTIVE_RATE_SCALE;
+}
+
+unsigned int AdaptiveNoiseController::getDisturberRate() const {
+    return disturberRate / ADAPTIVE_RATE_SCALE;
+}
+
+void AdaptiveNoiseController::begin(unsigned long now, const NoiseSettings& settings) {
+    lastTick = now;
+    lastNoise = now;
+    lastRaise = now - ADAPTIVE_RAISE_HOLD;
+    lastLower = now;
+    lastTune = now;
+    noiseCount = 0;
+    disturberCount = 0;
+    noiseRate = 0;
+    disturberRate = 0;
+    backoff = 1;
+    watchdogBoost = 0;
+    spikeBoost = 0;
+    probing = false;
+}
+
+void AdaptiveNoiseController::onInterrupt(unsigned long now, int interrupt) {
+    if ((interrupt & 0x01) != 0) {
+        noiseCount++;
+        lastNoise = now;
+    }
+    if ((interrupt & 0x04) != 0) {
+        disturberCount++;
+    }
+}
+
+bool AdaptiveNoiseController::update(unsigned long now, NoiseSettings& settings) {
+    unsigned long elapsed = now - lastTick;
+    if (elapsed < ADAPTIVE_TICK) {
+        return false;
+    }
+    lastTick = now;
+
+    // Smooth the rates. Noise reacts fast, disturbers are smoothed over a longer time.
+    long noiseSample = (long) noiseCount * 60000L * ADAPTIVE_RATE_SCALE / (long) elapsed;
+    long disturberSample = (long) disturberCount * 60000L * ADAPTIVE_RATE_SCALE / (long) elapsed;
+    noiseRate += (noiseSample - noiseRate) / 2;
+    disturberRate += (disturberSample - disturberRate) / 8;
+    bool noisy = noiseCount > 0;
+    noiseCount = 0;
+    disturberCount = 0;
+
+    bool changed = updateNoiseFloorLevel(now, noisy, settings);
+    changed |= updateDisturberSettings(now, settings);
+    return changed;
+}
+
+bool AdaptiveNoiseController::updateNoiseFloorLevel(unsigned long now, bool noisy, NoiseSettings& settings) {
+    if (noisy) {
+        if (now - lastRaise < ADAPTIVE_RAISE_HOLD) {
+            return false;
+        }
+        if (probing && now - lastLower < 2 * recoveryTime && backoff < ADAPTIVE_MAX_BACKOFF) {
+            // The last lowering was premature, wait longer next time
+            backoff *= 2;
+        }
+        probing = false;
+        lastRaise = now;
+        if (settings.noiseFloorLevel < 7) {
+            settings.noiseFloorLevel++;
+            settings.outOfRange = false;
+        } else {
+            settings.outOfRange = true;
+        }
+        return true;
+    }
+
+    if (probing && now - lastLower >= 2 * recoveryTime) {
+        // The last lowering was successful, so we can be faster again
+        probing = false;
+        if (backoff > 1) {
+            backoff /= 2;
+        }
+    }
+
+    if (noiseRate >= ADAPTIVE_QUIET_RATE * ADAPTIVE_RATE_SCALE
+            || now - lastNoise < recoveryTime * backoff
+            || now - lastLower < ADAPTIVE_LOWER_STEP) {
+        return false;
+    }
+
+    if (settings.outOfRange) {
+        settings.outOfRange = false;
+    } else if (settings.noiseFloorLevel > 0) {
+        settings.noiseFloorLevel--;
+    } else {
+        return false;
+    }
+    lastLower = now;
+    probing = true;
+    return true;
+}
+
+bool AdaptiveNoiseController::updateDisturberSettings(unsigned long now, NoiseSettings& settings) {
+    if (disturberLimit == 0) {
+        return false;
+    }
+
+    long limit = (long) disturberLimit * ADAPTIVE_RATE_SCALE;
+    if (disturberRate > limit) {
+        if (now - lastTune < ADAPTIVE_TUNE_HOLD) {
+            return false;
+        }
+        if (watchdogBoost < ADAPTIVE_MAX_BOOST && settings.watchdogThreshold < 15) {
+            settings.watchdogThreshold++;
+            watchdogBoost++;
+        } else if (spikeBoost < ADAPTIVE_MAX_BOOST && settings.spikeRejection < 15) {
+            settings.spikeRejection++;
+            spikeBoost++;
+        } else {
+            return false;
+        }
+        lastTune = now;
+        return true;
+    }
+
+    if (disturberRate < limit / 2 && (watchdogBoost > 0 || spikeBoost > 0)) {
+        if (now - lastTune < ADAPTIVE_TUNE_RELEASE) {
+            return false;
+        }
+        if (spikeBoost > 0) {
+            settings.spikeRejection--;
+            spikeBoost--;
+        } else {
+            settings.watchdogThreshold--;
+            watchdogBoost--;
+        }
+        lastTune = now;
+        return true;
+    }
+
+    return false;
+}
+
+bool AdaptiveNoiseController::isBoosted() const {
+    return watchdogBoost > 0 || spikeBoost > 0;
+}
+
+bool AdaptiveNoiseController::end(NoiseSettings& settings) {
+    if (!isBoosted()) {
+        return false;
+    }
+    settings.watchdogThreshold -= watchdogBoost;
+    settings.spikeRejection -= spikeBoost;
+    watchdogBoost = 0;
+    spikeBoost = 0;
+    return true;
+}
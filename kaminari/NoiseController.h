@@ -0,0 +1,187 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __NoiseController__
+#define __NoiseController__
+
+/**
+ * Detector settings that are adjusted by a NoiseController.
+ */
+struct NoiseSettings {
+    int noiseFloorLevel;        // noise floor level register value, 0..7
+    int watchdogThreshold;      // watchdog threshold, 0..15
+    int spikeRejection;         // spike rejection, 0..15
+    bool outOfRange;            // the noise is above the highest noise floor level
+};
+
+/**
+ * Adjusts the noise floor level, and optionally other detector settings, to the noise
+ * and disturbers in the environment of the detector.
+ *
+ * The AS3935 driver reports every interrupt to the controller, and invokes update() on
+ * every driver update. Both are invoked from the main loop.
+ */
+class NoiseController {
+public:
+    virtual ~NoiseController() {}
+
+    /**
+     * Start controlling. This is invoked when the controller is attached to the driver,
+     * and whenever the detector settings were changed from outside, e.g. by the user.
+     *
+     * @param now       Current time, in ms
+     * @param settings  Current detector settings
+     */
+    virtual void begin(unsigned long now, const NoiseSettings& settings) = 0;
+
+    /**
+     * An interrupt was reported by the detector.
+     *
+     * @param now       Current time, in ms
+     * @param interrupt Interrupt register (0x01 noise, 0x04 disturber, 0x08 lightning)
+     */
+    virtual void onInterrupt(unsigned long now, int interrupt) = 0;
+
+    /**
+     * Adjust the detector settings. This method is invoked very frequently, so it
+     * should return quickly if there is nothing to do.
+     *
+     * @param now       Current time, in ms
+     * @param settings  Current detector settings, to be changed by the controller
+     * @return true if the settings were changed
+     */
+    virtual bool update(unsigned long now, NoiseSettings& settings) = 0;
+
+    /**
+     * Return true if the controller has raised settings above their base values, so
+     * end() has something to hand back.
+     */
+    virtual bool isBoosted() const = 0;
+
+    /**
+     * Stop controlling. This is invoked before the controller is replaced or restarted,
+     * and before the detector settings are changed from outside. Settings that the
+     * controller has raised above their base values must be handed back, otherwise
+     * they would stay raised.
+     *
+     * @param settings  Current detector settings, to be changed by the controller
+     * @return true if the settings were changed
+     */
+    virtual bool end(NoiseSettings& settings) = 0;
+};
+
+/**
+ * The classic noise floor controller.
+ *
+ * The noise floor level is raised if noise was detected twice, but not more often
+ * than once per minute. It is lowered again after 10 minutes without noise.
+ */
+class BalanceNoiseController : public NoiseController {
+public:
+    BalanceNoiseController();
+
+    void begin(unsigned long now, const NoiseSettings& settings) override;
+    void onInterrupt(unsigned long now, int interrupt) override;
+    bool update(unsigned long now, NoiseSettings& settings) override;
+    bool isBoosted() const override;
+    bool end(NoiseSettings& settings) override;
+
+private:
+    unsigned long lastChange;
+    unsigned long lastRaise;
+    int balance;
+    bool pendingRaise;
+};
+
+/**
+ * A noise floor controller that converges quickly in both directions.
+ *
+ * Noise and disturber interrupts are counted, and smoothed to rates per minute once
+ * per second. The noise floor level is raised as soon as noise is reported. After the
+ * noise has been gone for the recovery time, it is lowered again every 2 seconds until
+ * noise is reported again. If the noise comes back shortly after a level was lowered,
+ * the recovery time is doubled (up to 8 times), so the controller does not oscillate
+ * around a noisy level. It is halved again on every successful lowering.
+ *
+ * If a disturber limit is set, the watchdog threshold and then the spike rejection are
+ * raised above their base settings while the smoothed disturber rate exceeds the limit.
+ * They are lowered again when the rate has dropped below half of the limit, or when the
+ * controller is stopped.
+ */
+class AdaptiveNoiseController : public NoiseController {
+public:
+    AdaptiveNoiseController();
+
+    /**
+     * Set the time without noise before the noise floor level is lowered, in ms.
+     */
+    void setRecoveryTime(unsigned long recoveryTime);
+
+    /**
+     * Return the time without noise before the noise floor level is lowered, in ms.
+     */
+    unsigned long getRecoveryTime() const;
+
+    /**
+     * Set the number of disturbers per minute that are tolerated before the watchdog
+     * threshold and spike rejection are raised. 0 disables the adjustment.
+     */
+    void setDisturberLimit(unsigned int disturberLimit);
+
+    /**
+     * Return the number of disturbers per minute that are tolerated.
+     */
+    unsigned int getDisturberLimit() const;
+
+    /**
+     * Return the smoothed number of noise interrupts per minute.
+     */
+    unsigned int getNoiseRate() const;
+
+    /**
+     * Return the smoothed number of disturbers per minute.
+     */
+    unsigned int getDisturberRate() const;
+
+    void begin(unsigned long now, const NoiseSettings& settings) override;
+    void onInterrupt(unsigned long now, int interrupt) override;
+    bool update(unsigned long now, NoiseSettings& settings) override;
+    bool isBoosted() const override;
+    bool end(NoiseSettings& settings) override;
+
+private:
+    unsigned long recoveryTime;
+    unsigned int disturberLimit;
+    unsigned long lastTick;
+    unsigned long lastNoise;
+    unsigned long lastRaise;
+    unsigned long lastLower;
+    unsigned long lastTune;
+    unsigned int noiseCount;
+    unsigned int disturberCount;
+    long noiseRate;
+    long disturberRate;
+    unsigned int backoff;
+    int watchdogBoost;
+    int spikeBoost;
+    bool probing;
+
+    bool updateNoiseFloorLevel(unsigned long now, bool noisy, NoiseSettings& settings);
+    bool updateDisturberSettings(unsigned long now, NoiseSettings& settings);
+};
+
+#endif
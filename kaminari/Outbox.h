@@ -0,0 +1,160 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Outbox__
+#define __Outbox__
+
+#include <LittleFS.h>
+
+/**
+ * A bounded first-in, first-out queue of pending messages.
+ *
+ * Messages are kept in RAM. Optionally, messages that do not fit into RAM are spilled
+ * to a file on LittleFS. Messages are always returned in the order they were added.
+ * If the queue is full, new messages are dropped and counted.
+ *
+ * The message type must be trivially copyable, as it is written to the file as is.
+ *
+ * @param T     Message type
+ * @param N     Number of messages that are kept in RAM
+ */
+template<typename T, size_t N>
+class Outbox {
+public:
+
+    Outbox() : head(0), count(0), dropped(0), spillPath(NULL), spillCapacity(0),
+            spillRead(0), spillWrite(0) {}
+
+    /**
+     * Spill messages to a file if the RAM queue is full. LittleFS must be mounted. An
+     * existing spill file is removed, as it contains messages of a previous session.
+     *
+     * @param path      Path of the spill file
+     * @param capacity  Maximum number of messages in the spill file
+     */
+    void spill(const char* path, size_t capacity) {
+        spillPath = path;
+        spillCapacity = capacity;
+        spillRead = 0;
+        spillWrite = 0;
+        LittleFS.remove(spillPath);
+    }
+
+    /**
+     * Add a message to the end of the queue.
+     *
+     * @return true if the message was added, false if it was dropped
+     */
+    bool push(const T& message) {
+        // Once messages were spilled, all further messages must be spilled as well
+        if (count < N && spillWrite == spillRead) {
+            entries[(head + count) % N] = message;
+            count++;
+            return true;
+        }
+
+        if (spillPath != NULL && spillWrite - spillRead < spillCapacity) {
+            File file = LittleFS.open(spillPath, "a");
+            if (file) {
+                size_t written = file.write((const uint8_t*) &message, sizeof(T));
+                file.close();
+                if (written == sizeof(T)) {
+                    spillWrite++;
+                    return true;
+                }
+            }
+        }
+
+        dropped++;
+        return false;
+    }
+
+    /**
+     * Read the oldest message without removing it.
+     *
+     * @return true if there was a message, false if the queue is empty
+     */
+    bool peek(T& message) const {
+        if (count > 0) {
+            message = entries[head];
+            return true;
+        }
+
+        if (spillWrite > spillRead) {
+            File file = LittleFS.open(spillPath, "r");
+            if (file) {
+                bool success = file.seek(spillRead * sizeof(T), SeekSet)
+                        && file.read((uint8_t*) &message, sizeof(T)) == sizeof(T);
+                file.close();
+                return success;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Remove the oldest message.
+     */
+    void pop() {
+        if (count > 0) {
+            head = (head + 1) % N;
+            count--;
+        } else if (spillWrite > spillRead) {
+            spillRead++;
+            if (spillRead == spillWrite) {
+                // All spilled messages were read, start with a fresh file
+                LittleFS.remove(spillPath);
+                spillRead = 0;
+                spillWrite = 0;
+            }
+        }
+    }
+
+    /**
+     * Return the number of pending messages, including spilled messages.
+     */
+    size_t size() const {
+        return count + (spillWrite - spillRead);
+    }
+
+    /**
+     * Return the number of spilled messages.
+     */
+    size_t spilled() const {
+        return spillWrite - spillRead;
+    }
+
+    /**
+     * Return the number of messages that were dropped because the queue was full.
+     */
+    unsigned long getDropped() const {
+        return dropped;
+    }
+
+private:
+    T entries[N];
+    size_t head;
+    size_t count;
+    unsigned long dropped;
+    const char* spillPath;
+    size_t spillCapacity;
+    size_t spillRead;
+    size_t spillWrite;
+};
+
+#endif
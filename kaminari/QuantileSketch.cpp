@@ -0,0 +1,168 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "QuantileSketch.h"
+
+static const float probabilities[] = { 0.5f, 0.9f, 0.99f };
+
+static_assert(QUANTILE_EXACT_VALUES >= 5, "P² needs at least five values to start");
+
+QuantileSketch::QuantileSketch() {
+    clear();
+}
+
+void QuantileSketch::clear() {
+    count = 0;
+    min = NAN;
+    max = NAN;
+}
+
+void QuantileSketch::add(float value) {
+    if (isnan(value)) {
+        return;
+    }
+
+    // The first values are kept in order
+    if (count < QUANTILE_EXACT_VALUES) {
+        int ix = count++;
+        while (ix > 0 && values[ix - 1] > value) {
+            values[ix] = values[ix - 1];
+            ix--;
+        }
+        values[ix] = value;
+        return;
+    }
+
+    if (count == QUANTILE_EXACT_VALUES) {
+        setupMarkers();
+    }
+
+    count++;
+    if (value < min) {
+        min = value;
+    }
+    if (value > max) {
+        max = value;
+    }
+
+    for (int q = 0; q < 3; q++) {
+        Markers& m = markers[q];
+
+        // All markers above the value move up by one position
+        for (int ix = 2; ix >= 0 && value < m.heights[ix]; ix--) {
+            m.positions[ix]++;
+        }
+
+        // Desired positions of the inner markers are at p/2, p and (1+p)/2
+        float p = probabilities[q];
+        adjust(m, 0, p / 2.0f);
+        adjust(m, 1, p);
+        adjust(m, 2, (1.0f + p) / 2.0f);
+    }
+}
+
+void QuantileSketch::setupMarkers() {
+    // The markers share their memory with the values, so the values are copied first
+    float sorted[QUANTILE_EXACT_VALUES];
+    memcpy(sorted, values, sizeof(sorted));
+    const int n = QUANTILE_EXACT_VALUES;
+    min = sorted[0];
+    max = sorted[n - 1];
+
+    for (int q = 0; q < 3; q++) {
+        // Every inner marker is set to the nearest rank of its desired position, but all
+        // markers must have distinct positions between the minimum and the maximum
+        float p = probabilities[q];
+        const float fractions[] = { p / 2.0f, p, (1.0f + p) / 2.0f };
+        int lowest = 2;
+        for (int ix = 0; ix < 3; ix++) {
+            int position = (int) lroundf(1.0f + (n - 1) * fractions[ix]);
+            if (position < lowest) {
+                position = lowest;
+            }
+            if (position > n - 3 + ix) {
+                position = n - 3 + ix;
+            }
+            markers[q].heights[ix] = sorted[position - 1];
+            markers[q].positions[ix] = position;
+            lowest = position + 1;
+        }
+    }
+}
+
+void QuantileSketch::adjust(Markers& m, int index, float fraction) {
+    // The outer markers are the minimum at position 1, and the maximum at position count
+    float desired = 1.0f + (count - 1) * fraction;
+    float height = m.heights[index];
+    long position = m.positions[index];
+    float lowerHeight = index > 0 ? m.heights[index - 1] : min;
+    long lowerPosition = index > 0 ? m.positions[index - 1] : 1;
+    float upperHeight = index < 2 ? m.heights[index + 1] : max;
+    long upperPosition = index < 2 ? m.positions[index + 1] : count;
+
+    float delta = desired - position;
+    int step;
+    if (delta >= 1.0f && upperPosition - position > 1) {
+        step = 1;
+    } else if (delta <= -1.0f && lowerPosition - position < -1) {
+        step = -1;
+    } else {
+        return;
+    }
+
+    // Piecewise-parabolic prediction, or a linear one if the parabola is not monotonic
+    float parabolic = height + (float) step / (upperPosition - lowerPosition)
+            * ((position - lowerPosition + step) * (upperHeight - height) / (upperPosition - position)
+            + (upperPosition - position - step) * (height - lowerHeight) / (position - lowerPosition));
+    if (lowerHeight < parabolic && parabolic < upperHeight) {
+        m.heights[index] = parabolic;
+    } else if (step > 0) {
+        m.heights[index] = height + (upperHeight - height) / (upperPosition - position);
+    } else {
+        m.heights[index] = height - (lowerHeight - height) / (lowerPosition - position);
+    }
+    m.positions[index] = position + step;
+}
+
+float QuantileSketch::getMin() const {
+    if (count == 0) {
+        return NAN;
+    }
+    return count <= QUANTILE_EXACT_VALUES ? values[0] : min;
+}
+
+float QuantileSketch::getMax() const {
+    if (count == 0) {
+        return NAN;
+    }
+    return count <= QUANTILE_EXACT_VALUES ? values[count - 1] : max;
+}
+
+float QuantileSketch::getQuantile(Quantile quantile) const {
+    if (count == 0) {
+        return NAN;
+    }
+    if (count <= QUANTILE_EXACT_VALUES) {
+        // Nearest rank of the kept values
+        int rank = (int) ceilf(probabilities[quantile] * count) - 1;
+        return values[rank < 0 ? 0 : rank];
+    }
+    return markers[quantile].heights[1];
+}
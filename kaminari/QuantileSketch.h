@@ -0,0 +1,106 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __QuantileSketch__
+#define __QuantileSketch__
+
+#include <stdint.h>
+
+#define QUANTILE_EXACT_VALUES 16    // Values that are kept before the estimation starts
+
+/**
+ * Quantiles that are estimated by a QuantileSketch.
+ */
+enum Quantile {
+    QUANTILE_50,
+    QUANTILE_90,
+    QUANTILE_99,
+};
+
+/**
+ * Estimates the median, the 90th and the 99th percentile of a stream of values, using
+ * the P² algorithm of Jain and Chlamtac.
+ *
+ * Every quantile is tracked by five markers, whose heights are adjusted with a
+ * piecewise-parabolic interpolation as values are added. The outer markers are the
+ * minimum and maximum, and are shared by all quantiles. The values themselves are not
+ * kept, so the memory consumption is constant, and adding a value is O(1).
+ *
+ * P² is inaccurate for few values, so the first QUANTILE_EXACT_VALUES values are kept
+ * in the memory of the markers, and the quantiles are exact until then. The markers are
+ * then set up at the ranks of the kept values.
+ */
+class QuantileSketch {
+public:
+    QuantileSketch();
+
+    /**
+     * Add a value.
+     */
+    void add(float value);
+
+    /**
+     * Remove all values.
+     */
+    void clear();
+
+    /**
+     * Return the number of values that were added since the last clear().
+     */
+    unsigned long getCount() const          { return count; }
+
+    /**
+     * Return the smallest value, or NAN if there are no values.
+     */
+    float getMin() const;
+
+    /**
+     * Return the largest value, or NAN if there are no values.
+     */
+    float getMax() const;
+
+    /**
+     * Return the estimated quantile, or NAN if there are no values.
+     */
+    float getQuantile(Quantile quantile) const;
+
+private:
+    struct Markers {
+        float heights[3];           // heights of the inner markers
+        uint32_t positions[3];      // positions of the inner markers, starting from 1
+    };
+
+    union {
+        Markers markers[3];
+        float values[QUANTILE_EXACT_VALUES];    // the first values, in ascending order
+    };
+    float min;
+    float max;
+    unsigned long count;
+
+    /**
+     * Set up the markers from the kept values.
+     */
+    void setupMarkers();
+
+    /**
+     * Move an inner marker towards its desired position, if it is off by one or more.
+     */
+    void adjust(Markers& m, int index, float fraction);
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __RateCounter__
+#define __RateCounter__
+
+#include <stdint.h>
+
+#define RATE_BUCKET_TIME 15000      // Time covered by a bucket, in ms
+#define RATE_BUCKETS 61             // 15 minutes, and one bucket that is leaving the window
+
+/**
+ * Time windows of a RateCounter.
+ */
+enum RateWindow {
+    RATE_1_MIN,
+    RATE_5_MIN,
+    RATE_15_MIN,
+};
+
+/**
+ * Counts events in sliding windows of 1, 5 and 15 minutes.
+ *
+ * Events are counted in 15 second buckets. The running sum of every window is kept up
+ * to date, so adding an event is O(1), and so is moving to the next bucket. The bucket
+ * that is about to leave a window is weighted by the part that is still inside the
+ * window, so the counts drop smoothly instead of in 15 second steps.
+ *
+ * The memory consumption is constant. If no events are added for a while, expired
+ * buckets are cleared on the next access.
+ */
+class RateCounter {
+public:
+    RateCounter() {
+        clear(0);
+    }
+
+    /**
+     * Remove all events.
+     *
+     * @param now   Current time, in ms
+     */
+    void clear(unsigned long now) {
+        for (int ix = 0; ix < RATE_BUCKETS; ix++) {
+            buckets[ix] = 0;
+        }
+        for (int ix = 0; ix < 3; ix++) {
+            sums[ix] = 0;
+        }
+        current = 0;
+        bucketStart = now;
+    }
+
+    /**
+     * Count an event.
+     *
+     * @param now   Current time, in ms
+     */
+    void add(unsigned long now) {
+        advance(now);
+        if (buckets[current] < UINT16_MAX) {
+            buckets[current]++;
+            for (int ix = 0; ix < 3; ix++) {
+                sums[ix]++;
+            }
+        }
+    }
+
+    /**
+     * Return the number of events within the given window.
+     *
+     * @param window    Time window
+     * @param now       Current time, in ms
+     */
+    unsigned int getCount(RateWindow window, unsigned long now) const {
+        advance(now);
+        unsigned long elapsed = now - bucketStart;
+        unsigned int leaving = buckets[(current + RATE_BUCKETS - getWindowBuckets(window)) % RATE_BUCKETS];
+        return sums[window] + (leaving * (RATE_BUCKET_TIME - elapsed)) / RATE_BUCKET_TIME;
+    }
+
+private:
+    mutable uint16_t buckets[RATE_BUCKETS];
+    mutable unsigned int sums[3];
+    mutable int current;
+    mutable unsigned long bucketStart;
+
+    static int getWindowBuckets(int window) {
+        static const int windowBuckets[3] = { 4, 20, 60 };
+        return windowBuckets[window];
+    }
+
+    /**
+     * Move to the bucket of the given time, and remove the buckets that left a window.
+     */
+    void advance(unsigned long now) const {
+        unsigned long passed = (now - bucketStart) / RATE_BUCKET_TIME;
+        if (passed == 0) {
+            return;
+        }
+        bucketStart += passed * RATE_BUCKET_TIME;
+        if (passed > RATE_BUCKETS) {
+            passed = RATE_BUCKETS;
+        }
+        while (passed-- > 0) {
+            current = (current + 1) % RATE_BUCKETS;
+            for (int ix = 0; ix < 3; ix++) {
+                sums[ix] -= buckets[(current + RATE_BUCKETS - getWindowBuckets(ix)) % RATE_BUCKETS];
+            }
+            buckets[current] = 0;
+        }
+    }
+};
+
+#endif
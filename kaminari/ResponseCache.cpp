@@ -0,0 +1,132 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+
+#include "ResponseCache.h"
+
+#define INITIAL_CAPACITY 512
+
+CachedResponse::CachedResponse() {
+    this->etag[0] = '\0';
+    this->contentType = NULL;
+    this->created = 0;
+    this->used = 0;
+    this->data = NULL;
+    this->length = 0;
+    this->capacity = 0;
+    this->overflow = false;
+}
+
+size_t CachedResponse::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t CachedResponse::write(const uint8_t* data, size_t size) {
+    if (overflow) {
+        return 0;
+    }
+    if (length + size > capacity) {
+        // Grow by doubling, so a body needs only a few reallocations
+        size_t newCapacity = capacity > 0 ? capacity : INITIAL_CAPACITY;
+        while (newCapacity < length + size) {
+            newCapacity *= 2;
+        }
+        if (newCapacity > RESPONSE_CACHE_MAX_SIZE) {
+            newCapacity = RESPONSE_CACHE_MAX_SIZE;
+        }
+        uint8_t* newData = length + size <= newCapacity ? (uint8_t*) realloc(this->data, newCapacity) : NULL;
+        if (newData == NULL) {
+            overflow = true;
+            release();
+            return 0;
+        }
+        this->data = newData;
+        this->capacity = newCapacity;
+    }
+    memcpy(this->data + length, data, size);
+    length += size;
+    return size;
+}
+
+void CachedResponse::release() {
+    free(data);
+    data = NULL;
+    length = 0;
+    capacity = 0;
+}
+
+ResponseCache::ResponseCache() {
+    this->hits = 0;
+    this->misses = 0;
+}
+
+const CachedResponse* ResponseCache::get(const char* etag, unsigned long maxAge) {
+    unsigned long now = millis();
+    for (int ix = 0; ix < RESPONSE_CACHE_ENTRIES; ix++) {
+        CachedResponse& entry = entries[ix];
+        if (entry.data != NULL && !entry.overflow && strcmp(entry.etag, etag) == 0
+                && now - entry.created <= maxAge) {
+            entry.used = now;
+            hits++;
+            return &entry;
+        }
+    }
+    misses++;
+    return NULL;
+}
+
+CachedResponse& ResponseCache::put(const char* etag, const char* contentType) {
+    unsigned long now = millis();
+
+    // Replace the body with the same ETag, or an unused one, or the least recently used
+    CachedResponse* victim = NULL;
+    for (int ix = 0; ix < RESPONSE_CACHE_ENTRIES && victim == NULL; ix++) {
+        if (strcmp(entries[ix].etag, etag) == 0) {
+            victim = &entries[ix];
+        }
+    }
+    for (int ix = 0; ix < RESPONSE_CACHE_ENTRIES && victim == NULL; ix++) {
+        if (entries[ix].etag[0] == '\0') {
+            victim = &entries[ix];
+        }
+    }
+    if (victim == NULL) {
+        victim = &entries[0];
+        for (int ix = 1; ix < RESPONSE_CACHE_ENTRIES; ix++) {
+            if (now - entries[ix].used > now - victim->used) {
+                victim = &entries[ix];
+            }
+        }
+    }
+
+    victim->release();
+    strncpy(victim->etag, etag, sizeof(victim->etag) - 1);
+    victim->etag[sizeof(victim->etag) - 1] = '\0';
+    victim->contentType = contentType;
+    victim->created = now;
+    victim->used = now;
+    victim->overflow = false;
+    return *victim;
+}
+
+void ResponseCache::clear() {
+    for (int ix = 0; ix < RESPONSE_CACHE_ENTRIES; ix++) {
+        entries[ix].release();
+        entries[ix].etag[0] = '\0';
+    }
+}
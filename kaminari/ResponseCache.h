@@ -0,0 +1,113 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __ResponseCache__
+#define __ResponseCache__
+
+#include <Arduino.h>
+
+#define RESPONSE_CACHE_ENTRIES     4    // Number of cached response bodies
+#define RESPONSE_CACHE_MAX_SIZE 5120    // Larger bodies are not cached
+#define RESPONSE_CACHE_ETAG_SIZE  40    // Maximum length of an ETag, including the terminator
+
+/**
+ * A rendered response body in the ResponseCache. The body is written to it like to any
+ * other Print.
+ */
+class CachedResponse : public Print {
+public:
+    CachedResponse();
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t* data, size_t size) override;
+
+    using Print::write;
+
+    const char* getETag() const             { return etag; }
+    const char* getContentType() const      { return contentType; }
+    const uint8_t* getData() const          { return data; }
+    size_t getLength() const                { return length; }
+
+    /**
+     * Check if the body was completely written. If it exceeded RESPONSE_CACHE_MAX_SIZE
+     * or the memory was exhausted, it is incomplete and must not be sent.
+     */
+    bool isComplete() const                 { return !overflow; }
+
+private:
+    friend class ResponseCache;
+
+    char etag[RESPONSE_CACHE_ETAG_SIZE];
+    const char* contentType;
+    unsigned long created;
+    unsigned long used;
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+    bool overflow;
+
+    void release();
+};
+
+/**
+ * Keeps rendered response bodies, so unchanged responses are not rendered again on
+ * every request.
+ *
+ * The bodies are identified by their ETag, which must contain everything the body
+ * depends on, usually a generation counter of the state. If the cache is full, the
+ * least recently used body is evicted. All bodies are dropped by clear(), which should
+ * be invoked when the generation changes, so memory is not wasted by outdated bodies.
+ */
+class ResponseCache {
+public:
+    ResponseCache();
+
+    /**
+     * Find a cached body.
+     *
+     * @param etag      ETag of the body
+     * @param maxAge    Maximum time since the body was rendered, in ms
+     * @return Cached body, or NULL if there is no complete body that is young enough
+     */
+    const CachedResponse* get(const char* etag, unsigned long maxAge);
+
+    /**
+     * Start a new body. The previous body with the same ETag, or the least recently
+     * used body, is replaced. The returned body is valid until the next put() or clear().
+     *
+     * @param etag          ETag of the body
+     * @param contentType   Content type of the body, must be a constant
+     * @return Body to write to
+     */
+    CachedResponse& put(const char* etag, const char* contentType);
+
+    /**
+     * Drop all bodies.
+     */
+    void clear();
+
+    unsigned long getHits() const           { return hits; }
+    unsigned long getMisses() const         { return misses; }
+
+private:
+    CachedResponse entries[RESPONSE_CACHE_ENTRIES];
+    unsigned long hits;
+    unsigned long misses;
+};
+
+#endif
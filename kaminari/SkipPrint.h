@@ -0,0 +1,62 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SkipPrint__
+#define __SkipPrint__
+
+#include <Arduino.h>
+
+/**
+ * Passes everything to another Print, except for the given number of leading bytes.
+ *
+ * This is used to stream the members of a serialized document into an enclosing
+ * document, without the opening brace or map header of the serialized document.
+ */
+class SkipPrint : public Print {
+public:
+
+    /**
+     * Create a new SkipPrint.
+     *
+     * @param out       Print to pass the bytes to
+     * @param skip      Number of leading bytes to drop
+     */
+    SkipPrint(Print& out, size_t skip) : out(out), skip(skip) {}
+
+    size_t write(uint8_t c) override {
+        if (skip > 0) {
+            skip--;
+            return 1;
+        }
+        return out.write(c);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        size_t skipped = size < skip ? size : skip;
+        skip -= skipped;
+        if (size == skipped) {
+            return size;
+        }
+        return skipped + out.write(buffer + skipped, size - skipped);
+    }
+
+private:
+    Print& out;
+    size_t skip;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+
+#include "StormTracker.h"
+
+#define STORM_TIMEOUT       1800000     // Time without lightning until a storm is over (ms)
+#define STORM_DECAY_TIME      600.0f    // Time constant of the distance regression (s)
+#define STORM_FAST_TIME       300.0f    // Time constant of the current strike rate (s)
+#define STORM_SLOW_TIME       900.0f    // Time constant of the long-term strike rate (s)
+#define STORM_MIN_STRIKES          3    // Minimum lightnings in range for a speed estimate
+#define STORM_MIN_SPAN         30000    // Minimum time span of these lightnings (ms)
+#define STORM_MIN_SPEED         1.0f    // Minimum approach speed for an ETA (km/h)
+#define STORM_TREND_BAND        0.5f    // Rate change that is considered a trend
+#define STORM_OVERHEAD          1.0f    // Distance that is reported for overhead storms
+
+StormTracker::StormTracker() {
+    clear();
+}
+
+void StormTracker::clear() {
+    lastTime = 0;
+    strikes = 0;
+    closest = -1;
+    latest = -1;
+    ranged = 0;
+    firstRanged = 0;
+    weight = 0.0f;
+    sumT = 0.0f;
+    sumD = 0.0f;
+    sumTT = 0.0f;
+    sumTD = 0.0f;
+    fastCount = 0.0f;
+    slowCount = 0.0f;
+}
+
+void StormTracker::add(unsigned long time, unsigned int distance) {
+    if (strikes > 0 && (long) (time - lastTime) > STORM_TIMEOUT) {
+        // the previous storm is over
+        clear();
+    }
+
+    if (strikes > 0) {
+        // Move the time origin to the new lightning, and decay the old values. Lightnings
+        // that are slightly out of order are treated as simultaneous.
+        float dt = (long) (time - lastTime) > 0 ? (time - lastTime) / 1000.0f : 0.0f;
+        float decay = expf(-dt / STORM_DECAY_TIME);
+        sumTT = (sumTT - 2.0f * dt * sumT + dt * dt * weight) * decay;
+        sumTD = (sumTD - dt * sumD) * decay;
+        sumT = (sumT - dt * weight) * decay;
+        sumD *= decay;
+        weight *= decay;
+        fastCount *= expf(-dt / STORM_FAST_TIME);
+        slowCount *= expf(-dt / STORM_SLOW_TIME);
+        if (dt > 0.0f) {
+            lastTime = time;
+        }
+    } else {
+        lastTime = time;
+    }
+
+    fastCount += 1.0f;
+    slowCount += 1.0f;
+    if (strikes < UINT16_MAX) {
+        strikes++;
+    }
+
+    if (distance < 0x3F) {
+        // The new lightning is at t = 0, so only the weight and distance sums change
+        weight += 1.0f;
+        sumD += distance;
+        latest = distance;
+        if (ranged == 0) {
+            firstRanged = time;
+        }
+        if (ranged < UINT16_MAX) {
+            ranged++;
+        }
+        if (closest < 0 || (int) distance < closest) {
+            closest = distance;
+        }
+    }
+}
+
+void StormTracker::getStatus(unsigned long now, StormStatus& status) const {
+    float age = (long) (now - lastTime) > 0 ? (now - lastTime) / 1000.0f : 0.0f;
+
+    status.active = strikes > 0 && age * 1000.0f <= STORM_TIMEOUT;
+    status.strikes = strikes;
+    status.closest = closest;
+    status.distance = NAN;
+    status.speed = NAN;
+    status.eta = -1;
+    status.trend = STORM_STEADY;
+    status.rate = 0.0f;
+
+    if (!status.active) {
+        return;
+    }
+
+    // A decayed count divided by its time constant is a rate
+    float fastRate = fastCount * expf(-age / STORM_FAST_TIME) / STORM_FAST_TIME;
+    float slowRate = slowCount * expf(-age / STORM_SLOW_TIME) / STORM_SLOW_TIME;
+    status.rate = fastRate * 60.0f;
+    if (strikes >= 3) {
+        if (fastRate > slowRate * (1.0f + STORM_TREND_BAND)) {
+            status.trend = STORM_INCREASING;
+        } else if (fastRate < slowRate * (1.0f - STORM_TREND_BAND)) {
+            status.trend = STORM_DECREASING;
+        }
+    }
+
+    if (weight <= 0.0f) {
+        // all lightnings were out of range
+        return;
+    }
+
+    // Without a trend, the latest distance is the best guess of the current distance
+    status.distance = latest;
+
+    float variance = weight * sumTT - sumT * sumT;
+    if (ranged < STORM_MIN_STRIKES || (long) (lastTime - firstRanged) < STORM_MIN_SPAN
+            || !(variance > 0.0f)) {
+        // too few lightnings, or too close in time for a trend
+        return;
+    }
+
+    float slope = (weight * sumTD - sumT * sumD) / variance;     // km/s
+    float distance = (sumD - slope * sumT) / weight + slope * age;
+    status.distance = distance > STORM_OVERHEAD ? distance : STORM_OVERHEAD;
+    status.speed = -slope * 3600.0f;
+    if (status.speed >= STORM_MIN_SPEED) {
+        status.eta = lroundf((status.distance - STORM_OVERHEAD) / -slope);
+    }
+}
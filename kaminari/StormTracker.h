@@ -0,0 +1,105 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __StormTracker__
+#define __StormTracker__
+
+#include <stdint.h>
+
+/**
+ * Trend of the strike rate.
+ */
+enum StormTrend {
+    STORM_DECREASING = -1,      // the strike rate is falling
+    STORM_STEADY = 0,           // the strike rate is steady, or there is no storm
+    STORM_INCREASING = 1,       // the strike rate is rising
+};
+
+/**
+ * Summary of the current storm. Values that cannot be estimated are NAN, or -1 for
+ * integer values.
+ */
+struct StormStatus {
+    bool active;                // a lightning was detected within the storm timeout
+    int8_t trend;               // StormTrend of the strike rate
+    uint16_t strikes;           // number of lightnings of this storm
+    int16_t closest;            // closest distance of a lightning, in km
+    float distance;             // estimated current distance of the storm, in km
+    float speed;                // approach speed, in km/h, negative if departing
+    float rate;                 // current strike rate, in lightnings per minute
+    long eta;                   // estimated time until the storm is overhead, in s
+};
+
+/**
+ * Tracks the movement of a storm.
+ *
+ * Every lightning is added incrementally, in O(1) time and constant memory. The
+ * distance over time is fitted by a linear regression with exponentially decaying
+ * weights, so recent lightnings count more than older ones. The regression sums are
+ * kept relative to the time of the last lightning, and are shifted and decayed when a
+ * new lightning is added, so they stay small enough for float precision.
+ *
+ * The strike rate is tracked by two decaying counters with a short and a long time
+ * constant. The trend compares both rates.
+ *
+ * The speed is only estimated when at least three lightnings in range span at least
+ * 30 seconds. Until then, the distance of the latest lightning is reported.
+ *
+ * A new storm starts when there was no lightning for 30 minutes.
+ */
+class StormTracker {
+public:
+    StormTracker();
+
+    /**
+     * Add a lightning.
+     *
+     * @param time      Time of the lightning, in ms
+     * @param distance  Estimated distance, in km, or 0x3F if out of range
+     */
+    void add(unsigned long time, unsigned int distance);
+
+    /**
+     * Forget the current storm.
+     */
+    void clear();
+
+    /**
+     * Return the summary of the current storm.
+     *
+     * @param now       Current time, in ms
+     * @param status    Target structure
+     */
+    void getStatus(unsigned long now, StormStatus& status) const;
+
+private:
+    unsigned long lastTime;
+    uint16_t strikes;
+    int16_t closest;
+    int16_t latest;             // distance of the latest lightning in range, in km
+    uint16_t ranged;            // number of lightnings in range
+    unsigned long firstRanged;  // time of the first lightning in range
+    float weight;               // regression sums, with t in s relative to lastTime
+    float sumT;
+    float sumD;
+    float sumTT;
+    float sumTD;
+    float fastCount;            // decayed lightning counts at lastTime
+    float slowCount;
+};
+
+#endif
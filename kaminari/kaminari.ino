@@ -19,13 +19,24 @@
 #include <ArduinoJson.h>
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
-#include <ESP8266WebServer.h>
 #include <ESP8266mDNS.h>
 #include <Adafruit_NeoPixel.h>
 #include <PubSubClient.h>
+#include <LittleFS.h>
+#include <time.h>
 
 #include "AS3935.h"
+#include "CaptureRing.h"
+#include "ChunkedResponse.h"
 #include "Config.h"
+#include "EventLog.h"
+#include "EventStream.h"
+#include "HttpServer.h"
+#include "LedAnimation.h"
+#include "Metrics.h"
+#include "Outbox.h"
+#include "ResponseCache.h"
+#include "SkipPrint.h"
 #include "myWiFi.h"
 
 #define SPI_CS   15     // IO15 (D8)
@@ -41,33 +52,332 @@
 #define COLOR_CALIBRATING  0x00404000
 #define COLOR_BLACK        0x00000000
 
-#define DISTANCE_ANIMATION_TIME 5000
-#define ENERGY_ANIMATION_TIME    500
-#define DISTURBER_ANIMATION_TIME 1000
+#define MQTT_OUTBOX_SIZE          32    // MQTT messages kept in RAM while disconnected
+#define MQTT_OUTBOX_SPILL_SIZE  1024    // MQTT messages spilled to flash, if enabled
+#define MQTT_PUBLISH_INTERVAL    200    // Minimum time between two MQTT messages
+#define MQTT_BUFFER_SIZE        1024    // Maximum size of a MQTT message
+
+#define HISTORY_LIMIT           1000    // Default maximum number of /history records
+#define HISTORY_BATCH             32    // /history records that are sent in one step
+#define VALID_TIME        1577836800    // Earliest valid time, the clock is not set before
+#define STATUS_CACHE_TIME       1000    // Maximum age of a cached /status body, in ms
+#define STATUS_BATCH              16    // /status lightnings that are sent in one step
+
+#define MAX_ROUTES                12    // Maximum number of routes with metrics
+
+/**
+ * Detector status at the time of an event, to be published via MQTT.
+ */
+struct MqttStatus {
+    unsigned long time;
+    unsigned long tuning;
+    unsigned long energy : 24;
+    unsigned long distance : 8;
+    unsigned long lightningTime;
+    unsigned long seq;
+    bool hasLightning;
+    int noiseFloorLevel;
+    unsigned int disturbersPerMinute;
+    int watchdogThreshold;
+    long wifiSignalStrength;
+    uint16_t rates[3][3];
+    float quantiles[3][3];
+    uint8_t detector;
+    StormStatus storm;
+};
+
+/**
+ * Position of a /history response, which is sent in batches.
+ */
+struct HistoryCursor {
+    uint32_t from;          // time of the last record that was sent
+    uint32_t to;
+    size_t remaining;       // number of records that may still be sent
+    size_t sent;            // number of records with the time "from" that were sent
+    bool first;
+};
+
+/**
+ * Position of a /status response, which is sent in batches if it is too large for the
+ * response cache.
+ */
+struct StatusCursor {
+    AS3935* sensor;
+    unsigned long now;          // time of the request, for the ages of the lightnings
+    unsigned long sequence;     // sequence number of the latest lightning at that time
+    unsigned long next;         // sequence number of the next lightning to be sent
+    size_t remaining;           // number of lightnings that are still to be sent
+    bool truncated;
+    bool msgPack;
+};
 
 ConfigManager cfgMgr;
-ESP8266WebServer server(PORT);
+HttpServer server(PORT);
 AS3935 detector(SPI_CS, AS_INT);
+#ifdef MY_DETECTOR_2_PINS
+AS3935 detector2(MY_DETECTOR_2_PINS);
+#endif
+#ifdef MY_DETECTOR_3_PINS
+AS3935 detector3(MY_DETECTOR_3_PINS);
+#endif
+AS3935* detectors[] = {
+    &detector,
+    #ifdef MY_DETECTOR_2_PINS
+    &detector2,
+    #endif
+    #ifdef MY_DETECTOR_3_PINS
+    &detector3,
+    #endif
+};
+const int configuredDetectors = sizeof(detectors) / sizeof(detectors[0]);
+int detectorCount = configuredDetectors;
+AdaptiveNoiseController adaptiveNoiseControllers[configuredDetectors];
 Adafruit_NeoPixel neopixel(1, NEOPIXEL, NEO_GRBW + NEO_KHZ800);
+LedAnimation animation;
+EventStream eventStream;
+EventLog eventLog;
+ResponseCache responseCache;
+CaptureRing captureRing;
+Outbox<MqttStatus, MQTT_OUTBOX_SIZE> mqttOutbox;
 WiFiClient wifiClient;
 PubSubClient client(MY_MQTT_SERVER_HOST, MY_MQTT_SERVER_PORT, wifiClient);
 WiFiEventHandler connectedEventHandler, gotIpEventHandler, disconnectedEventHandler;
 
 unsigned long beforeAnimation = millis();
 unsigned long beforeMqttConnection = millis();
+unsigned long beforeMqttPublish = millis();
 bool connected = false;
+bool setupPending = false;
 unsigned int currentColor = 0;
-Lightning ledLightning;
+
+Histogram loopDuration;
+Histogram updateDuration;
+Histogram colorDuration;
+Histogram routeDurations[MAX_ROUTES];
+const char* routes[MAX_ROUTES];
+int routeCount = 0;
+unsigned long mqttPublishFailures = 0;
+uint32_t generation = 0;
+unsigned long notModified = 0;
 
 inline static unsigned long timeDifference(unsigned long now, unsigned long past) {
     // This is actually safe from millis() overflow because all types are unsigned long!
     return past > 0 ? (now - past) : 0;
 }
 
-void sendJsonResponse(ArduinoJson::JsonDocument &doc, int status = 200) {
-    String json;
-    serializeJson(doc, json);
-    server.send(status, "application/json", json);
+void stateChanged() {
+    // All rendered responses are outdated now
+    generation++;
+    responseCache.clear();
+}
+
+bool acceptsMsgPack() {
+    // JSON is the default, MessagePack must be requested explicitly
+    if (server.arg("format") == "msgpack") {
+        return true;
+    }
+    String accept = server.header("Accept");
+    return accept.indexOf("application/msgpack") >= 0
+        || accept.indexOf("application/x-msgpack") >= 0;
+}
+
+void sendResponse(ArduinoJson::JsonDocument &doc, int status = 200) {
+    ChunkedResponse response(server);
+    if (acceptsMsgPack()) {
+        response.begin(status, "application/msgpack");
+        serializeMsgPack(doc, response);
+    } else {
+        response.begin(status, "application/json");
+        serializeJson(doc, response);
+    }
+    response.end();
+}
+
+void sendCachedResponse(const CachedResponse &response) {
+    server.sendHeader("ETag", response.getETag());
+    server.send(200, response.getContentType(), (const char*) response.getData(), response.getLength());
+}
+
+bool sendCached(const char* etag, unsigned long maxAge) {
+    // If-None-Match always uses the weak comparison
+    String match = server.header("If-None-Match");
+    const char* tag = strncmp(etag, "W/", 2) == 0 ? etag + 2 : etag;
+    if (match == "*" || match.indexOf(tag) >= 0) {
+        notModified++;
+        server.sendHeader("ETag", etag);
+        server.send(304);
+        return true;
+    }
+
+    const CachedResponse* cached = responseCache.get(etag, maxAge);
+    if (cached != NULL) {
+        sendCachedResponse(*cached);
+        return true;
+    }
+    return false;
+}
+
+void sendJsonMembers(ArduinoJson::JsonDocument &doc, Print &out) {
+    // Stream the document's members, without the leading brace of the object
+    SkipPrint members(out, 1);
+    serializeJson(doc, members);
+}
+
+void writeMsgPackHeader(Print &out, uint8_t fixType, uint8_t type16, size_t size) {
+    if (size < 16) {
+        out.write((uint8_t) (fixType | size));
+    } else {
+        out.write(type16);
+        out.write((uint8_t) (size >> 8));
+        out.write((uint8_t) size);
+    }
+}
+
+void writeMsgPackMap(Print &out, size_t size) {
+    writeMsgPackHeader(out, 0x80, 0xDE, size);
+}
+
+void writeMsgPackArray(Print &out, size_t size) {
+    writeMsgPackHeader(out, 0x90, 0xDC, size);
+}
+
+void writeMsgPackKey(Print &out, const char* key) {
+    // keys are always shorter than 32 characters, so a fixstr is sufficient
+    size_t length = strlen(key);
+    out.write((uint8_t) (0xA0 | length));
+    out.write((const uint8_t*) key, length);
+}
+
+void sendMsgPackMembers(ArduinoJson::JsonDocument &doc, Print &out) {
+    // Stream the document's members, without the map header
+    size_t size = doc.size();
+    SkipPrint members(out, size < 16 ? 1 : size <= 0xFFFF ? 3 : 5);
+    serializeMsgPack(doc, members);
+}
+
+int detectorIndex(const AS3935& sensor) {
+    for (int ix = 0; ix < detectorCount; ix++) {
+        if (detectors[ix] == &sensor) {
+            return ix;
+        }
+    }
+    return 0;
+}
+
+AS3935* selectDetector() {
+    // The first detector is used unless another one is selected by parameter
+    if (!server.hasArg("detector")) {
+        return detectors[0];
+    }
+    long index = server.arg("detector").toInt();
+    if (index < 0 || index >= detectorCount) {
+        server.send(404, "text/plain", "No such detector\n");
+        return NULL;
+    }
+    return detectors[index];
+}
+
+bool isCalibrating() {
+    for (int ix = 0; ix < detectorCount; ix++) {
+        if (detectors[ix]->isCalibrating()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void readRates(const AS3935& sensor, uint16_t rates[3][3]) {
+    for (int window = 0; window < 3; window++) {
+        rates[0][window] = sensor.getLightningCount((RateWindow) window);
+        rates[1][window] = sensor.getDisturberCount((RateWindow) window);
+        rates[2][window] = sensor.getNoiseCount((RateWindow) window);
+    }
+}
+
+void readQuantiles(const AS3935& sensor, float quantiles[3][3]) {
+    const QuantileSketch* sketches[] = {
+        &sensor.getEnergyQuantiles(), &sensor.getDistanceQuantiles(), &sensor.getNoiseFloorQuantiles()
+    };
+    for (int type = 0; type < 3; type++) {
+        for (int quantile = 0; quantile < 3; quantile++) {
+            quantiles[type][quantile] = sketches[type]->getQuantile((Quantile) quantile);
+        }
+    }
+}
+
+void addQuantiles(ArduinoJson::JsonDocument &doc, const float quantiles[3][3]) {
+    // Median, 90th and 99th percentile since the quantiles were cleared, null if unknown
+    const char* names[] = { "energy", "distance", "noiseFloorLevel" };
+    JsonObject object = doc.createNestedObject("quantiles");
+    for (int type = 0; type < 3; type++) {
+        JsonArray array = object.createNestedArray(names[type]);
+        for (int quantile = 0; quantile < 3; quantile++) {
+            float value = quantiles[type][quantile];
+            if (!isnan(value)) {
+                array.add(round(value * 10.0) / 10.0);
+            } else {
+                array.add((char*) NULL);
+            }
+        }
+    }
+}
+
+void addSketch(JsonObject object, const QuantileSketch &sketch) {
+    // Values are null as long as nothing was added
+    const char* names[] = { "min", "max", "p50", "p90", "p99" };
+    float values[] = {
+        sketch.getMin(), sketch.getMax(), sketch.getQuantile(QUANTILE_50),
+        sketch.getQuantile(QUANTILE_90), sketch.getQuantile(QUANTILE_99)
+    };
+    object["count"] = sketch.getCount();
+    for (int ix = 0; ix < 5; ix++) {
+        if (!isnan(values[ix])) {
+            object[names[ix]] = round(values[ix] * 10.0) / 10.0;
+        } else {
+            object[names[ix]] = (char*) NULL;
+        }
+    }
+}
+
+void addStorm(JsonObject object, const StormStatus &storm) {
+    // Values that cannot be estimated yet are null
+    const char* trends[] = { "decreasing", "steady", "increasing" };
+    object["active"] = storm.active;
+    object["strikes"] = storm.strikes;
+    if (storm.closest >= 0) {
+        object["closest"] = storm.closest;
+    } else {
+        object["closest"] = (char*) NULL;
+    }
+    if (!isnan(storm.distance)) {
+        object["distance"] = round(storm.distance * 10.0) / 10.0;
+    } else {
+        object["distance"] = (char*) NULL;
+    }
+    if (!isnan(storm.speed)) {
+        object["speed"] = round(storm.speed * 10.0) / 10.0;
+    } else {
+        object["speed"] = (char*) NULL;
+    }
+    if (storm.eta >= 0) {
+        object["eta"] = storm.eta;
+    } else {
+        object["eta"] = (char*) NULL;
+    }
+    object["rate"] = round(storm.rate * 100.0) / 100.0;
+    object["trend"] = trends[storm.trend + 1];
+}
+
+void addRates(ArduinoJson::JsonDocument &doc, const uint16_t rates[3][3]) {
+    // Number of events within the last 1, 5 and 15 minutes
+    const char* names[] = { "lightnings", "disturbers", "noise" };
+    JsonObject object = doc.createNestedObject("rates");
+    for (int type = 0; type < 3; type++) {
+        JsonArray array = object.createNestedArray(names[type]);
+        for (int window = 0; window < 3; window++) {
+            array.add(rates[type][window]);
+        }
+    }
 }
 
 bool authenticated() {
@@ -82,67 +392,460 @@ bool authenticated() {
 }
 
 void handleStatus() {
-    DynamicJsonDocument doc(8192);
+    AS3935* sensor = selectDetector();
+    if (sensor == NULL) {
+        return;
+    }
 
-    unsigned long now = millis();
+    bool msgPack = acceptsMsgPack();
 
-    JsonArray la = doc.createNestedArray("lightnings");
-    Lightning lightning;
-    for (int ix = 0; ; ix++) {
-        if (!detector.getLastLightningDetection(ix, lightning)) {
+    // Only return lightnings that are newer than the given cursor
+    const AS3935History& history = sensor->getLightnings();
+    unsigned long since = 0;
+    bool truncated = false;
+    if (server.hasArg("since")) {
+        since = strtoul(server.arg("since").c_str(), NULL, 10);
+        if (since > history.getSequence()) {
+            // cursor is from before a reboot, start all over again
+            since = 0;
+            truncated = true;
+        } else {
+            truncated = history.isOverwritten(since);
+        }
+    }
+
+    // Ages and rates change with the time, so the ETag is weak, and contains the time
+    // slot of STATUS_CACHE_TIME. The cached body is only used within that slot, too.
+    char etag[RESPONSE_CACHE_ETAG_SIZE];
+    snprintf(etag, sizeof(etag), "W/\"%08lx-%d-%lu%s-%lx-%c\"", (unsigned long) generation,
+            detectorIndex(*sensor), since, truncated ? "t" : "",
+            millis() / STATUS_CACHE_TIME, msgPack ? 'm' : 'j');
+    if (sendCached(etag, STATUS_CACHE_TIME)) {
+        return;
+    }
+
+    CachedResponse& response = responseCache.put(etag, msgPack ? "application/msgpack" : "application/json");
+    writeStatus(response, *sensor, since, truncated, msgPack);
+    if (response.isComplete()) {
+        sendCachedResponse(response);
+    } else {
+        // Too large for the cache, so it is rendered again, and the lightnings are
+        // streamed in batches, as fast as the client receives them
+        StatusCursor cursor;
+        startStatus(cursor, *sensor, since, truncated, msgPack);
+        ChunkedResponse chunked(server);
+        chunked.begin(200, response.getContentType());
+        writeStatusHead(chunked, cursor);
+        chunked.flush();
+        server.stream([cursor]() mutable {
+            return streamStatus(cursor);
+        });
+    }
+}
+
+bool streamStatus(StatusCursor &cursor) {
+    ChunkedResponse response(server);
+    if (writeStatusLightnings(response, cursor, STATUS_BATCH)) {
+        response.flush();
+        return true;
+    }
+    writeStatusTail(response, cursor);
+    response.end();
+    return false;
+}
+
+void writeStatus(Print &response, AS3935 &sensor, unsigned long since, bool truncated, bool msgPack) {
+    StatusCursor cursor;
+    startStatus(cursor, sensor, since, truncated, msgPack);
+    writeStatusHead(response, cursor);
+    writeStatusLightnings(response, cursor, cursor.remaining);
+    writeStatusTail(response, cursor);
+}
+
+void startStatus(StatusCursor &cursor, AS3935 &sensor, unsigned long since, bool truncated, bool msgPack) {
+    const AS3935History& history = sensor.getLightnings();
+    cursor.sensor = &sensor;
+    cursor.now = millis();
+    cursor.sequence = history.getSequence();
+    cursor.next = cursor.sequence;
+    cursor.remaining = 0;
+    cursor.truncated = truncated;
+    cursor.msgPack = msgPack;
+    while (cursor.remaining < history.size() && history.getSequence(cursor.remaining) > since) {
+        cursor.remaining++;
+    }
+}
+
+void fillStatus(ArduinoJson::JsonDocument &doc, StatusCursor &cursor) {
+    AS3935 &sensor = *cursor.sensor;
+    doc["cursor"] = cursor.sequence;
+    doc["truncated"] = cursor.truncated;
+
+    unsigned int distance = sensor.getEstimatedDistance();
+    if (distance < 0x3F) {
+        doc["distance"] = distance;
+    } else {
+        doc["distance"] = (char*) NULL;
+    }
+
+    doc["energy"] = sensor.getEnergy();
+    doc["noiseFloorLevel"] = sensor.getNoiseFloorLevel();
+    doc["disturbersPerMinute"] = sensor.getDisturbersPerMinute();
+    doc["watchdogThreshold"] = sensor.getWatchdogThreshold();
+    doc["wifiSignalStrength"] = WiFi.RSSI();
+    doc["detector"] = detectorIndex(sensor);
+    doc["detectors"] = detectorCount;
+
+    uint16_t rates[3][3];
+    readRates(sensor, rates);
+    addRates(doc, rates);
+
+    #ifdef MY_MQTT_ENABLED
+    doc["mqttQueued"] = mqttOutbox.size();
+    doc["mqttDropped"] = mqttOutbox.getDropped();
+    #endif
+}
+
+void writeStatusHead(Print &response, StatusCursor &cursor) {
+    if (cursor.msgPack) {
+        // MessagePack needs the number of members in advance
+        StaticJsonDocument<512> doc;
+        fillStatus(doc, cursor);
+        writeMsgPackMap(response, doc.size() + 2);
+        writeMsgPackKey(response, "lightnings");
+        writeMsgPackArray(response, cursor.remaining);
+    } else {
+        response.print("{\"lightnings\":[");
+    }
+}
+
+bool writeStatusLightnings(Print &response, StatusCursor &cursor, size_t limit) {
+    // The lightnings are streamed one by one, so the memory consumption is constant
+    const AS3935History& history = cursor.sensor->getLightnings();
+    for (size_t count = 0; count < limit && cursor.remaining > 0; count++) {
+        size_t ix = history.getSequence() - cursor.next;
+        if (ix >= history.size()) {
+            // The remaining lightnings were overwritten or cleared while streaming. The
+            // number of MessagePack array items was announced, so they are sent as nil.
+            while (cursor.msgPack && cursor.remaining > 0) {
+                response.write((uint8_t) 0xC0);
+                cursor.remaining--;
+            }
+            cursor.remaining = 0;
             break;
         }
-        StaticJsonDocument<200> subdoc;
-        subdoc["age"] = timeDifference(now, lightning.time) / 1000;
+
+        const Lightning& lightning = history[ix];
+        StaticJsonDocument<128> subdoc;
+        subdoc["seq"] = cursor.next;
+        subdoc["age"] = timeDifference(cursor.now, lightning.time) / 1000;
         subdoc["energy"] = lightning.energy;
         if (lightning.distance < 0x3F) {
             subdoc["distance"] = lightning.distance;
         } else {
             subdoc["distance"] = (char*) NULL;
         }
-        la.add(subdoc);
+        if (cursor.msgPack) {
+            serializeMsgPack(subdoc, response);
+        } else {
+            if (cursor.next != cursor.sequence) {
+                response.print(",");
+            }
+            serializeJson(subdoc, response);
+        }
+        cursor.next--;
+        cursor.remaining--;
     }
+    return cursor.remaining > 0;
+}
 
-    unsigned int distance = detector.getEstimatedDistance();
-    if (distance < 0x3F) {
-        doc["distance"] = distance;
+void writeStatusTail(Print &response, StatusCursor &cursor) {
+    {
+        // Serialized separately, to keep the stack usage low
+        StaticJsonDocument<256> stormDoc;
+        StormStatus storm;
+        cursor.sensor->getStormStatus(storm);
+        addStorm(stormDoc.to<JsonObject>(), storm);
+        if (cursor.msgPack) {
+            writeMsgPackKey(response, "storm");
+            serializeMsgPack(stormDoc, response);
+        } else {
+            response.print("],\"storm\":");
+            serializeJson(stormDoc, response);
+            response.print(",");
+        }
+    }
+
+    StaticJsonDocument<512> doc;
+    fillStatus(doc, cursor);
+    if (cursor.msgPack) {
+        sendMsgPackMembers(doc, response);
     } else {
-        doc["distance"] = (char*) NULL;
+        sendJsonMembers(doc, response);
     }
+}
 
-    doc["energy"] = detector.getEnergy();
-    doc["noiseFloorLevel"] = detector.getNoiseFloorLevel();
-    doc["disturbersPerMinute"] = detector.getDisturbersPerMinute();
-    doc["watchdogThreshold"] = detector.getWatchdogThreshold();
-    doc["wifiSignalStrength"] = WiFi.RSSI();
+void handleMetrics() {
+    ChunkedResponse response(server);
+    response.begin(200, "text/plain; version=0.0.4");
+    MetricsWriter metrics(response);
+
+    metrics.family("kaminari_uptime_seconds", "gauge", "Time since start");
+    metrics.seconds("kaminari_uptime_seconds", millis() * 1000ULL);
+
+    metrics.family("kaminari_loop_duration_seconds", "histogram", "Duration of a main loop iteration");
+    metrics.histogram("kaminari_loop_duration_seconds", loopDuration);
 
-    sendJsonResponse(doc);
+    metrics.family("kaminari_detector_update_duration_seconds", "histogram", "Duration of a detector update");
+    metrics.histogram("kaminari_detector_update_duration_seconds", updateDuration);
+
+    metrics.family("kaminari_led_update_duration_seconds", "histogram", "Duration of a LED frame update");
+    metrics.histogram("kaminari_led_update_duration_seconds", colorDuration);
+
+    metrics.family("kaminari_http_request_duration_seconds", "histogram", "Duration of a HTTP request, by route");
+    response.flush();
+
+    // The route histograms are large, so they are sent one by one, followed by the rest
+    int route = 0;
+    server.stream([route]() mutable {
+        ChunkedResponse response(server);
+        MetricsWriter metrics(response);
+        if (route < routeCount) {
+            char labels[40];
+            snprintf(labels, sizeof(labels), "route=\"%s\"", routes[route]);
+            metrics.histogram("kaminari_http_request_duration_seconds", routeDurations[route], labels);
+            route++;
+            response.flush();
+            return true;
+        }
+        writeRuntimeMetrics(metrics);
+        response.end();
+        return false;
+    });
+}
+
+void writeRuntimeMetrics(MetricsWriter& metrics) {
+    // All samples of a family must be grouped, so there is a loop for every family
+    char labels[configuredDetectors][16];
+    for (int ix = 0; ix < detectorCount; ix++) {
+        snprintf(labels[ix], sizeof(labels[ix]), "detector=\"%d\"", ix);
+    }
+
+    metrics.family("kaminari_spi_transactions_total", "counter", "Number of SPI transactions with the detector");
+    for (int ix = 0; ix < detectorCount; ix++) {
+        metrics.value("kaminari_spi_transactions_total", detectors[ix]->getSpiTransactions(), labels[ix]);
+    }
+
+    metrics.family("kaminari_spi_time_seconds_total", "counter", "Time spent in SPI transactions with the detector");
+    for (int ix = 0; ix < detectorCount; ix++) {
+        metrics.seconds("kaminari_spi_time_seconds_total", detectors[ix]->getSpiTime(), labels[ix]);
+    }
+
+    metrics.family("kaminari_interrupts_total", "counter", "Number of detector interrupts");
+    for (int ix = 0; ix < detectorCount; ix++) {
+        metrics.value("kaminari_interrupts_total", detectors[ix]->getInterrupts(), labels[ix]);
+    }
+
+    metrics.family("kaminari_interrupts_processed_total", "counter", "Number of processed detector interrupts");
+    for (int ix = 0; ix < detectorCount; ix++) {
+        metrics.value("kaminari_interrupts_processed_total", detectors[ix]->getProcessedInterrupts(), labels[ix]);
+    }
+
+    metrics.family("kaminari_interrupts_lost_total", "counter", "Number of detector interrupts lost by queue overflow");
+    for (int ix = 0; ix < detectorCount; ix++) {
+        metrics.value("kaminari_interrupts_lost_total", detectors[ix]->getLostInterrupts(), labels[ix]);
+    }
+
+    metrics.family("kaminari_config_writes_total", "counter", "Number of configuration writes to the EEPROM");
+    metrics.value("kaminari_config_writes_total", cfgMgr.getWrites());
+
+    metrics.family("kaminari_heap_free_bytes", "gauge", "Free heap memory");
+    metrics.value("kaminari_heap_free_bytes", ESP.getFreeHeap());
+
+    metrics.family("kaminari_heap_max_block_bytes", "gauge", "Largest free block of heap memory");
+    metrics.value("kaminari_heap_max_block_bytes", ESP.getMaxFreeBlockSize());
+
+    metrics.family("kaminari_event_subscribers", "gauge", "Number of event stream subscribers");
+    metrics.value("kaminari_event_subscribers", eventStream.getSubscribers());
+
+    metrics.family("kaminari_http_connections", "gauge", "Number of open HTTP connections");
+    metrics.value("kaminari_http_connections", server.getConnections());
+
+    metrics.family("kaminari_http_deferred_total", "counter", "Number of HTTP requests deferred by pending output");
+    metrics.value("kaminari_http_deferred_total", server.getDeferred());
+
+    metrics.family("kaminari_http_not_modified_total", "counter", "Number of HTTP requests answered with 304 Not Modified");
+    metrics.value("kaminari_http_not_modified_total", notModified);
+
+    metrics.family("kaminari_response_cache_hits_total", "counter", "Number of responses sent from the response cache");
+    metrics.value("kaminari_response_cache_hits_total", responseCache.getHits());
+
+    metrics.family("kaminari_response_cache_misses_total", "counter", "Number of responses that had to be rendered");
+    metrics.value("kaminari_response_cache_misses_total", responseCache.getMisses());
+
+    metrics.family("kaminari_http_timeouts_total", "counter", "Number of HTTP connections closed because the client was too slow");
+    metrics.value("kaminari_http_timeouts_total", server.getTimeouts());
+
+    metrics.family("kaminari_http_overflows_total", "counter", "Number of HTTP responses aborted because they exceeded the output queue");
+    metrics.value("kaminari_http_overflows_total", server.getOverflows());
+
+    #ifdef MY_MQTT_ENABLED
+    metrics.family("kaminari_mqtt_publish_failures_total", "counter", "Number of failed MQTT publications");
+    metrics.value("kaminari_mqtt_publish_failures_total", mqttPublishFailures);
+
+    metrics.family("kaminari_mqtt_queued", "gauge", "Number of MQTT messages waiting in the outbox");
+    metrics.value("kaminari_mqtt_queued", mqttOutbox.size());
+
+    metrics.family("kaminari_mqtt_dropped_total", "counter", "Number of MQTT messages dropped by outbox overflow");
+    metrics.value("kaminari_mqtt_dropped_total", mqttOutbox.getDropped());
+    #endif
+
+    #ifdef MY_EVENT_LOG_ENABLED
+    metrics.family("kaminari_event_log_records", "gauge", "Number of lightnings in the event log");
+    metrics.value("kaminari_event_log_records", eventLog.size());
+
+    metrics.family("kaminari_event_log_dropped_total", "counter", "Number of lightnings dropped because the event log could not be written");
+    metrics.value("kaminari_event_log_dropped_total", eventLog.getDropped());
+    #endif
+}
+
+void handleEvents() {
+    WiFiClient client = server.client();
+    if (!eventStream.subscribe(client)) {
+        server.send(503, "text/plain", "Too many subscribers");
+    }
+}
+
+void handleHistory() {
+    HistoryCursor cursor;
+    cursor.from = 0;
+    cursor.to = 0xFFFFFFFF;
+    cursor.remaining = HISTORY_LIMIT;
+    cursor.sent = 0;
+    cursor.first = true;
+    if (server.hasArg("from")) {
+        cursor.from = strtoul(server.arg("from").c_str(), NULL, 10);
+    }
+    if (server.hasArg("to")) {
+        cursor.to = strtoul(server.arg("to").c_str(), NULL, 10);
+    }
+    if (server.hasArg("limit")) {
+        cursor.remaining = strtoul(server.arg("limit").c_str(), NULL, 10);
+    }
+
+    ChunkedResponse response(server);
+    response.begin(200, "application/json");
+    response.print("{\"lightnings\":[");
+    response.flush();
+
+    // The records are streamed from flash in batches, as fast as the client receives them
+    server.stream([cursor]() mutable {
+        return streamHistory(cursor);
+    });
+}
+
+bool streamHistory(HistoryCursor &cursor) {
+    ChunkedResponse response(server);
+    size_t batch = cursor.remaining < HISTORY_BATCH ? cursor.remaining : HISTORY_BATCH;
+
+    // Records of the same second may span batches, so the ones that were sent are skipped
+    size_t skip = cursor.sent;
+    size_t count = 0;
+    bool truncated = eventLog.query(cursor.from, cursor.to, skip + batch, [&](const EventLogRecord& record) {
+        if (skip > 0) {
+            skip--;
+            return;
+        }
+        StaticJsonDocument<128> subdoc;
+        subdoc["time"] = record.time;
+        subdoc["energy"] = record.energy;
+        if (record.distance < 0x3F) {
+            subdoc["distance"] = record.distance;
+        } else {
+            subdoc["distance"] = (char*) NULL;
+        }
+        if (!cursor.first) {
+            response.print(",");
+        }
+        serializeJson(subdoc, response);
+        cursor.first = false;
+        if (record.time == cursor.from) {
+            cursor.sent++;
+        } else {
+            cursor.from = record.time;
+            cursor.sent = 1;
+        }
+        count++;
+    });
+    cursor.remaining -= count;
+
+    if (truncated && cursor.remaining > 0) {
+        response.flush();
+        return true;
+    }
+    response.print("],\"truncated\":");
+    response.print(truncated ? "true" : "false");
+    response.print("}");
+    response.end();
+    return false;
 }
 
 void handleSettings() {
-    DynamicJsonDocument doc(1024);
-    doc["tuning"] = detector.getFrequency();
-    doc["noiseFloorLevel"] = detector.getNoiseFloorLevel();
-    doc["outdoorMode"] = detector.getOutdoorMode();
-    doc["watchdogThreshold"] = detector.getWatchdogThreshold();
-    doc["minimumNumberOfLightning"] = detector.getMinimumNumberOfLightning();
-    doc["spikeRejection"] = detector.getSpikeRejection();
-    doc["outdoorMode"] = detector.getOutdoorMode();
+    AS3935* sensor = selectDetector();
+    if (sensor == NULL) {
+        return;
+    }
+
+    // The settings only change with the state, so the cached body is used until then
+    bool msgPack = acceptsMsgPack();
+    char etag[RESPONSE_CACHE_ETAG_SIZE];
+    snprintf(etag, sizeof(etag), "\"%08lx-%d-%c\"", (unsigned long) generation,
+            detectorIndex(*sensor), msgPack ? 'm' : 'j');
+    if (sendCached(etag, 0xFFFFFFFFUL)) {
+        return;
+    }
+
+    StaticJsonDocument<512> doc;
+    doc["tuning"] = sensor->getFrequency();
+    doc["noiseFloorLevel"] = sensor->getNoiseFloorLevel();
+    doc["outdoorMode"] = sensor->getOutdoorMode();
+    doc["watchdogThreshold"] = sensor->getWatchdogThreshold();
+    doc["minimumNumberOfLightning"] = sensor->getMinimumNumberOfLightning();
+    doc["spikeRejection"] = sensor->getSpikeRejection();
+    doc["outdoorMode"] = sensor->getOutdoorMode();
     doc["statusLed"] = cfgMgr.config.ledEnabled;
     doc["blueBrightness"] = cfgMgr.config.blueBrightness;
     doc["disturberBrightness"] = cfgMgr.config.disturberBrightness;
-    sendJsonResponse(doc);
+    doc["adaptiveNoiseFloor"] = cfgMgr.config.adaptiveNoiseFloor;
+    doc["noiseRecoveryTime"] = cfgMgr.config.noiseRecoveryTime;
+    doc["disturberLimit"] = cfgMgr.config.disturberLimit;
+    doc["mqttMessagePack"] = cfgMgr.config.mqttMessagePack;
+
+    CachedResponse& response = responseCache.put(etag, msgPack ? "application/msgpack" : "application/json");
+    if (msgPack) {
+        serializeMsgPack(doc, response);
+    } else {
+        serializeJson(doc, response);
+    }
+    if (response.isComplete()) {
+        sendCachedResponse(response);
+    } else {
+        sendResponse(doc);
+    }
 }
 
 void handleUpdate() {
     if (authenticated()) {
         bool needsClearing = false;
+        bool needsNoiseController = false;
 
         if (server.hasArg("watchdogThreshold")) {
             long val = String(server.arg("watchdogThreshold")).toInt();
             if (val >= 0 && val <= 10) {
                 cfgMgr.config.watchdogThreshold = val;
-                detector.setWatchdogThreshold(val);
+                for (int ix = 0; ix < detectorCount; ix++) {
+                    detectors[ix]->setWatchdogThreshold(val);
+                }
                 needsClearing = true;
             }
         }
@@ -151,7 +854,9 @@ void handleUpdate() {
             long val = String(server.arg("minimumNumberOfLightning")).toInt();
             if (val == 1 || val == 5 || val == 9 || val == 16) {
                 cfgMgr.config.minimumNumberOfLightning = val;
-                detector.setMinimumNumberOfLightning(val);
+                for (int ix = 0; ix < detectorCount; ix++) {
+                    detectors[ix]->setMinimumNumberOfLightning(val);
+                }
             }
         }
 
@@ -159,7 +864,9 @@ void handleUpdate() {
             long val = String(server.arg("spikeRejection")).toInt();
             if (val >= 0 && val <= 11) {
                 cfgMgr.config.spikeRejection = val;
-                detector.setSpikeRejection(val);
+                for (int ix = 0; ix < detectorCount; ix++) {
+                    detectors[ix]->setSpikeRejection(val);
+                }
                 needsClearing = true;
             }
         }
@@ -167,7 +874,9 @@ void handleUpdate() {
         if (server.hasArg("outdoorMode")) {
             bool val = String(server.arg("outdoorMode")) == "true";
             cfgMgr.config.outdoorMode = val;
-            detector.setOutdoorMode(val);
+            for (int ix = 0; ix < detectorCount; ix++) {
+                detectors[ix]->setOutdoorMode(val);
+            }
             needsClearing = true;
         }
 
@@ -189,78 +898,354 @@ void handleUpdate() {
             }
         }
 
-        cfgMgr.commit();
-        handleSettings();
+        if (server.hasArg("adaptiveNoiseFloor")) {
+            cfgMgr.config.adaptiveNoiseFloor = String(server.arg("adaptiveNoiseFloor")) == "true";
+            needsNoiseController = true;
+        }
+
+        if (server.hasArg("noiseRecoveryTime")) {
+            long val = String(server.arg("noiseRecoveryTime")).toInt();
+            if (val >= 1 && val <= 3600) {
+                cfgMgr.config.noiseRecoveryTime = val;
+                needsNoiseController = true;
+            }
+        }
+
+        if (server.hasArg("disturberLimit")) {
+            long val = String(server.arg("disturberLimit")).toInt();
+            if (val >= 0 && val <= 1000) {
+                cfgMgr.config.disturberLimit = val;
+                needsNoiseController = true;
+            }
+        }
+
+        if (server.hasArg("mqttMessagePack")) {
+            cfgMgr.config.mqttMessagePack = String(server.arg("mqttMessagePack")) == "true";
+        }
+
+        if (needsNoiseController) {
+            setupNoiseController();
+        }
+
+        setupAnimation();
 
         if (needsClearing) {
             // clear detector statistics after changing the detector config
-            detector.clearStatistics();
+            for (int ix = 0; ix < detectorCount; ix++) {
+                detectors[ix]->clearStatistics();
+            }
         }
+
+        cfgMgr.commit();
+        stateChanged();
+        handleSettings();
     }
 }
 
 void handleCalibrate() {
     if (authenticated()) {
-        unsigned int oldColor = currentColor;
-        color(COLOR_CALIBRATING);
-        StaticJsonDocument<200> doc;
-        doc["tuning"] = detector.calibrate();
-        sendJsonResponse(doc);
-        color(oldColor);
+        if (server.hasArg("detector")) {
+            AS3935* sensor = selectDetector();
+            if (sensor == NULL) {
+                return;
+            }
+            sensor->startCalibration();
+        } else {
+            for (int ix = 0; ix < detectorCount; ix++) {
+                detectors[ix]->startCalibration();
+            }
+        }
+        stateChanged();
+        handleCalibration();
     }
 }
 
+void handleStats() {
+    AS3935* sensor = selectDetector();
+    if (sensor == NULL) {
+        return;
+    }
+
+    if (server.hasArg("reset")) {
+        if (!authenticated()) {
+            return;
+        }
+        for (int ix = 0; ix < detectorCount; ix++) {
+            detectors[ix]->clearQuantiles();
+        }
+        stateChanged();
+    }
+
+    StaticJsonDocument<512> doc;
+    doc["detector"] = detectorIndex(*sensor);
+    doc["duration"] = timeDifference(millis(), sensor->getQuantilesSince()) / 1000;
+    addSketch(doc.createNestedObject("energy"), sensor->getEnergyQuantiles());
+    addSketch(doc.createNestedObject("distance"), sensor->getDistanceQuantiles());
+    addSketch(doc.createNestedObject("noiseFloorLevel"), sensor->getNoiseFloorQuantiles());
+    sendResponse(doc);
+}
+
+void handleCalibration() {
+    AS3935* sensor = selectDetector();
+    if (sensor == NULL) {
+        return;
+    }
+
+    StaticJsonDocument<512> doc;
+    doc["job"] = sensor->getCalibrationJob();
+    doc["calibrating"] = sensor->isCalibrating();
+    int bit = sensor->getCalibrationBit();
+    if (bit >= 0) {
+        doc["bit"] = bit;
+    } else {
+        doc["bit"] = (char*) NULL;
+    }
+    JsonArray ma = doc.createNestedArray("measurements");
+    for (int ix = 3; ix >= 0; ix--) {
+        unsigned long freq = sensor->getCalibrationFrequency(ix);
+        if (freq > 0) {
+            JsonObject mo = ma.createNestedObject();
+            mo["bit"] = ix;
+            mo["frequency"] = freq;
+        }
+    }
+    doc["tuning"] = sensor->getFrequency();
+    sendResponse(doc);
+}
+
 void handleClear() {
     if (authenticated()) {
-        detector.clearDetections();
+        for (int ix = 0; ix < detectorCount; ix++) {
+            detectors[ix]->clearDetections();
+        }
+        stateChanged();
         server.send(200, "text/plain", "OK");
     }
 }
 
 void handleReset() {
     if (authenticated()) {
-        detector.reset();
-        handleCalibrate();
-        setupDetector();
-        detector.clearStatistics();
+        for (int ix = 0; ix < detectorCount; ix++) {
+            detectors[ix]->reset();
+            detectors[ix]->startCalibration();
+        }
+        setupPending = true;
+        stateChanged();
+        handleCalibration();
     }
 }
 
-void sendMqttStatus() {
-    DynamicJsonDocument doc(8192);
-    String json;
+void handleCapture() {
+    if (server.hasArg("action")) {
+        if (!authenticated()) {
+            return;
+        }
+        String action = server.arg("action");
+        if (action == "start") {
+            if (!captureRing.begin()) {
+                server.send(503, "text/plain", "Not enough memory");
+                return;
+            }
+        } else if (action == "stop") {
+            captureRing.end();
+        } else {
+            server.send(400, "text/plain", "Unknown action");
+            return;
+        }
+        server.send(200, "text/plain", "OK");
+        return;
+    }
+
+    if (!captureRing.isActive()) {
+        server.send(404, "text/plain", "Capture is not running");
+        return;
+    }
 
+    time_t currentTime = time(NULL);
+    ChunkedResponse response(server);
+    response.begin(200, "application/octet-stream");
+    captureRing.write(response, currentTime >= VALID_TIME ? currentTime : 0);
+    response.end();
+}
+
+void queueMqttStatus(AS3935& sensor) {
+    MqttStatus status;
     Lightning lightning;
-    if (detector.getLastLightningDetection(0, lightning)) {
-        doc["energy"] = lightning.energy;
-        if (lightning.distance < 0x3F) {
-            doc["distance"] = lightning.distance;
+
+    status.time = millis();
+    status.detector = detectorIndex(sensor);
+    status.hasLightning = sensor.getLastLightningDetection(0, lightning);
+    if (status.hasLightning) {
+        status.energy = lightning.energy;
+        status.distance = lightning.distance;
+        status.lightningTime = lightning.time;
+        status.seq = sensor.getLightnings().getSequence();
+    }
+    status.tuning = sensor.getFrequency();
+    status.noiseFloorLevel = sensor.getNoiseFloorLevel();
+    status.disturbersPerMinute = sensor.getDisturbersPerMinute();
+    status.watchdogThreshold = sensor.getWatchdogThreshold();
+    status.wifiSignalStrength = WiFi.RSSI();
+    readRates(sensor, status.rates);
+    readQuantiles(sensor, status.quantiles);
+    sensor.getStormStatus(status.storm);
+
+    if (!mqttOutbox.push(status)) {
+        Serial.println("MQTT outbox is full, message was dropped");
+    }
+}
+
+bool sendMqttStatus(const MqttStatus& status) {
+    StaticJsonDocument<1024> doc;
+    uint8_t payload[768];
+
+    if (status.hasLightning) {
+        doc["energy"] = status.energy;
+        if (status.distance < 0x3F) {
+            doc["distance"] = status.distance;
         } else {
             doc["distance"] = (char*) NULL;
         }
+        doc["seq"] = status.seq;
+        doc["lightningAge"] = timeDifference(millis(), status.lightningTime) / 1000;
     } else {
         doc["energy"] = (char*) NULL;
         doc["distance"] = (char*) NULL;
+        doc["seq"] = (char*) NULL;
+        doc["lightningAge"] = (char*) NULL;
     }
 
-    doc["tuning"] = detector.getFrequency();
-    doc["noiseFloorLevel"] = detector.getNoiseFloorLevel();
-    doc["disturbersPerMinute"] = detector.getDisturbersPerMinute();
-    doc["watchdogThreshold"] = detector.getWatchdogThreshold();
-    doc["wifiSignalStrength"] = WiFi.RSSI();
+    doc["age"] = timeDifference(millis(), status.time) / 1000;
+    doc["tuning"] = status.tuning;
+    doc["noiseFloorLevel"] = status.noiseFloorLevel;
+    doc["disturbersPerMinute"] = status.disturbersPerMinute;
+    doc["watchdogThreshold"] = status.watchdogThreshold;
+    doc["wifiSignalStrength"] = status.wifiSignalStrength;
+    doc["detector"] = status.detector;
+    addRates(doc, status.rates);
+    addQuantiles(doc, status.quantiles);
+    addStorm(doc.createNestedObject("storm"), status.storm);
 
-    serializeJson(doc, json);
-    if (!client.publish(MY_MQTT_TOPIC, json.c_str(), MY_MQTT_RETAIN)) {
+    size_t length;
+    if (cfgMgr.config.mqttMessagePack) {
+        length = serializeMsgPack(doc, payload, sizeof(payload));
+    } else {
+        length = serializeJson(doc, (char*) payload, sizeof(payload));
+    }
+    if (!client.publish(MY_MQTT_TOPIC, payload, length, MY_MQTT_RETAIN)) {
         Serial.print("Failed to send MQTT message, rc=");
         Serial.println(client.state());
+        mqttPublishFailures++;
+        return false;
+    }
+    return true;
+}
+
+void onDetectorEvent(AS3935& source, AS3935Event event) {
+    stateChanged();
+
+    StaticJsonDocument<256> doc;
+    char data[256];
+    const char* name = NULL;
+    bool primary = &source == &detector;
+
+    switch (event) {
+        case AS3935_LIGHTNING: {
+            const AS3935History& history = source.getLightnings();
+            const Lightning& lightning = history[0];
+            #ifdef MY_EVENT_LOG_ENABLED
+            // Only the first detector is logged, as the others usually see the same lightning
+            time_t currentTime = time(NULL);
+            if (primary && currentTime >= VALID_TIME) {
+                unsigned long age = (millis() - lightning.time) / 1000;
+                eventLog.append(currentTime - age, lightning.energy, lightning.distance);
+            }
+            #endif
+            animation.lightning(lightning.time, lightning.energy, lightning.distance);
+            name = "lightning";
+            doc["seq"] = history.getSequence();
+            doc["energy"] = lightning.energy;
+            if (lightning.distance < 0x3F) {
+                doc["distance"] = lightning.distance;
+            } else {
+                doc["distance"] = (char*) NULL;
+            }
+            break;
+        }
+
+        case AS3935_DISTURBER:
+            animation.disturber(source.getLastDisturber());
+            name = "disturber";
+            doc["disturbersPerMinute"] = source.getDisturbersPerMinute();
+            break;
+
+        case AS3935_NOISE_FLOOR:
+            if (primary) {
+                setupAnimation();
+            }
+            name = "noiseFloor";
+            doc["noiseFloorLevel"] = source.getNoiseFloorLevel();
+            doc["outOfRange"] = source.isNoiseFloorLevelOutOfRange();
+            break;
+    }
+
+    if (name != NULL) {
+        doc["detector"] = detectorIndex(source);
+        serializeJson(doc, data, sizeof(data));
+        eventStream.publish(name, data);
+    }
+
+    #ifdef MY_MQTT_ENABLED
+    if (event == AS3935_LIGHTNING || event == AS3935_NOISE_FLOOR) {
+        queueMqttStatus(source);
+    }
+    #endif
+}
+
+void route(const char* uri, HttpServer::THandlerFunction handler) {
+    if (routeCount >= MAX_ROUTES) {
+        server.on(uri, handler);
+        return;
+    }
+
+    // Measure the duration of every request to this route
+    int index = routeCount++;
+    routes[index] = uri;
+    server.on(uri, [index, handler]() {
+        unsigned long start = micros();
+        handler();
+        routeDurations[index].observe(micros() - start);
+    });
+}
+
+void setupNoiseController() {
+    // Every detector has its own noise environment, and thus its own controller
+    for (int ix = 0; ix < detectorCount; ix++) {
+        adaptiveNoiseControllers[ix].setRecoveryTime(cfgMgr.config.noiseRecoveryTime * 1000UL);
+        adaptiveNoiseControllers[ix].setDisturberLimit(cfgMgr.config.disturberLimit);
+        detectors[ix]->setNoiseController(cfgMgr.config.adaptiveNoiseFloor ? &adaptiveNoiseControllers[ix] : NULL);
     }
 }
 
 void setupDetector() {
-    detector.setOutdoorMode(cfgMgr.config.outdoorMode);
-    detector.setWatchdogThreshold(cfgMgr.config.watchdogThreshold);
-    detector.setMinimumNumberOfLightning(cfgMgr.config.minimumNumberOfLightning);
-    detector.setSpikeRejection(cfgMgr.config.spikeRejection);
+    AS3935Settings settings;
+    settings.outdoorMode = cfgMgr.config.outdoorMode;
+    settings.watchdogThreshold = cfgMgr.config.watchdogThreshold;
+    settings.minimumNumberOfLightning = cfgMgr.config.minimumNumberOfLightning;
+    settings.spikeRejection = cfgMgr.config.spikeRejection;
+    for (int ix = 0; ix < detectorCount; ix++) {
+        detectors[ix]->configure(settings);
+    }
+    setupNoiseController();
+    setupAnimation();
+}
+
+void setupAnimation() {
+    // Only changes on noise floor events and settings changes, so keep it off the hot path
+    int blueBrightness = cfgMgr.config.blueBrightness;
+    int blue = detector.getNoiseFloorLevel() * blueBrightness / (detector.getOutdoorMode() ? 2000 : 146);
+    animation.setNoiseFloor(blue <= 255 ? blue : 255, blueBrightness > 128 ? blueBrightness : 128);
+    animation.setDisturberBrightness(cfgMgr.config.disturberBrightness);
 }
 
 void color(unsigned int color) {
@@ -271,11 +1256,12 @@ void color(unsigned int color) {
     }
 }
 
-inline int limit(int v) {
-    return v <= 255 ? (v >= 0 ? v : 0): 255;
-}
-
 void updateColor(unsigned long now) {
+    if (isCalibrating()) {
+        color(COLOR_CALIBRATING);
+        return;
+    }
+
     if (!connected) {
         color(now % 1000 <= 500 ? COLOR_CONNECTING : COLOR_BLACK);
         return;
@@ -286,46 +1272,7 @@ void updateColor(unsigned long now) {
         return;
     }
 
-    // Calculate blue color (noise floor level)
-    int blue = 0;
-    if (detector.isNoiseFloorLevelOutOfRange()) {
-        blue = now % 1000 <= 500 ? (cfgMgr.config.blueBrightness > 128 ? cfgMgr.config.blueBrightness : 128) : 0;
-    } else {
-        blue = detector.getNoiseFloorLevel() * cfgMgr.config.blueBrightness / (detector.getOutdoorMode() ? 2000 : 146);
-    }
-
-    // Calculate lightning age (white) and distance (green to red)
-    long red = 0;
-    long green = 0;
-    long white = 0;
-    if (ledLightning.time > 0 && ledLightning.distance <= 40) {
-        unsigned long diff = timeDifference(now, ledLightning.time);
-        long distancePast = (DISTANCE_ANIMATION_TIME + ENERGY_ANIMATION_TIME) - diff;
-        long energyPast = ENERGY_ANIMATION_TIME - diff;
-        if (energyPast >= 0) {
-            white = ((     ledLightning.energy  ) * energyPast   * 255) / (300000 * ENERGY_ANIMATION_TIME);
-            blue = 0;
-        } else if (distancePast >= 0) {
-            green = ((     ledLightning.distance) * distancePast * 255) / (40 * DISTANCE_ANIMATION_TIME);
-            red   = ((40 - ledLightning.distance) * distancePast * 255) / (40 * DISTANCE_ANIMATION_TIME);
-            long newblue = ((long) blue) * diff / (DISTANCE_ANIMATION_TIME + ENERGY_ANIMATION_TIME);
-            if (newblue < blue) {
-                blue = newblue;
-            }
-        }
-    }
-
-    // Calculate last disturber fade
-    unsigned long lastDisturber = detector.getLastDisturber();
-    unsigned long disturberDiff = timeDifference(now, lastDisturber);
-    if (cfgMgr.config.disturberBrightness > 0 && lastDisturber != 0 && disturberDiff <= DISTURBER_ANIMATION_TIME) {
-        red = (cfgMgr.config.disturberBrightness * (DISTURBER_ANIMATION_TIME - disturberDiff)) / DISTURBER_ANIMATION_TIME;
-    }
-
-    color(    (limit(white) & 0xFF) << 24
-            | (limit(red  ) & 0xFF) << 16
-            | (limit(green) & 0xFF) << 8
-            | (limit(blue ) & 0xFF));
+    color(animation.frame(now, detector.isNoiseFloorLevelOutOfRange()));
 }
 
 void setup() {
@@ -334,24 +1281,64 @@ void setup() {
 
     cfgMgr.begin();
 
-    detector.begin();
+    // ETags must not repeat after a restart
+    generation = ESP.random();
+
+    #if defined(MY_EVENT_LOG_ENABLED) || (defined(MY_MQTT_ENABLED) && defined(MY_MQTT_OUTBOX_SPILL))
+    if (LittleFS.begin()) {
+        #if defined(MY_MQTT_ENABLED) && defined(MY_MQTT_OUTBOX_SPILL)
+        mqttOutbox.spill("/mqtt-outbox.bin", MQTT_OUTBOX_SPILL_SIZE);
+        #endif
+        #ifdef MY_EVENT_LOG_ENABLED
+        eventLog.begin("/log");
+        #endif
+    } else {
+        Serial.println("Could not mount file system");
+    }
+    #endif
+
+    // Detectors that cannot be started are removed, so they are never calibrated or polled
+    detectorCount = 0;
+    for (int ix = 0; ix < configuredDetectors; ix++) {
+        if (!detectors[ix]->begin()) {
+            Serial.print("Could not start detector ");
+            Serial.print(ix);
+            Serial.println(", it will be ignored");
+            continue;
+        }
+        detectors[detectorCount++] = detectors[ix];
+    }
+
+    for (int ix = 0; ix < detectorCount; ix++) {
+        detectors[ix]->onEvent(onDetectorEvent);
+        detectors[ix]->setCapture(&captureRing, ix);
+    }
 
     neopixel.begin();
     neopixel.setBrightness(255);
 
-    // Init detector
+    // Init detectors, one after the other
     color(COLOR_CALIBRATING);
-    Serial.println("Calibrating antenna...");
-    detector.reset();
-    unsigned int freq = detector.calibrate();
-    Serial.print("Calibrated antenna frequency: ");
-    Serial.print(freq);
-    Serial.println(" Hz");
+    for (int ix = 0; ix < detectorCount; ix++) {
+        Serial.print("Calibrating antenna of detector ");
+        Serial.print(ix);
+        Serial.println("...");
+        detectors[ix]->reset();
+        unsigned int freq = detectors[ix]->calibrate();
+        Serial.print("Calibrated antenna frequency: ");
+        Serial.print(freq);
+        Serial.println(" Hz");
+    }
     color(COLOR_BLACK);
 
-    // Set up the detector
+    // Set up the detectors
     setupDetector();
 
+    #ifdef MY_MQTT_ENABLED
+    // The default MQTT buffer is too small for the status message
+    client.setBufferSize(MQTT_BUFFER_SIZE);
+    #endif
+
     // Start WiFi
     WiFi.setSleepMode(WIFI_NONE_SLEEP);
     WiFi.mode(WIFI_STA);
@@ -376,6 +1363,11 @@ void setup() {
     });
     WiFi.begin(MY_SSID, MY_PSK);
 
+    #ifdef MY_EVENT_LOG_ENABLED
+    // Synchronize the clock, for the event log
+    configTime(0, 0, MY_NTP_SERVER);
+    #endif
+
     // Start MDNS
     if (MDNS.begin(MY_MDNS_NAME)) {
         Serial.println("MDNS responder started");
@@ -383,24 +1375,34 @@ void setup() {
     }
 
     // Start server
-    server.on("/status", handleStatus);
-    server.on("/settings", handleSettings);
-    server.on("/update", handleUpdate);
-    server.on("/calibrate", handleCalibrate);
-    server.on("/clear", handleClear);
-    server.on("/reset", handleReset);
+    route("/status", handleStatus);
+    route("/settings", handleSettings);
+    route("/metrics", handleMetrics);
+    route("/events", handleEvents);
+    #ifdef MY_EVENT_LOG_ENABLED
+    route("/history", handleHistory);
+    #endif
+    route("/stats", handleStats);
+    route("/update", handleUpdate);
+    route("/calibrate", handleCalibrate);
+    route("/calibration", handleCalibration);
+    route("/clear", handleClear);
+    route("/reset", handleReset);
+    route("/capture", handleCapture);
     server.onNotFound([]() {
         server.send(404, "text/plain", server.uri() + ": not found\n");
     });
-    const char * headerkeys[] = { "X-API-Key" };
+    const char * headerkeys[] = { "X-API-Key", "Accept", "If-None-Match" };
     server.collectHeaders(headerkeys, sizeof(headerkeys) / sizeof(char*));
 }
 
 void loop() {
     const unsigned long now = millis();
+    const unsigned long loopStart = micros();
 
     if (connected) {
         server.handleClient();
+        eventStream.update();
         MDNS.update();
 
         #ifdef MY_MQTT_ENABLED
@@ -413,22 +1415,49 @@ void loop() {
                 Serial.println(client.state());
             }
         }
+
+        // Replay pending messages in order, but not faster than the rate limit
+        if (client.connected() && mqttOutbox.size() > 0
+                && now - beforeMqttPublish >= MQTT_PUBLISH_INTERVAL) {
+            beforeMqttPublish = now;
+            MqttStatus status;
+            if (mqttOutbox.peek(status) && sendMqttStatus(status)) {
+                mqttOutbox.pop();
+            }
+        }
         #endif
     }
 
-    if (detector.update()) {
-        if (!detector.getLastLightningDetection(0, ledLightning)) {
-            ledLightning.time = 0;
-        }
-        #ifdef MY_MQTT_ENABLED
-        if (connected && client.connected()) {
-            sendMqttStatus();
+    unsigned long updateStart = micros();
+    bool detectorChanged = false;
+    for (int ix = 0; ix < detectorCount; ix++) {
+        detectorChanged |= detectors[ix]->update();
+    }
+    updateDuration.observe(micros() - updateStart);
+    if (detectorChanged) {
+        stateChanged();
+        if (setupPending && !isCalibrating()) {
+            // reset was completed by calibration, now set up the detectors again
+            setupPending = false;
+            setupDetector();
+            for (int ix = 0; ix < detectorCount; ix++) {
+                detectors[ix]->clearStatistics();
+            }
         }
-        #endif
     }
 
+    #ifdef MY_EVENT_LOG_ENABLED
+    eventLog.update();
+    #endif
+
+    cfgMgr.update();
+
     if (timeDifference(now, beforeAnimation) > 50) {
         beforeAnimation = now;
+        unsigned long colorStart = micros();
         updateColor(now);
+        colorDuration.observe(micros() - colorStart);
     }
+
+    loopDuration.observe(micros() - loopStart);
 }
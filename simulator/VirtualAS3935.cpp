@@ -0,0 +1,362 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <Arduino.h>
+
+#include "VirtualAS3935.h"
+
+#define NOISE_CHECK_INTERVAL 1000000    // INT_NH is raised once per second while noisy
+#define STRIKE_WINDOW 900000000         // Window for the minimum number of lightning (15 min)
+#define AFE_GB_OUTDOOR 0x0E             // AFE gain boost for outdoor mode
+
+static const int outdoorThresholds[] = { 390,  630,  860, 1100, 1140, 1570, 1800, 2000 };
+static const int indoorThresholds[]  = {  28,   45,   62,   78,   95,  112,  130,  146 };
+static const int minNumLightning[]   = { 1, 5, 9, 16 };
+static const int distances[]         = { 1, 5, 6, 8, 10, 12, 14, 17, 20, 24, 27, 31, 34, 37, 40 };
+
+VirtualAS3935::VirtualAS3935(int csPin, int intPin, unsigned long maxFrequency, unsigned long stepFrequency) {
+    this->csPin = csPin;
+    this->intPin = intPin;
+    this->maxFrequency = maxFrequency;
+    this->stepFrequency = stepFrequency;
+    this->noise = 0;
+    this->nextNoiseCheck = NOISE_CHECK_INTERVAL;
+    this->pendingLightningTime = 0;
+    this->lastLightningTime = 0;
+    this->replayPending = false;
+    this->spiState = SPI_IDLE;
+    this->spiAddress = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+    preset();
+}
+
+void VirtualAS3935::schedule(const SimEvent& event) {
+    events.push(event);
+}
+
+size_t VirtualAS3935::getScheduled() const {
+    return events.size();
+}
+
+uint8_t VirtualAS3935::getRegister(uint8_t address) const {
+    return registers[address & 0x3F];
+}
+
+bool VirtualAS3935::isInterruptPending() const {
+    return intHigh;
+}
+
+uint64_t VirtualAS3935::getLastLightningTime() const {
+    return lastLightningTime;
+}
+
+int VirtualAS3935::getRequiredNoiseFloorLevel() const {
+    int level = 0;
+    while (level < 8 && noise > getNoiseThreshold(level)) {
+        level++;
+    }
+    return level;
+}
+
+unsigned long VirtualAS3935::getLcoFrequency(int tuning) const {
+    return maxFrequency - (tuning & 0x0F) * stepFrequency;
+}
+
+const SimChipStats& VirtualAS3935::getStats() const {
+    return stats;
+}
+
+void VirtualAS3935::pinWrite(int pin, int value) {
+    if (pin != csPin) {
+        return;
+    }
+    if (value == LOW) {
+        spiState = SPI_COMMAND;
+        stats.spiFrames++;
+    } else {
+        spiState = SPI_IDLE;
+    }
+}
+
+uint8_t VirtualAS3935::spiTransfer(uint8_t value) {
+    uint8_t result = 0x00;
+    switch (spiState) {
+        case SPI_IDLE:
+            return 0xFF;
+
+        case SPI_COMMAND:
+            spiAddress = value & 0x3F;
+            switch (value >> 6) {
+                case 0:  spiState = SPI_WRITE;  break;
+                case 1:  spiState = SPI_READ;   break;
+                default: spiState = SPI_IGNORE; break;
+            }
+            break;
+
+        case SPI_READ:
+            result = readRegister(spiAddress);
+            spiAddress = (spiAddress + 1) & 0x3F;
+            break;
+
+        case SPI_WRITE:
+            writeRegister(spiAddress, value);
+            spiAddress = (spiAddress + 1) & 0x3F;
+            break;
+
+        case SPI_IGNORE:
+            break;
+    }
+    stats.spiBytes++;
+    return result;
+}
+
+void VirtualAS3935::advanceTo(uint64_t time) {
+    for (;;) {
+        uint64_t next = nextNoiseCheck;
+        if (!events.empty() && events.top().time <= next) {
+            next = events.top().time;
+        }
+        if (lcoEnabled && nextLcoEdge <= next) {
+            next = (uint64_t) nextLcoEdge;
+        }
+        if (next > time) {
+            break;
+        }
+        sim::setTime(next);
+
+        if (!events.empty() && events.top().time == next) {
+            SimEvent event = events.top();
+            events.pop();
+            process(event);
+        } else if (lcoEnabled && (uint64_t) nextLcoEdge == next) {
+            stats.lcoEdges++;
+            nextLcoEdge += getLcoPeriod();
+            sim::interrupt(intPin);
+        } else {
+            nextNoiseCheck += NOISE_CHECK_INTERVAL;
+            if (isNoisy()) {
+                stats.reported[SIM_NOISE]++;
+                raise(0x01);
+            }
+        }
+    }
+}
+
+void VirtualAS3935::preset() {
+    memset(registers, 0, sizeof(registers));
+    registers[0x00] = 0x24;
+    registers[0x01] = 0x22;
+    registers[0x02] = 0xC2;
+    registers[0x07] = 0x3F;
+    intHigh = false;
+    lcoEnabled = false;
+    nextLcoEdge = 0.0;
+    strikes = 0;
+    firstStrike = 0;
+}
+
+uint8_t VirtualAS3935::readRegister(uint8_t address) {
+    uint8_t value = registers[address];
+    if (address == 0x03) {
+        // Reading the interrupt register clears the interrupt
+        if ((value & 0x08) != 0) {
+            lastLightningTime = pendingLightningTime;
+        }
+
+        // The settings of a captured event were recorded when its interrupt was read,
+        // so they are compared now, ignoring CL_STAT and the reserved bits
+        if (replayPending) {
+            replayPending = false;
+            if ((registers[0x00] & 0x3F) != (replaySettings[0x00] & 0x3F)
+                    || (registers[0x01] & 0x7F) != (replaySettings[0x01] & 0x7F)
+                    || (registers[0x02] & 0x3F) != (replaySettings[0x02] & 0x3F)) {
+                stats.diverged++;
+            }
+        }
+        registers[0x03] &= 0xF0;
+        intHigh = false;
+    }
+    return value;
+}
+
+void VirtualAS3935::writeRegister(uint8_t address, uint8_t value) {
+    switch (address) {
+        case 0x02:
+            if ((value & 0x40) == 0) {
+                strikes = 0;            // CL_STAT low clears the statistics
+            }
+            registers[address] = value;
+            break;
+
+        case 0x03:
+            registers[address] = (value & 0xF0) | (registers[address] & 0x0F);
+            break;
+
+        case 0x04: case 0x05: case 0x06: case 0x07:
+            break;                      // read only
+
+        case 0x08: {
+            bool lco = (value & 0x80) != 0;
+            registers[address] = value;
+            if (lco && !lcoEnabled) {
+                nextLcoEdge = sim::now() + getLcoPeriod();
+            }
+            lcoEnabled = lco;
+            break;
+        }
+
+        case 0x3C:
+            if (value == 0x96) {
+                preset();               // PRESET_DEFAULT
+            }
+            break;
+
+        case 0x3D:
+            if (value == 0x96) {
+                registers[0x3A] = 0x80; // CALIB_RCO: TRCO and SRCO calibration done
+                registers[0x3B] = 0x80;
+            }
+            break;
+
+        default:
+            registers[address] = value;
+            break;
+    }
+}
+
+void VirtualAS3935::process(const SimEvent& event) {
+    if (event.type == SIM_CAPTURED) {
+        replay(event);
+        return;
+    }
+
+    stats.injected[event.type]++;
+
+    if (event.type == SIM_NOISE) {
+        noise = event.noise;
+        return;
+    }
+
+    if ((registers[0x00] & 0x01) != 0) {
+        return;                         // powered down
+    }
+    if (isNoisy()) {
+        stats.deafened++;
+        return;
+    }
+    if (event.signal < (registers[0x01] & 0x0F)) {
+        stats.rejected++;
+        return;
+    }
+
+    if (event.type == SIM_DISTURBER) {
+        if ((registers[0x03] & 0x20) != 0) {
+            stats.masked++;
+            return;
+        }
+        stats.reported[SIM_DISTURBER]++;
+        raise(0x04);
+        return;
+    }
+
+    if (strikes == 0 || event.time - firstStrike > STRIKE_WINDOW) {
+        strikes = 0;
+        firstStrike = event.time;
+    }
+    strikes++;
+    if (strikes < (unsigned int) minNumLightning[(registers[0x02] >> 4) & 0x03]) {
+        stats.suppressed++;
+        return;
+    }
+
+    registers[0x04] = event.energy & 0xFF;
+    registers[0x05] = (event.energy >> 8) & 0xFF;
+    registers[0x06] = (registers[0x06] & 0xE0) | ((event.energy >> 16) & 0x1F);
+    registers[0x07] = (registers[0x07] & 0xC0) | quantizeDistance(event.distance);
+    pendingLightningTime = event.time;
+    stats.reported[SIM_LIGHTNING]++;
+    raise(0x08);
+}
+
+void VirtualAS3935::replay(const SimEvent& event) {
+    const uint8_t* original = event.registers;
+    memcpy(replaySettings, original, sizeof(replaySettings));
+    replayPending = true;
+
+    uint8_t interrupt = original[0x03] & 0x0F;
+    int type = (interrupt & 0x08) != 0 ? SIM_LIGHTNING
+            : (interrupt & 0x04) != 0 ? SIM_DISTURBER
+            : (interrupt & 0x01) != 0 ? SIM_NOISE : -1;
+    if (type >= 0) {
+        stats.injected[type]++;
+        stats.reported[type]++;
+    }
+
+    registers[0x04] = original[0x04];
+    registers[0x05] = original[0x05];
+    registers[0x06] = (registers[0x06] & 0xE0) | (original[0x06] & 0x1F);
+    registers[0x07] = (registers[0x07] & 0xC0) | (original[0x07] & 0x3F);
+    if (type == SIM_LIGHTNING) {
+        pendingLightningTime = event.time;
+    }
+    raise(interrupt);
+}
+
+void VirtualAS3935::raise(uint8_t interrupt) {
+    if (intHigh) {
+        stats.merged++;
+    }
+    registers[0x03] = (registers[0x03] & 0xF0) | interrupt;
+    if (!intHigh) {
+        intHigh = true;
+        if (!lcoEnabled) {
+            // While LCO is displayed, the INT pin carries the oscillator signal
+            sim::interrupt(intPin);
+        }
+    }
+}
+
+bool VirtualAS3935::isNoisy() const {
+    return noise > getNoiseThreshold();
+}
+
+int VirtualAS3935::getNoiseThreshold() const {
+    return getNoiseThreshold((registers[0x01] >> 4) & 0x07);
+}
+
+int VirtualAS3935::getNoiseThreshold(int level) const {
+    bool outdoor = ((registers[0x00] >> 1) & 0x1F) == AFE_GB_OUTDOOR;
+    return outdoor ? outdoorThresholds[level] : indoorThresholds[level];
+}
+
+double VirtualAS3935::getLcoPeriod() const {
+    unsigned long ratio = 16UL << ((registers[0x03] >> 6) & 0x03);
+    return 1000000.0 * ratio / getLcoFrequency(registers[0x08]);
+}
+
+int VirtualAS3935::quantizeDistance(int distance) const {
+    if (distance > 40) {
+        return 0x3F;                    // out of range
+    }
+    int result = distances[0];
+    for (int distanceStep : distances) {
+        if (distanceStep <= distance) {
+            result = distanceStep;
+        }
+    }
+    return result;
+}
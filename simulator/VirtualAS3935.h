@@ -0,0 +1,184 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __VirtualAS3935__
+#define __VirtualAS3935__
+
+#include <stdint.h>
+#include <queue>
+#include <vector>
+
+#include "Simulator.h"
+
+/**
+ * Types of events that can be injected into the virtual AS3935.
+ */
+enum SimEventType {
+    SIM_LIGHTNING,
+    SIM_DISTURBER,
+    SIM_NOISE,
+    SIM_CAPTURED
+};
+
+/**
+ * An event in the environment of the virtual AS3935.
+ */
+struct SimEvent {
+    uint64_t time;          // Time of the event, in µs
+    SimEventType type;
+    unsigned long energy;   // Lightning: energy value (21 bits)
+    int distance;           // Lightning: distance of the storm front, in km
+    int signal;             // Lightning, disturber: signal strength (0..15)
+    int noise;              // Noise: new environmental noise level, in µVrms
+    uint8_t registers[8];   // Captured: registers 0x00 to 0x07 of the original chip
+};
+
+/**
+ * Statistics of the virtual AS3935.
+ */
+struct SimChipStats {
+    unsigned long injected[3];      // Injected events, by type
+    unsigned long reported[3];      // Events that were reported via INT, by type
+    unsigned long rejected;         // Lightnings and disturbers below the watchdog threshold
+    unsigned long suppressed;       // Lightnings below the minimum number of lightning
+    unsigned long deafened;         // Lightnings and disturbers hidden by noise
+    unsigned long masked;           // Disturbers that were masked
+    unsigned long merged;           // Events that overwrote a pending, unread event
+    unsigned long diverged;         // Captured events with settings unlike the original chip
+    unsigned long lcoEdges;         // Number of LCO edges on the INT pin
+    unsigned long spiFrames;        // Number of SPI frames (CS low to CS high)
+    unsigned long spiBytes;         // Number of SPI bytes transferred
+};
+
+/**
+ * A virtual AS3935 lightning sensor.
+ *
+ * It models the register file, the SPI protocol, the INT pin, the LCO antenna
+ * frequency output, and a simplified detection logic. Events from the environment are
+ * scheduled with their time, and are processed while the simulated time advances.
+ *
+ * The detection logic is deliberately simple. Noise above the noise floor threshold
+ * raises INT_NH once per second and hides all other events. Lightnings and disturbers
+ * with a signal below the watchdog threshold are ignored. Lightnings are only reported
+ * after the minimum number of lightning was reached within 15 minutes. An event that
+ * occurs while the previous one is still unread overwrites its results.
+ *
+ * Captured events bypass the detection logic. Their interrupt and results are raised
+ * exactly as the original chip did, so a capture of a real detector can be replayed.
+ */
+class VirtualAS3935 : public sim::Device {
+public:
+
+    /**
+     * Create a new virtual AS3935.
+     *
+     * @param csPin         Chip select pin
+     * @param intPin        Interrupt pin
+     * @param maxFrequency  LCO frequency with all tuning capacitors disabled, in Hz
+     * @param stepFrequency Frequency reduction per tuning capacitor step, in Hz
+     */
+    VirtualAS3935(int csPin, int intPin, unsigned long maxFrequency = 530000, unsigned long stepFrequency = 4000);
+
+    /**
+     * Schedule an event. Events in the past are processed on the next advance.
+     */
+    void schedule(const SimEvent& event);
+
+    /**
+     * Return the number of events that are still scheduled.
+     */
+    size_t getScheduled() const;
+
+    /**
+     * Return the current value of a register, without side effects.
+     */
+    uint8_t getRegister(uint8_t address) const;
+
+    /**
+     * Return true if the INT pin is currently high.
+     */
+    bool isInterruptPending() const;
+
+    /**
+     * Return the time of the lightning whose result was read most recently, in µs.
+     */
+    uint64_t getLastLightningTime() const;
+
+    /**
+     * Return the lowest noise floor level that is above the current environmental
+     * noise, or 8 if the noise is above all levels.
+     */
+    int getRequiredNoiseFloorLevel() const;
+
+    /**
+     * Return the LCO frequency of the given tuning capacitor setting, in Hz.
+     */
+    unsigned long getLcoFrequency(int tuning) const;
+
+    /**
+     * Return the statistics.
+     */
+    const SimChipStats& getStats() const;
+
+    void pinWrite(int pin, int value) override;
+    uint8_t spiTransfer(uint8_t value) override;
+    void advanceTo(uint64_t time) override;
+
+private:
+    struct Later {
+        bool operator()(const SimEvent& a, const SimEvent& b) const {
+            return a.time > b.time;
+        }
+    };
+
+    enum SpiState { SPI_IDLE, SPI_COMMAND, SPI_READ, SPI_WRITE, SPI_IGNORE };
+
+    int csPin;
+    int intPin;
+    unsigned long maxFrequency;
+    unsigned long stepFrequency;
+    uint8_t registers[0x40];
+    bool intHigh;
+    int noise;
+    uint64_t nextNoiseCheck;
+    bool lcoEnabled;
+    double nextLcoEdge;
+    unsigned int strikes;
+    uint64_t firstStrike;
+    uint64_t pendingLightningTime;
+    uint64_t lastLightningTime;
+    bool replayPending;
+    uint8_t replaySettings[3];
+    SpiState spiState;
+    uint8_t spiAddress;
+    SimChipStats stats;
+    std::priority_queue<SimEvent, std::vector<SimEvent>, Later> events;
+
+    void preset();
+    uint8_t readRegister(uint8_t address);
+    void writeRegister(uint8_t address, uint8_t value);
+    void process(const SimEvent& event);
+    void replay(const SimEvent& event);
+    void raise(uint8_t interrupt);
+    bool isNoisy() const;
+    int getNoiseThreshold() const;
+    int getNoiseThreshold(int level) const;
+    double getLcoPeriod() const;
+    int quantizeDistance(int distance) const;
+};
+
+#endif
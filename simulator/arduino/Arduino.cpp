@@ -0,0 +1,193 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <vector>
+
+#include "Arduino.h"
+#include "Simulator.h"
+
+#define MAX_PINS 32
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static uint64_t simTime = 0;
+static std::vector<sim::Device*> devices;
+static void (*isrs[MAX_PINS])() = { NULL };
+
+uint64_t sim::yieldTime = 10;
+bool sim::quiet = false;
+
+void sim::attach(Device* device) {
+    devices.push_back(device);
+}
+
+void sim::detachAll() {
+    devices.clear();
+    for (int ix = 0; ix < MAX_PINS; ix++) {
+        isrs[ix] = NULL;
+    }
+    simTime = 0;
+}
+
+uint64_t sim::now() {
+    return simTime;
+}
+
+void sim::setTime(uint64_t time) {
+    if (time > simTime) {
+        simTime = time;
+    }
+}
+
+void sim::advance(uint64_t micros) {
+    uint64_t target = simTime + micros;
+    for (Device* device : devices) {
+        device->advanceTo(target);
+    }
+    simTime = target;
+}
+
+uint8_t sim::spiTransfer(uint8_t value) {
+    uint8_t result = 0xFF;
+    for (Device* device : devices) {
+        result &= device->spiTransfer(value);
+    }
+    return result;
+}
+
+void sim::interrupt(int pin) {
+    if (pin >= 0 && pin < MAX_PINS && isrs[pin] != NULL) {
+        isrs[pin]();
+    }
+}
+
+unsigned long millis() {
+    return (unsigned long) (simTime / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long) simTime;
+}
+
+void delay(unsigned long ms) {
+    sim::advance((uint64_t) ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    sim::advance(us);
+}
+
+void yield() {
+    sim::advance(sim::yieldTime);
+}
+
+void pinMode(int pin, int mode) {
+}
+
+void digitalWrite(int pin, int value) {
+    for (sim::Device* device : devices) {
+        device->pinWrite(pin, value);
+    }
+}
+
+int digitalPinToInterrupt(int pin) {
+    return pin;
+}
+
+void attachInterrupt(int interrupt, void (*isr)(), int mode) {
+    if (interrupt >= 0 && interrupt < MAX_PINS) {
+        isrs[interrupt] = isr;
+    }
+}
+
+void detachInterrupt(int interrupt) {
+    if (interrupt >= 0 && interrupt < MAX_PINS) {
+        isrs[interrupt] = NULL;
+    }
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (size-- > 0) {
+        written += write(*buffer++);
+    }
+    return written;
+}
+
+size_t Print::print(const char* str) {
+    return write((const uint8_t*) str, strlen(str));
+}
+
+size_t Print::print(const String& str) {
+    return write((const uint8_t*) str.c_str(), str.length());
+}
+
+size_t Print::print(long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%ld", value);
+    return print(buffer);
+}
+
+size_t Print::print(unsigned long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%lu", value);
+    return print(buffer);
+}
+
+size_t Print::print(int value) {
+    return print((long) value);
+}
+
+size_t Print::print(unsigned int value) {
+    return print((unsigned long) value);
+}
+
+size_t Print::println() {
+    return print("\n");
+}
+
+size_t Print::println(const char* str) {
+    return print(str) + println();
+}
+
+size_t Print::println(const String& str) {
+    return print(str) + println();
+}
+
+size_t Print::println(long value) {
+    return print(value) + println();
+}
+
+size_t Print::println(unsigned long value) {
+    return print(value) + println();
+}
+
+size_t Print::println(int value) {
+    return print(value) + println();
+}
+
+size_t Print::println(unsigned int value) {
+    return print(value) + println();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (!sim::quiet) {
+        fputc(c, stderr);
+    }
+    return 1;
+}
@@ -0,0 +1,107 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Arduino__
+#define __Arduino__
+
+/*
+ * A minimal mock of the Arduino API, just as much as the driver and the other firmware
+ * units need to be compiled and run on a Linux host.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WString.h"
+
+typedef uint8_t byte;
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+
+#define pgm_read_byte(addr)     (*(const uint8_t*) (addr))
+#define pgm_read_dword(addr)    (*(const uint32_t*) (addr))
+
+#define LOW     0
+#define HIGH    1
+#define INPUT   0
+#define OUTPUT  1
+#define RISING  1
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int interrupt, void (*isr)(), int mode);
+void detachInterrupt(int interrupt);
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    virtual void flush() {}
+    size_t print(const char* str);
+    size_t print(const String& str);
+    size_t print(long value);
+    size_t print(unsigned long value);
+    size_t print(int value);
+    size_t print(unsigned int value);
+    size_t println();
+    size_t println(const char* str);
+    size_t println(const String& str);
+    size_t println(long value);
+    size_t println(unsigned long value);
+    size_t println(int value);
+    size_t println(unsigned int value);
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud) {}
+    size_t write(uint8_t c) override;
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
+
+/**
+ * Mock of the ESP8266 system functions.
+ */
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 40000; }
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __EEPROM_Rotate__
+#define __EEPROM_Rotate__
+
+#include <Arduino.h>
+
+/**
+ * Mock of the EEPROM_Rotate library, keeping the EEPROM content in RAM.
+ */
+class EEPROM_Rotate {
+public:
+    void offset(int offset) {}
+    void begin(size_t size) {}
+    uint8_t read(int address) { return data[address]; }
+    void write(int address, uint8_t value) { data[address] = value; }
+    bool commit() { commits++; return true; }
+    uint8_t* getDataPtr() { return data; }
+
+    template<typename T> T& get(int address, T& target) {
+        memcpy(&target, data + address, sizeof(T));
+        return target;
+    }
+
+    template<typename T> const T& put(int address, const T& source) {
+        memcpy(data + address, &source, sizeof(T));
+        return source;
+    }
+
+    /**
+     * Number of commits since start.
+     */
+    unsigned long commits = 0;
+
+private:
+    uint8_t data[4096] = {0};
+};
+
+#endif
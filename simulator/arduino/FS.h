@@ -0,0 +1,99 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __FS__
+#define __FS__
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum SeekMode {
+    SeekSet,
+    SeekCur,
+    SeekEnd,
+};
+
+namespace fs {
+
+typedef std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> FileMap;
+
+/**
+ * An open file of the in-memory file system.
+ */
+class File {
+public:
+    File() : position(0) {}
+    File(std::shared_ptr<std::vector<uint8_t>> data, size_t position) : data(data), position(position) {}
+
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t read(uint8_t* buffer, size_t size);
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    bool truncate(uint32_t size);
+    size_t size() const { return data ? data->size() : 0; }
+    void close() { data.reset(); }
+    operator bool() const { return (bool) data; }
+
+private:
+    std::shared_ptr<std::vector<uint8_t>> data;
+    size_t position;
+};
+
+/**
+ * Iterates over the files of a directory.
+ */
+class Dir {
+public:
+    Dir() {}
+    Dir(const FileMap& files, const std::string& prefix);
+
+    bool next();
+    String fileName() const { return String(current->first.substr(prefix.length()).c_str()); }
+    size_t fileSize() const { return current->second->size(); }
+    File openFile(const char* mode);
+
+private:
+    FileMap files;
+    std::string prefix;
+    FileMap::const_iterator current;
+    bool started = false;
+};
+
+/**
+ * Mock of a flash file system, kept in memory. Directories are only path prefixes.
+ */
+class FS {
+public:
+    bool begin() { return true; }
+    File open(const char* path, const char* mode);
+    bool exists(const char* path) { return files.count(path) > 0; }
+    bool remove(const char* path) { return files.erase(path) > 0; }
+    bool mkdir(const char* path) { return true; }
+    Dir openDir(const char* path);
+
+private:
+    FileMap files;
+};
+
+}
+
+using fs::File;
+using fs::Dir;
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "LittleFS.h"
+
+fs::FS LittleFS;
+
+size_t fs::File::write(const uint8_t* buffer, size_t size) {
+    if (!data) {
+        return 0;
+    }
+    if (data->size() < position + size) {
+        data->resize(position + size);
+    }
+    memcpy(data->data() + position, buffer, size);
+    position += size;
+    return size;
+}
+
+size_t fs::File::read(uint8_t* buffer, size_t size) {
+    if (!data || position >= data->size()) {
+        return 0;
+    }
+    if (size > data->size() - position) {
+        size = data->size() - position;
+    }
+    memcpy(buffer, data->data() + position, size);
+    position += size;
+    return size;
+}
+
+bool fs::File::seek(uint32_t pos, SeekMode mode) {
+    if (!data) {
+        return false;
+    }
+    size_t base = mode == SeekSet ? 0 : mode == SeekCur ? position : data->size();
+    if (base + pos > data->size()) {
+        return false;
+    }
+    position = base + pos;
+    return true;
+}
+
+bool fs::File::truncate(uint32_t size) {
+    if (!data) {
+        return false;
+    }
+    data->resize(size);
+    if (position > size) {
+        position = size;
+    }
+    return true;
+}
+
+fs::Dir::Dir(const FileMap& files, const std::string& prefix) : files(files), prefix(prefix) {
+}
+
+bool fs::Dir::next() {
+    current = started ? std::next(current) : files.lower_bound(prefix);
+    started = true;
+    while (current != files.end() && current->first.compare(0, prefix.length(), prefix) == 0) {
+        if (current->first.find('/', prefix.length()) == std::string::npos) {
+            return true;
+        }
+        ++current;
+    }
+    current = files.end();
+    return false;
+}
+
+fs::File fs::Dir::openFile(const char* mode) {
+    size_t position = mode[0] == 'a' ? current->second->size() : 0;
+    if (mode[0] == 'w') {
+        current->second->clear();
+    }
+    return File(current->second, position);
+}
+
+fs::File fs::FS::open(const char* path, const char* mode) {
+    FileMap::iterator it = files.find(path);
+    if (it == files.end()) {
+        if (mode[0] == 'r') {
+            return File();
+        }
+        it = files.insert(std::make_pair(std::string(path), std::make_shared<std::vector<uint8_t>>())).first;
+    }
+    size_t position = mode[0] == 'a' ? it->second->size() : 0;
+    if (mode[0] == 'w') {
+        it->second->clear();
+    }
+    return File(it->second, position);
+}
+
+fs::Dir fs::FS::openDir(const char* path) {
+    return Dir(files, std::string(path) + "/");
+}
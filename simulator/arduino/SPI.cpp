@@ -0,0 +1,41 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "SPI.h"
+#include "Simulator.h"
+
+SPIClass SPI;
+
+void SPIClass::beginTransaction(SPISettings settings) {
+    transactions++;
+}
+
+void SPIClass::endTransaction() {
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    return sim::spiTransfer(data);
+}
+
+void SPIClass::transferBytes(const uint8_t* out, uint8_t* in, uint32_t size) {
+    for (uint32_t ix = 0; ix < size; ix++) {
+        uint8_t result = sim::spiTransfer(out != NULL ? out[ix] : 0xFF);
+        if (in != NULL) {
+            in[ix] = result;
+        }
+    }
+}
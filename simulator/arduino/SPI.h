@@ -0,0 +1,51 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SPI__
+#define __SPI__
+
+#include <Arduino.h>
+
+#define MSBFIRST    1
+#define SPI_MODE0   0
+#define SPI_MODE1   1
+
+struct SPISettings {
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {}
+};
+
+/**
+ * Mock of the SPI bus. Transfers are passed to all attached simulated devices.
+ */
+class SPIClass {
+public:
+    void begin() {}
+    void end() {}
+    void beginTransaction(SPISettings settings);
+    void endTransaction();
+    uint8_t transfer(uint8_t data);
+    void transferBytes(const uint8_t* out, uint8_t* in, uint32_t size);
+
+    /**
+     * Number of transactions since start.
+     */
+    unsigned long transactions = 0;
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __Simulator__
+#define __Simulator__
+
+#include <stdint.h>
+
+/**
+ * The simulated hardware environment of the mock Arduino layer.
+ *
+ * Time is virtual. It only advances when the simulation advances it, or when the code
+ * under test invokes delay() or yield().
+ */
+namespace sim {
+
+    /**
+     * A simulated device that is connected to the microcontroller.
+     */
+    class Device {
+    public:
+        virtual ~Device() {}
+
+        /**
+         * A GPIO pin was set.
+         */
+        virtual void pinWrite(int pin, int value) {}
+
+        /**
+         * Transfer a byte via SPI. Only the selected device should respond.
+         *
+         * @return Received byte, or 0xFF if the device is not selected
+         */
+        virtual uint8_t spiTransfer(uint8_t value) { return 0xFF; }
+
+        /**
+         * Advance the device state to the given time. Interrupts must be raised in
+         * chronological order, after setting the clock via setTime().
+         */
+        virtual void advanceTo(uint64_t time) {}
+    };
+
+    /**
+     * Connect a device to the microcontroller.
+     */
+    void attach(Device* device);
+
+    /**
+     * Disconnect all devices, and reset the clock and interrupts.
+     */
+    void detachAll();
+
+    /**
+     * Current time, in microseconds.
+     */
+    uint64_t now();
+
+    /**
+     * Set the clock. Must only be used by devices while advancing.
+     */
+    void setTime(uint64_t time);
+
+    /**
+     * Advance the time by the given number of microseconds.
+     */
+    void advance(uint64_t micros);
+
+    /**
+     * Transfer a byte on the SPI bus. All devices receive the byte. Unselected devices
+     * answer 0xFF, like a floating MISO line with a pull-up, so the answers are ANDed.
+     */
+    uint8_t spiTransfer(uint8_t value);
+
+    /**
+     * Raise a rising edge on an interrupt pin, invoking the attached ISR.
+     */
+    void interrupt(int pin);
+
+    /**
+     * Time that is consumed by every yield() call, in microseconds.
+     */
+    extern uint64_t yieldTime;
+
+    /**
+     * true to suppress the Serial output of the code under test.
+     */
+    extern bool quiet;
+}
+
+#endif
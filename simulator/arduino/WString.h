@@ -0,0 +1,72 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __WString__
+#define __WString__
+
+#include <stdlib.h>
+#include <string>
+
+/**
+ * Mock of the Arduino String, backed by a std::string.
+ */
+class String {
+public:
+    String() {}
+    String(const char* str) : value(str != NULL ? str : "") {}
+    String(char c) : value(1, c) {}
+    String(int number) : value(std::to_string(number)) {}
+    String(unsigned int number) : value(std::to_string(number)) {}
+    String(long number) : value(std::to_string(number)) {}
+    String(unsigned long number) : value(std::to_string(number)) {}
+
+    const char* c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.length(); }
+    void reserve(unsigned int size) { value.reserve(size); }
+    char charAt(unsigned int index) const { return value[index]; }
+    char operator[](unsigned int index) const { return value[index]; }
+    long toInt() const { return atol(value.c_str()); }
+
+    int indexOf(char c) const { return position(value.find(c)); }
+    int indexOf(const char* str) const { return position(value.find(str)); }
+    int indexOf(const String& str) const { return position(value.find(str.value)); }
+    bool startsWith(const String& prefix) const { return value.compare(0, prefix.value.length(), prefix.value) == 0; }
+    String substring(unsigned int from) const { return String(value.substr(from)); }
+    String substring(unsigned int from, unsigned int to) const { return String(value.substr(from, to - from)); }
+
+    String& operator+=(const String& str) { value += str.value; return *this; }
+    String& operator+=(const char* str) { value += str; return *this; }
+    String& operator+=(char c) { value += c; return *this; }
+    bool concat(const char* str, unsigned int length) { value.append(str, length); return true; }
+
+    bool operator==(const String& str) const { return value == str.value; }
+    bool operator==(const char* str) const { return value == str; }
+    bool operator!=(const String& str) const { return value != str.value; }
+    bool operator!=(const char* str) const { return value != str; }
+
+    friend String operator+(const String& a, const String& b) { return String(a.value + b.value); }
+    friend String operator+(const String& a, const char* b) { return String(a.value + b); }
+
+private:
+    std::string value;
+
+    explicit String(const std::string& str) : value(str) {}
+
+    static int position(size_t pos) { return pos == std::string::npos ? -1 : (int) pos; }
+};
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __WiFiClient__
+#define __WiFiClient__
+
+#include <Arduino.h>
+
+/**
+ * Mock of a TCP client. It is never connected, so the web server units can be compiled
+ * and linked on the host.
+ */
+class WiFiClient : public Stream {
+public:
+    size_t write(uint8_t c) override { return 0; }
+    size_t write(const uint8_t* buffer, size_t size) override { return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int read(uint8_t* buffer, size_t size) { return 0; }
+    size_t availableForWrite() { return 0; }
+    uint8_t connected() { return 0; }
+    void setNoDelay(bool noDelay) {}
+    void stop() {}
+    operator bool() { return false; }
+};
+
+#endif
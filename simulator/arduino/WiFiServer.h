@@ -0,0 +1,35 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __WiFiServer__
+#define __WiFiServer__
+
+#include <WiFiClient.h>
+
+/**
+ * Mock of a TCP server. No client ever connects.
+ */
+class WiFiServer {
+public:
+    WiFiServer(int port) {}
+    void begin() {}
+    void setNoDelay(bool noDelay) {}
+    bool hasClient() { return false; }
+    WiFiClient available() { return WiFiClient(); }
+};
+
+#endif
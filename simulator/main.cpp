@@ -0,0 +1,809 @@
+/*
+ * Kaminari
+ *
+ * Copyright (C) 2020 Richard "Shred" Körber
+ *   https://codeberg.org/shred/kaminari
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Runs the AS3935 driver against a virtual AS3935 on the host, feeding it with a
+ * scripted or randomized storm, or with a capture of a real detector, and reports event
+ * loss, latency and driver costs.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AS3935.h"
+#include "CaptureRing.h"
+#include "Config.h"
+#include "NoiseController.h"
+#include "Simulator.h"
+#include "VirtualAS3935.h"
+
+#define SPI_CS   15     // same pins as the firmware
+#define AS_INT    5
+
+#define BASELINE_NOISE 20   // Environmental noise without noise bursts, in µVrms
+#define DRAIN_TIME 1000000  // Time to run after the last event, in µs
+
+struct Options {
+    const char* script = NULL;
+    const char* replay = NULL;
+    const char* capture = NULL;
+    const char* dump = NULL;
+    int detector = 0;
+    unsigned long duration = 600;
+    double lightningRate = 6.0;
+    double disturberRate = 30.0;
+    double noiseRate = 6.0;
+    unsigned long seed = 1;
+    unsigned long loopTime = 1000;
+    unsigned long stallTime = 100;
+    double stallRate = 0.0;
+    unsigned long maxFrequency = 530000;
+    int outdoor = -1;
+    int watchdog = -1;
+    int spikeRejection = -1;
+    int minLightning = -1;
+    int adaptive = -1;
+    int recoveryTime = -1;
+    int disturberLimit = -1;
+    bool verbose = false;
+    bool quiet = false;
+    bool failOnLoss = false;
+    bool failOnDivergence = false;
+    bool failOnNoApproach = false;
+    bool failOnDrift = false;
+    long maxSetup = -1;
+};
+
+/**
+ * A change of the configuration while the simulation is running.
+ */
+struct SimSetting {
+    uint64_t time;
+    std::string name;
+    int value;
+};
+
+static VirtualAS3935* chip = NULL;
+static AS3935 detector(SPI_CS, AS_INT);
+static ConfigManager cfgMgr;
+static AdaptiveNoiseController adaptiveNoiseController;
+
+static std::vector<double> latencies;       // in ms
+static std::vector<long> timeErrors;        // in ms
+static std::vector<double> energies;
+static std::vector<double> distances;       // in km, only lightnings within range
+static unsigned long recordedDisturbers = 0;
+static unsigned long noiseFloorChanges = 0;
+static bool verbose = false;
+
+static const int minNumLightning[] = { 1, 5, 9, 16 };
+
+/**
+ * Writes the output of a Print to a file.
+ */
+class FilePrint : public Print {
+public:
+    FilePrint(FILE* file) : file(file) {}
+
+    size_t write(uint8_t c) override {
+        return fputc(c, file) != EOF ? 1 : 0;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        return fwrite(buffer, 1, size, file);
+    }
+
+private:
+    FILE* file;
+};
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: kaminari-sim [options]\n"
+        "\n"
+        "Storm:\n"
+        "  --script FILE        read events from FILE instead of a random storm\n"
+        "  --duration S         duration of the random storm, in s (default 600)\n"
+        "  --lightnings N       lightnings per minute (default 6)\n"
+        "  --disturbers N       disturbers per minute (default 30)\n"
+        "  --noise N            noise bursts per hour (default 6)\n"
+        "  --seed N             random seed (default 1)\n"
+        "  --replay FILE        replay the interrupts of a capture blob instead\n"
+        "  --detector N         detector of the capture blob to replay (default 0)\n"
+        "\n"
+        "Firmware:\n"
+        "  --loop US            duration of a main loop iteration, in us (default 1000)\n"
+        "  --stall-rate P       probability that a loop iteration stalls (default 0)\n"
+        "  --stall MS           duration of a stall, in ms (default 100)\n"
+        "  --outdoor            use outdoor mode\n"
+        "  --watchdog N         watchdog threshold (0..15)\n"
+        "  --spike N            spike rejection (0..15)\n"
+        "  --min-lightnings N   minimum number of lightning (1, 5, 9, 16)\n"
+        "  --noise-control C    noise floor controller, 'balance' or 'adaptive'\n"
+        "  --recovery S         recovery time of the adaptive controller, in s\n"
+        "  --disturber-limit N  disturbers per minute before the adaptive controller\n"
+        "                       raises watchdog threshold and spike rejection\n"
+        "\n"
+        "Chip:\n"
+        "  --lco HZ             LCO frequency with all tuning capacitors off (default 530000)\n"
+        "\n"
+        "Output:\n"
+        "  --verbose            log every event\n"
+        "  --quiet              suppress the serial output of the driver\n"
+        "  --fail-on-loss       exit with 1 if a reported lightning was not recorded\n"
+        "  --fail-on-divergence exit with 1 if the settings of a replay differ from\n"
+        "                       the captured ones\n"
+        "  --fail-on-no-approach exit with 1 if the storm is not tracked as approaching,\n"
+        "                       with a speed and an ETA\n"
+        "  --fail-on-drift      exit with 1 if the final watchdog threshold or spike\n"
+        "                       rejection differ from the configured ones\n"
+        "  --max-setup N        exit with 1 if applying the detector configuration\n"
+        "                       takes more than N SPI transactions\n"
+        "  --capture FILE       write all interrupts of the run to a capture blob\n"
+        "  --dump FILE          print the records of a capture blob, and exit\n");
+}
+
+static bool parseOptions(int argc, char** argv, Options& opt) {
+    for (int ix = 1; ix < argc; ix++) {
+        std::string arg = argv[ix];
+        const char* value = ix + 1 < argc ? argv[ix + 1] : NULL;
+
+        if (arg == "--outdoor") {
+            opt.outdoor = 1;
+        } else if (arg == "--verbose") {
+            opt.verbose = true;
+        } else if (arg == "--quiet") {
+            opt.quiet = true;
+        } else if (arg == "--fail-on-loss") {
+            opt.failOnLoss = true;
+        } else if (arg == "--fail-on-divergence") {
+            opt.failOnDivergence = true;
+        } else if (arg == "--fail-on-no-approach") {
+            opt.failOnNoApproach = true;
+        } else if (arg == "--fail-on-drift") {
+            opt.failOnDrift = true;
+        } else if (value == NULL) {
+            return false;
+        } else {
+            ix++;
+            if (arg == "--script") {
+                opt.script = value;
+            } else if (arg == "--replay") {
+                opt.replay = value;
+            } else if (arg == "--detector") {
+                opt.detector = atoi(value);
+            } else if (arg == "--capture") {
+                opt.capture = value;
+            } else if (arg == "--dump") {
+                opt.dump = value;
+            } else if (arg == "--duration") {
+                opt.duration = strtoul(value, NULL, 10);
+            } else if (arg == "--lightnings") {
+                opt.lightningRate = atof(value);
+            } else if (arg == "--disturbers") {
+                opt.disturberRate = atof(value);
+            } else if (arg == "--noise") {
+                opt.noiseRate = atof(value);
+            } else if (arg == "--seed") {
+                opt.seed = strtoul(value, NULL, 10);
+            } else if (arg == "--loop") {
+                opt.loopTime = strtoul(value, NULL, 10);
+            } else if (arg == "--stall-rate") {
+                opt.stallRate = atof(value);
+            } else if (arg == "--stall") {
+                opt.stallTime = strtoul(value, NULL, 10);
+            } else if (arg == "--watchdog") {
+                opt.watchdog = atoi(value);
+            } else if (arg == "--spike") {
+                opt.spikeRejection = atoi(value);
+            } else if (arg == "--min-lightnings") {
+                opt.minLightning = atoi(value);
+            } else if (arg == "--noise-control") {
+                std::string controller = value;
+                if (controller != "balance" && controller != "adaptive") {
+                    return false;
+                }
+                opt.adaptive = controller == "adaptive" ? 1 : 0;
+            } else if (arg == "--recovery") {
+                opt.recoveryTime = atoi(value);
+            } else if (arg == "--disturber-limit") {
+                opt.disturberLimit = atoi(value);
+            } else if (arg == "--max-setup") {
+                opt.maxSetup = atol(value);
+            } else if (arg == "--lco") {
+                opt.maxFrequency = strtoul(value, NULL, 10);
+            } else {
+                return false;
+            }
+        }
+    }
+    return opt.loopTime > 0;
+}
+
+/**
+ * Return true if the configuration can be changed by a script.
+ */
+static bool isSetting(const std::string& name) {
+    return name == "watchdogThreshold" || name == "spikeRejection" || name == "outdoorMode"
+        || name == "adaptiveNoiseFloor" || name == "noiseRecoveryTime" || name == "disturberLimit";
+}
+
+/**
+ * Set up the noise controller, same as the firmware.
+ */
+static void setupNoiseController() {
+    adaptiveNoiseController.setRecoveryTime(cfgMgr.config.noiseRecoveryTime * 1000UL);
+    adaptiveNoiseController.setDisturberLimit(cfgMgr.config.disturberLimit);
+    detector.setNoiseController(cfgMgr.config.adaptiveNoiseFloor ? &adaptiveNoiseController : NULL);
+}
+
+/**
+ * Change the configuration, same as the /update endpoint of the firmware.
+ */
+static void applySetting(const SimSetting& setting) {
+    if (verbose) {
+        printf("%10.3f set %s=%d\n", sim::now() / 1000000.0, setting.name.c_str(), setting.value);
+    }
+    if (setting.name == "watchdogThreshold") {
+        cfgMgr.config.watchdogThreshold = setting.value;
+        detector.setWatchdogThreshold(setting.value);
+        detector.clearStatistics();
+    } else if (setting.name == "spikeRejection") {
+        cfgMgr.config.spikeRejection = setting.value;
+        detector.setSpikeRejection(setting.value);
+        detector.clearStatistics();
+    } else if (setting.name == "outdoorMode") {
+        cfgMgr.config.outdoorMode = setting.value != 0;
+        detector.setOutdoorMode(setting.value != 0);
+        detector.clearStatistics();
+    } else if (setting.name == "adaptiveNoiseFloor") {
+        cfgMgr.config.adaptiveNoiseFloor = setting.value != 0;
+        setupNoiseController();
+    } else if (setting.name == "noiseRecoveryTime") {
+        cfgMgr.config.noiseRecoveryTime = setting.value;
+        setupNoiseController();
+    } else if (setting.name == "disturberLimit") {
+        cfgMgr.config.disturberLimit = setting.value;
+        setupNoiseController();
+    }
+}
+
+/**
+ * Read a storm script. Every line contains the time in ms, the event type and its
+ * parameters:
+ *
+ *   <ms> lightning <distance km> <energy> [signal]
+ *   <ms> disturber [signal]
+ *   <ms> noise <uVrms>
+ *   <ms> set <name> <value>
+ *
+ * A "set" line changes the configuration, like the /update endpoint of the firmware. The
+ * names are watchdogThreshold, spikeRejection, outdoorMode, adaptiveNoiseFloor,
+ * noiseRecoveryTime and disturberLimit. Empty lines and lines starting with '#' are ignored.
+ */
+static bool readScript(const char* file, uint64_t start, std::vector<SimEvent>& events,
+        std::vector<SimSetting>& settings) {
+    std::ifstream in(file);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", file);
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        std::string type;
+        double ms;
+        if (!(fields >> ms)) {
+            if (line.find_first_not_of(" \t") == std::string::npos || line[line.find_first_not_of(" \t")] == '#') {
+                continue;
+            }
+            fprintf(stderr, "%s:%d: bad time\n", file, lineNumber);
+            return false;
+        }
+        fields >> type;
+
+        SimEvent event = SimEvent();
+        event.time = start + (uint64_t) (ms * 1000.0);
+        event.signal = 15;
+        if (type == "lightning") {
+            event.type = SIM_LIGHTNING;
+            if (!(fields >> event.distance >> event.energy)) {
+                fprintf(stderr, "%s:%d: lightning needs distance and energy\n", file, lineNumber);
+                return false;
+            }
+            fields >> event.signal;
+        } else if (type == "disturber") {
+            event.type = SIM_DISTURBER;
+            fields >> event.signal;
+        } else if (type == "noise") {
+            event.type = SIM_NOISE;
+            if (!(fields >> event.noise)) {
+                fprintf(stderr, "%s:%d: noise needs a level\n", file, lineNumber);
+                return false;
+            }
+        } else if (type == "set") {
+            SimSetting setting;
+            setting.time = event.time;
+            if (!(fields >> setting.name >> setting.value) || !isSetting(setting.name)) {
+                fprintf(stderr, "%s:%d: set needs a setting and a value\n", file, lineNumber);
+                return false;
+            }
+            settings.push_back(setting);
+            continue;
+        } else {
+            fprintf(stderr, "%s:%d: unknown event '%s'\n", file, lineNumber, type.c_str());
+            return false;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+/**
+ * Read a capture blob, as written by CaptureRing.
+ */
+static bool readCapture(const char* file, CaptureHeader& header, std::vector<CaptureRecord>& records) {
+    FILE* in = fopen(file, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Cannot open %s\n", file);
+        return false;
+    }
+
+    bool valid = fread(&header, sizeof(header), 1, in) == 1
+            && memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == CAPTURE_VERSION
+            && header.recordSize == sizeof(CaptureRecord);
+    if (valid) {
+        records.resize(header.count);
+        valid = fread(records.data(), sizeof(CaptureRecord), header.count, in) == header.count;
+    }
+    fclose(in);
+    if (!valid) {
+        fprintf(stderr, "%s: not a capture blob of version %d\n", file, CAPTURE_VERSION);
+    }
+    return valid;
+}
+
+/**
+ * Print the records of a capture blob, one per line.
+ */
+static void dumpCapture(const CaptureHeader& header, const std::vector<CaptureRecord>& records) {
+    printf("# %u records, %lu overwritten, started at %lu ms, written at %lu ms, epoch %lu\n",
+        header.count, (unsigned long) header.overwritten, (unsigned long) header.start,
+        (unsigned long) header.time, (unsigned long) header.epoch);
+    printf("#   time ms det int energy   dist afe nf wd srej minl delay us lost\n");
+    for (const CaptureRecord& record : records) {
+        const uint8_t* reg = record.registers;
+        unsigned long energy = ((unsigned long) (reg[0x06] & 0x1F) << 16) | (reg[0x05] << 8) | reg[0x04];
+        printf("%11lu %3u  %x %8lu %4u  %02x %2u %2u %4u %4u %8u %4u\n",
+            (unsigned long) record.time, record.detector, reg[0x03] & 0x0F, energy,
+            reg[0x07] & 0x3F, reg[0x00] & 0x3F, (reg[0x01] >> 4) & 0x07, reg[0x01] & 0x0F,
+            reg[0x02] & 0x0F, (reg[0x02] >> 4) & 0x03, record.delay, record.lost);
+    }
+}
+
+/**
+ * Turn the records of a detector into captured events. The replay starts at the time
+ * the capture was started, so the interrupts keep their timing relative to it.
+ */
+static void replayCapture(const CaptureHeader& header, const std::vector<CaptureRecord>& records,
+        int detector, uint64_t start, std::vector<SimEvent>& events) {
+    for (const CaptureRecord& record : records) {
+        if (record.detector != detector) {
+            continue;
+        }
+        // An interrupt may have occurred shortly before capturing was started
+        int32_t offset = (int32_t) (record.time - header.start);
+        SimEvent event = SimEvent();
+        event.time = start + (uint64_t) std::max(offset, (int32_t) 0) * 1000;
+        event.type = SIM_CAPTURED;
+        memcpy(event.registers, record.registers, sizeof(event.registers));
+        events.push_back(event);
+    }
+}
+
+/**
+ * Generate a random storm. The storm front approaches from 40 km, passes overhead at
+ * half time, and moves away again. Lightnings, disturbers and noise bursts are Poisson
+ * distributed.
+ */
+static void generateStorm(const Options& opt, uint64_t start, std::vector<SimEvent>& events) {
+    std::mt19937 rng(opt.seed);
+    std::uniform_int_distribution<int> signal(0, 15);
+    std::uniform_int_distribution<unsigned long> energy(1000, 0x1FFFFF);
+    std::normal_distribution<double> scatter(0.0, 2.0);
+    std::uniform_int_distribution<int> burstLevel(50, 600);
+    std::uniform_real_distribution<double> burstLength(5.0, 60.0);
+    double duration = opt.duration;
+
+    SimEvent baseline = SimEvent();
+    baseline.time = start;
+    baseline.type = SIM_NOISE;
+    baseline.noise = BASELINE_NOISE;
+    events.push_back(baseline);
+
+    if (opt.lightningRate > 0.0) {
+        std::exponential_distribution<double> next(opt.lightningRate / 60.0);
+        for (double t = next(rng); t < duration; t += next(rng)) {
+            double front = 40.0 * (t < duration / 2 ? 1.0 - 2.0 * t / duration : 2.0 * t / duration - 1.0);
+            SimEvent event = SimEvent();
+            event.time = start + (uint64_t) (t * 1000000.0);
+            event.type = SIM_LIGHTNING;
+            event.distance = std::max(0, (int) (front + scatter(rng)));
+            event.energy = energy(rng);
+            event.signal = signal(rng);
+            events.push_back(event);
+        }
+    }
+
+    if (opt.disturberRate > 0.0) {
+        std::exponential_distribution<double> next(opt.disturberRate / 60.0);
+        for (double t = next(rng); t < duration; t += next(rng)) {
+            SimEvent event = SimEvent();
+            event.time = start + (uint64_t) (t * 1000000.0);
+            event.type = SIM_DISTURBER;
+            event.signal = signal(rng);
+            events.push_back(event);
+        }
+    }
+
+    if (opt.noiseRate > 0.0) {
+        std::exponential_distribution<double> next(opt.noiseRate / 3600.0);
+        for (double t = next(rng); t < duration; t += next(rng)) {
+            SimEvent event = SimEvent();
+            event.time = start + (uint64_t) (t * 1000000.0);
+            event.type = SIM_NOISE;
+            event.noise = burstLevel(rng);
+            events.push_back(event);
+
+            t += burstLength(rng);
+            event.time = start + (uint64_t) (t * 1000000.0);
+            event.noise = BASELINE_NOISE;
+            events.push_back(event);
+        }
+    }
+}
+
+static void onDetectorEvent(AS3935& source, AS3935Event event) {
+    switch (event) {
+        case AS3935_LIGHTNING: {
+            const Lightning& lightning = source.getLightnings()[0];
+            uint64_t eventTime = chip->getLastLightningTime();
+            latencies.push_back((sim::now() - eventTime) / 1000.0);
+            timeErrors.push_back((long) lightning.time - (long) (eventTime / 1000));
+            energies.push_back(lightning.energy);
+            if (lightning.distance < 0x3F) {
+                distances.push_back(lightning.distance);
+            }
+            if (!verbose) {
+                break;
+            }
+            StormStatus storm;
+            source.getStormStatus(storm);
+            printf("%10.3f lightning  distance=%u energy=%lu latency=%.3f ms"
+                " storm=%.1f km speed=%.1f km/h eta=%ld s\n",
+                sim::now() / 1000000.0, (unsigned int) lightning.distance,
+                (unsigned long) lightning.energy, latencies.back(),
+                storm.distance, storm.speed, storm.eta);
+            break;
+        }
+
+        case AS3935_DISTURBER:
+            recordedDisturbers++;
+            break;
+
+        case AS3935_NOISE_FLOOR:
+            noiseFloorChanges++;
+            if (verbose) {
+                printf("%10.3f noise floor %d uVrms\n", sim::now() / 1000000.0, detector.getNoiseFloorLevel());
+            }
+            break;
+    }
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t index = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+/**
+ * Print the estimated quantiles of a sketch, and the exact ones of all values.
+ */
+static void printQuantiles(const char* name, const QuantileSketch& sketch, std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    printf("%-17s p50 %.1f (%.1f), p90 %.1f (%.1f), p99 %.1f (%.1f), %lu values\n", name,
+        sketch.getQuantile(QUANTILE_50), percentile(values, 0.5),
+        sketch.getQuantile(QUANTILE_90), percentile(values, 0.9),
+        sketch.getQuantile(QUANTILE_99), percentile(values, 0.99),
+        sketch.getCount());
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    sim::quiet = opt.quiet;
+    verbose = opt.verbose;
+
+    CaptureHeader captureHeader;
+    std::vector<CaptureRecord> captured;
+    if (opt.dump != NULL) {
+        if (!readCapture(opt.dump, captureHeader, captured)) {
+            return 2;
+        }
+        dumpCapture(captureHeader, captured);
+        return 0;
+    }
+
+    // A replay uses the configuration of the first captured interrupt, unless it is given
+    // explicitly. The noise floor level is left to the noise controller, as in the firmware.
+    const CaptureRecord* initial = NULL;
+    if (opt.replay != NULL) {
+        if (!readCapture(opt.replay, captureHeader, captured)) {
+            return 2;
+        }
+        for (const CaptureRecord& record : captured) {
+            if (record.detector == opt.detector) {
+                initial = &record;
+                break;
+            }
+        }
+        if (initial == NULL) {
+            fprintf(stderr, "%s: no interrupts of detector %d\n", opt.replay, opt.detector);
+            return 2;
+        }
+        const uint8_t* reg = initial->registers;
+        if (opt.outdoor < 0) opt.outdoor = reg[0x00] == 0x1C ? 1 : 0;
+        if (opt.watchdog < 0) opt.watchdog = reg[0x01] & 0x0F;
+        if (opt.spikeRejection < 0) opt.spikeRejection = reg[0x02] & 0x0F;
+        if (opt.minLightning < 0) opt.minLightning = minNumLightning[(reg[0x02] >> 4) & 0x03];
+    }
+
+    VirtualAS3935 as3935(SPI_CS, AS_INT, opt.maxFrequency);
+    chip = &as3935;
+    sim::attach(chip);
+
+    // Same start up sequence as the firmware
+    cfgMgr.begin();
+    if (opt.outdoor >= 0) cfgMgr.config.outdoorMode = opt.outdoor != 0;
+    if (opt.watchdog >= 0) cfgMgr.config.watchdogThreshold = opt.watchdog;
+    if (opt.spikeRejection >= 0) cfgMgr.config.spikeRejection = opt.spikeRejection;
+    if (opt.minLightning >= 0) cfgMgr.config.minimumNumberOfLightning = opt.minLightning;
+    if (opt.adaptive >= 0) cfgMgr.config.adaptiveNoiseFloor = opt.adaptive != 0;
+    if (opt.recoveryTime >= 0) cfgMgr.config.noiseRecoveryTime = opt.recoveryTime;
+    if (opt.disturberLimit >= 0) cfgMgr.config.disturberLimit = opt.disturberLimit;
+
+    detector.begin();
+    detector.onEvent(onDetectorEvent);
+    detector.reset();
+    unsigned long frequency = detector.calibrate();
+    unsigned long setupTransactions = SPI.transactions;
+    SimChipStats setupStats = as3935.getStats();
+    AS3935Settings settings;
+    settings.outdoorMode = cfgMgr.config.outdoorMode;
+    settings.watchdogThreshold = cfgMgr.config.watchdogThreshold;
+    settings.minimumNumberOfLightning = cfgMgr.config.minimumNumberOfLightning;
+    settings.spikeRejection = cfgMgr.config.spikeRejection;
+    detector.configure(settings);
+    setupTransactions = SPI.transactions - setupTransactions;
+    unsigned long setupFrames = as3935.getStats().spiFrames - setupStats.spiFrames;
+    setupNoiseController();
+    detector.clearStatistics();
+    detector.clearDetections();
+
+    CaptureRing captureRing;
+    if (opt.capture != NULL) {
+        captureRing.begin();
+        detector.setCapture(&captureRing);
+    }
+
+    uint64_t start = sim::now();
+    uint64_t calibrationTime = start;
+    unsigned long spiTransactionsBefore = SPI.transactions;
+    SimChipStats statsBefore = as3935.getStats();
+
+    std::vector<SimEvent> events;
+    std::vector<SimSetting> settingChanges;
+    if (opt.replay != NULL) {
+        replayCapture(captureHeader, captured, opt.detector, start, events);
+    } else if (opt.script != NULL) {
+        if (!readScript(opt.script, start, events, settingChanges)) {
+            return 2;
+        }
+    } else {
+        generateStorm(opt, start, events);
+    }
+    uint64_t end = start;
+    for (const SimEvent& event : events) {
+        as3935.schedule(event);
+        end = std::max(end, event.time);
+    }
+    std::stable_sort(settingChanges.begin(), settingChanges.end(), [](const SimSetting& a, const SimSetting& b) {
+        return a.time < b.time;
+    });
+    for (const SimSetting& change : settingChanges) {
+        end = std::max(end, change.time);
+    }
+    end += DRAIN_TIME;
+
+    // Main loop
+    std::mt19937 loopRng(opt.seed + 1);
+    std::uniform_real_distribution<double> stallDice(0.0, 1.0);
+    unsigned long iterations = 0;
+    unsigned long stalls = 0;
+    unsigned long changes = 0;
+    double hostNanos = 0.0;
+    double hostMaxNanos = 0.0;
+    uint64_t tooHighTime = 0;
+    uint64_t tooLowTime = 0;
+    uint64_t excessLevelTime = 0;
+    size_t nextSetting = 0;
+    while (sim::now() < end) {
+        while (nextSetting < settingChanges.size() && settingChanges[nextSetting].time <= sim::now()) {
+            applySetting(settingChanges[nextSetting++]);
+        }
+
+        auto before = std::chrono::steady_clock::now();
+        if (detector.update()) {
+            changes++;
+        }
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+        hostNanos += nanos;
+        hostMaxNanos = std::max(hostMaxNanos, nanos);
+        iterations++;
+
+        uint64_t step = opt.loopTime;
+        if (opt.stallRate > 0.0 && stallDice(loopRng) < opt.stallRate) {
+            step += (uint64_t) opt.stallTime * 1000;
+            stalls++;
+        }
+
+        // Compare the noise floor level with the level that the noise would require
+        int level = (as3935.getRegister(0x01) >> 4) & 0x07;
+        int required = as3935.getRequiredNoiseFloorLevel();
+        if (level > required) {
+            tooHighTime += step;
+            excessLevelTime += step * (level - required);
+        } else if (level < required && required <= 7) {
+            tooLowTime += step;
+        }
+
+        sim::advance(step);
+    }
+
+    // Report
+    const SimChipStats& stats = as3935.getStats();
+    unsigned long recordedLightnings = detector.getLightnings().getSequence();
+    unsigned long lost = stats.reported[SIM_LIGHTNING] - recordedLightnings;
+    std::vector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    double latencySum = 0.0;
+    for (double latency : sorted) {
+        latencySum += latency;
+    }
+    long timeErrorMax = 0;
+    double timeErrorSum = 0.0;
+    for (long error : timeErrors) {
+        timeErrorSum += labs(error);
+        timeErrorMax = std::max(timeErrorMax, labs(error));
+    }
+
+    printf("Calibration:     %lu Hz (tuning %d), %.3f s\n",
+        frequency, as3935.getRegister(0x08) & 0x0F, calibrationTime / 1000000.0);
+    printf("Setup:           %lu SPI transactions, %lu frames\n", setupTransactions, setupFrames);
+    printf("Simulated:       %.3f s, %lu loop iterations, %lu stalls\n",
+        (end - start) / 1000000.0, iterations, stalls);
+    printf("Injected:        %lu lightnings, %lu disturbers, %lu noise changes\n",
+        stats.injected[SIM_LIGHTNING], stats.injected[SIM_DISTURBER], stats.injected[SIM_NOISE]);
+    printf("Chip reported:   %lu lightnings, %lu disturbers, %lu noise interrupts\n",
+        stats.reported[SIM_LIGHTNING], stats.reported[SIM_DISTURBER], stats.reported[SIM_NOISE]);
+    printf("Chip ignored:    %lu rejected, %lu suppressed, %lu deafened by noise, %lu masked\n",
+        stats.rejected, stats.suppressed, stats.deafened, stats.masked);
+    printf("Driver recorded: %lu lightnings, %lu disturbers, %lu noise floor changes\n",
+        recordedLightnings, recordedDisturbers, noiseFloorChanges);
+    printf("Rates:           %u/%u/%u lightnings, %u/%u/%u disturbers, %u/%u/%u noise (1/5/15 min)\n",
+        detector.getLightningCount(RATE_1_MIN), detector.getLightningCount(RATE_5_MIN),
+        detector.getLightningCount(RATE_15_MIN), detector.getDisturberCount(RATE_1_MIN),
+        detector.getDisturberCount(RATE_5_MIN), detector.getDisturberCount(RATE_15_MIN),
+        detector.getNoiseCount(RATE_1_MIN), detector.getNoiseCount(RATE_5_MIN),
+        detector.getNoiseCount(RATE_15_MIN));
+    StormStatus storm;
+    detector.getStormStatus(storm);
+    printf("Storm:           %u lightnings, closest %d km, %.1f km, %.1f km/h, eta %ld s, %.2f/min, trend %d\n",
+        storm.strikes, storm.closest, storm.distance, storm.speed, storm.eta, storm.rate, storm.trend);
+    printf("Event loss:      %lu lightnings, %lu overwritten while unread, %lu lost interrupts\n",
+        lost, stats.merged, detector.getLostInterrupts());
+    printf("Noise floor:     %.3f s too high (avg %.2f levels), %.3f s too low, final level %d\n",
+        tooHighTime / 1000000.0, tooHighTime > 0 ? (double) excessLevelTime / tooHighTime : 0.0,
+        tooLowTime / 1000000.0, (as3935.getRegister(0x01) >> 4) & 0x07);
+    int finalWatchdog = as3935.getRegister(0x01) & 0x0F;
+    int finalSpikeRejection = as3935.getRegister(0x02) & 0x0F;
+    bool drifted = finalWatchdog != cfgMgr.config.watchdogThreshold
+        || finalSpikeRejection != cfgMgr.config.spikeRejection;
+    printf("Settings:        watchdog %d (configured %d), spike rejection %d (configured %d)\n",
+        finalWatchdog, cfgMgr.config.watchdogThreshold, finalSpikeRejection, cfgMgr.config.spikeRejection);
+    printf("Latency:         min %.3f, avg %.3f, p50 %.3f, p99 %.3f, max %.3f ms\n",
+        percentile(sorted, 0.0), sorted.empty() ? 0.0 : latencySum / sorted.size(),
+        percentile(sorted, 0.5), percentile(sorted, 0.99), percentile(sorted, 1.0));
+    printf("Time error:      avg %.3f, max %ld ms\n",
+        timeErrors.empty() ? 0.0 : timeErrorSum / timeErrors.size(), timeErrorMax);
+    printf("update():        %lu changes, avg %.0f ns, max %.0f ns (host)\n",
+        changes, iterations > 0 ? hostNanos / iterations : 0.0, hostMaxNanos);
+    printf("SPI:             %lu transactions, %lu frames, %lu bytes\n",
+        SPI.transactions - spiTransactionsBefore, stats.spiFrames - statsBefore.spiFrames,
+        stats.spiBytes - statsBefore.spiBytes);
+    printQuantiles("Energy:", detector.getEnergyQuantiles(), energies);
+    printQuantiles("Distance:", detector.getDistanceQuantiles(), distances);
+
+    if (opt.replay != NULL) {
+        unsigned long fieldLost = 0;
+        unsigned long delaySum = 0;
+        unsigned int delayMax = 0;
+        for (const CaptureRecord& record : captured) {
+            if (record.detector == opt.detector) {
+                fieldLost += record.lost;
+                delaySum += record.delay;
+                delayMax = std::max(delayMax, (unsigned int) record.delay);
+            }
+        }
+        printf("Replay:          %lu interrupts, %lu with diverging settings, %lu overwritten in the capture\n",
+            (unsigned long) events.size(), stats.diverged, (unsigned long) captureHeader.overwritten);
+        printf("Field:           %lu lost interrupts, read delay avg %.0f, max %u us\n",
+            fieldLost, events.empty() ? 0.0 : (double) delaySum / events.size(), delayMax);
+    }
+
+    if (opt.capture != NULL) {
+        FILE* out = fopen(opt.capture, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "Cannot write %s\n", opt.capture);
+            return 2;
+        }
+        FilePrint print(out);
+        captureRing.write(print, 0);
+        fclose(out);
+    }
+
+    if (opt.failOnDivergence && stats.diverged > 0) {
+        return 1;
+    }
+    if (opt.failOnNoApproach && !(storm.speed > 0.0f && storm.eta >= 0)) {
+        return 1;
+    }
+    if (opt.failOnDrift && drifted) {
+        return 1;
+    }
+    if (opt.maxSetup >= 0 && setupTransactions > (unsigned long) opt.maxSetup) {
+        return 1;
+    }
+    return opt.failOnLoss && lost > 0 ? 1 : 0;
+}